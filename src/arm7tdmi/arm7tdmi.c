@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <string.h>
 #include <stdbool.h>
 #include "arm7tdmi.h"
 #include "../common/log.h"
@@ -34,6 +35,8 @@
 #include "../graphics/debug.h"
 #include "../disassemble.h"
 #include "arm_instr/arm_software_interrupt.h"
+#include "block_cache.h"
+#include "jit.h"
 
 const char MODE_NAMES[32][11] = {
 "UNKNOWN",    // 0b00000
@@ -114,6 +117,319 @@ void set_pc(arm7tdmi_t* state, word new_pc) {
     fill_pipe(state);
 }
 
+static void arm_data_processing(arm7tdmi_t* state, arminstr_t* instr, arm_operands_t* ops) {
+    data_processing(state, &instr->parsed.DATA_PROCESSING, ops);
+}
+
+static void arm_status_transfer(arm7tdmi_t* state, arminstr_t* instr, arm_operands_t* ops) {
+    psr_transfer(state,
+                 instr->parsed.DATA_PROCESSING.immediate,
+                 instr->parsed.DATA_PROCESSING.opcode,
+                 instr->parsed.DATA_PROCESSING.rn,
+                 instr->parsed.DATA_PROCESSING.rd,
+                 instr->parsed.DATA_PROCESSING.operand2);
+}
+
+static void arm_multiply(arm7tdmi_t* state, arminstr_t* instr, arm_operands_t* ops) {
+    multiply(state, &instr->parsed.MULTIPLY);
+}
+
+static void arm_multiply_long(arm7tdmi_t* state, arminstr_t* instr, arm_operands_t* ops) {
+    multiply_long(state, &instr->parsed.MULTIPLY_LONG);
+}
+
+static void arm_single_data_swap(arm7tdmi_t* state, arminstr_t* instr, arm_operands_t* ops) {
+    single_data_swap(state, &instr->parsed.SINGLE_DATA_SWAP);
+}
+
+static void arm_branch_exchange(arm7tdmi_t* state, arminstr_t* instr, arm_operands_t* ops) {
+    branch_exchange(state, &instr->parsed.BRANCH_EXCHANGE);
+}
+
+static void arm_halfword_dt_ro(arm7tdmi_t* state, arminstr_t* instr, arm_operands_t* ops) {
+    halfword_dt_ro(state,
+                   instr->parsed.HALFWORD_DT_RO.p,
+                   instr->parsed.HALFWORD_DT_RO.u,
+                   instr->parsed.HALFWORD_DT_RO.w,
+                   instr->parsed.HALFWORD_DT_RO.l,
+                   ops->rn,
+                   ops->rd,
+                   instr->parsed.HALFWORD_DT_RO.s,
+                   instr->parsed.HALFWORD_DT_RO.h,
+                   ops->rm);
+}
+
+static void arm_halfword_dt_io(arm7tdmi_t* state, arminstr_t* instr, arm_operands_t* ops) {
+    halfword_dt_io(state,
+                   instr->parsed.HALFWORD_DT_IO.p,
+                   instr->parsed.HALFWORD_DT_IO.u,
+                   instr->parsed.HALFWORD_DT_IO.w,
+                   instr->parsed.HALFWORD_DT_IO.l,
+                   ops->rn,
+                   ops->rd,
+                   ops->immediate,
+                   instr->parsed.HALFWORD_DT_IO.s,
+                   instr->parsed.HALFWORD_DT_IO.h);
+}
+
+static void arm_single_data_transfer(arm7tdmi_t* state, arminstr_t* instr, arm_operands_t* ops) {
+    single_data_transfer(state,
+                         ops,
+                         instr->parsed.SINGLE_DATA_TRANSFER.l,
+                         instr->parsed.SINGLE_DATA_TRANSFER.w,
+                         instr->parsed.SINGLE_DATA_TRANSFER.b,
+                         instr->parsed.SINGLE_DATA_TRANSFER.u,
+                         instr->parsed.SINGLE_DATA_TRANSFER.p);
+}
+
+static void arm_block_data_transfer(arm7tdmi_t* state, arminstr_t* instr, arm_operands_t* ops) {
+    block_data_transfer(state, &instr->parsed.BLOCK_DATA_TRANSFER);
+}
+
+static void arm_branch(arm7tdmi_t* state, arminstr_t* instr, arm_operands_t* ops) {
+    branch(state, &instr->parsed.BRANCH);
+}
+
+static void arm_swi(arm7tdmi_t* state, arminstr_t* instr, arm_operands_t* ops) {
+    arm_software_interrupt(state, &instr->parsed.SOFTWARE_INTERRUPT);
+}
+
+static void arm_undefined(arm7tdmi_t* state, arminstr_t* instr, arm_operands_t* ops) {
+    logfatal("Unimplemented instruction type: UNDEFINED (0x%08X)", instr->raw)
+}
+
+static void arm_coprocessor_data_transfer(arm7tdmi_t* state, arminstr_t* instr, arm_operands_t* ops) {
+    logfatal("Unimplemented instruction type: COPROCESSOR_DATA_TRANSFER (0x%08X)", instr->raw)
+}
+
+static void arm_coprocessor_data_operation(arm7tdmi_t* state, arminstr_t* instr, arm_operands_t* ops) {
+    logfatal("Unimplemented instruction type: COPROCESSOR_DATA_OPERATION (0x%08X)", instr->raw)
+}
+
+static void arm_coprocessor_register_transfer(arm7tdmi_t* state, arminstr_t* instr, arm_operands_t* ops) {
+    logfatal("Unimplemented instruction type: COPROCESSOR_REGISTER_TRANSFER (0x%08X)", instr->raw)
+}
+
+arm_handler_t arm_handlers[ARM_INSTR_HASH_SIZE];
+byte arm_types[ARM_INSTR_HASH_SIZE];
+
+// Runs the slow decoder once for every possible hash, so decoding an instruction is a single table lookup.
+static void init_arm_handlers() {
+    for (word hash = 0; hash < ARM_INSTR_HASH_SIZE; hash++) {
+        arminstr_t instr;
+        instr.raw = ((hash & 0xFF0u) << 16u) | ((hash & 0xFu) << 4u);
+        arm_types[hash] = get_arm_instr_type(&instr);
+        switch (arm_types[hash]) {
+            case DATA_PROCESSING:
+                arm_handlers[hash] = arm_data_processing;
+                break;
+            case STATUS_TRANSFER:
+                arm_handlers[hash] = arm_status_transfer;
+                break;
+            case MULTIPLY:
+                arm_handlers[hash] = arm_multiply;
+                break;
+            case MULTIPLY_LONG:
+                arm_handlers[hash] = arm_multiply_long;
+                break;
+            case SINGLE_DATA_SWAP:
+                arm_handlers[hash] = arm_single_data_swap;
+                break;
+            case BRANCH_EXCHANGE:
+                arm_handlers[hash] = arm_branch_exchange;
+                break;
+            case HALFWORD_DT_RO:
+                arm_handlers[hash] = arm_halfword_dt_ro;
+                break;
+            case HALFWORD_DT_IO:
+                arm_handlers[hash] = arm_halfword_dt_io;
+                break;
+            case SINGLE_DATA_TRANSFER:
+                arm_handlers[hash] = arm_single_data_transfer;
+                break;
+            case UNDEFINED:
+                arm_handlers[hash] = arm_undefined;
+                break;
+            case BLOCK_DATA_TRANSFER:
+                arm_handlers[hash] = arm_block_data_transfer;
+                break;
+            case BRANCH:
+                arm_handlers[hash] = arm_branch;
+                break;
+            case COPROCESSOR_DATA_TRANSFER:
+                arm_handlers[hash] = arm_coprocessor_data_transfer;
+                break;
+            case COPROCESSOR_DATA_OPERATION:
+                arm_handlers[hash] = arm_coprocessor_data_operation;
+                break;
+            case COPROCESSOR_REGISTER_TRANSFER:
+                arm_handlers[hash] = arm_coprocessor_register_transfer;
+                break;
+            case SOFTWARE_INTERRUPT:
+                arm_handlers[hash] = arm_swi;
+                break;
+            default:
+                logfatal("Hit default case in init_arm_handlers switch. This should never happen!")
+        }
+    }
+}
+
+static void thumb_move_shifted_register(arm7tdmi_t* state, thumbinstr_t* instr) {
+    move_shifted_register(state, &instr->MOVE_SHIFTED_REGISTER);
+}
+
+static void thumb_add_subtract(arm7tdmi_t* state, thumbinstr_t* instr) {
+    add_subtract(state, &instr->ADD_SUBTRACT);
+}
+
+static void thumb_immediate_operations(arm7tdmi_t* state, thumbinstr_t* instr) {
+    immediate_operations(state, &instr->IMMEDIATE_OPERATIONS);
+}
+
+static void thumb_alu_operations(arm7tdmi_t* state, thumbinstr_t* instr) {
+    alu_operations(state, &instr->ALU_OPERATIONS);
+}
+
+static void thumb_high_register_operations(arm7tdmi_t* state, thumbinstr_t* instr) {
+    high_register_operations(state, &instr->HIGH_REGISTER_OPERATIONS);
+}
+
+static void thumb_pc_relative_load(arm7tdmi_t* state, thumbinstr_t* instr) {
+    pc_relative_load(state, &instr->PC_RELATIVE_LOAD);
+}
+
+static void thumb_load_store_ro(arm7tdmi_t* state, thumbinstr_t* instr) {
+    load_store_ro(state, &instr->LOAD_STORE_RO);
+}
+
+static void thumb_load_store_byte_halfword(arm7tdmi_t* state, thumbinstr_t* instr) {
+    load_store_byte_halfword(state, &instr->LOAD_STORE_BYTE_HALFWORD);
+}
+
+static void thumb_load_store_io(arm7tdmi_t* state, thumbinstr_t* instr) {
+    load_store_io(state, &instr->LOAD_STORE_IO);
+}
+
+static void thumb_load_store_halfword(arm7tdmi_t* state, thumbinstr_t* instr) {
+    load_store_halfword(state, &instr->LOAD_STORE_HALFWORD);
+}
+
+static void thumb_sp_relative_load_store(arm7tdmi_t* state, thumbinstr_t* instr) {
+    sp_relative_load_store(state, &instr->SP_RELATIVE_LOAD_STORE);
+}
+
+static void thumb_load_address(arm7tdmi_t* state, thumbinstr_t* instr) {
+    load_address(state, &instr->LOAD_ADDRESS);
+}
+
+static void thumb_add_offset_to_stack_pointer(arm7tdmi_t* state, thumbinstr_t* instr) {
+    add_offset_to_stack_pointer(state, &instr->ADD_OFFSET_TO_STACK_POINTER);
+}
+
+static void thumb_push_pop_registers(arm7tdmi_t* state, thumbinstr_t* instr) {
+    push_pop_registers(state, &instr->PUSH_POP_REGISTERS);
+}
+
+static void thumb_multiple_load_store(arm7tdmi_t* state, thumbinstr_t* instr) {
+    multiple_load_store(state, &instr->MULTIPLE_LOAD_STORE);
+}
+
+static void thumb_conditional_branch(arm7tdmi_t* state, thumbinstr_t* instr) {
+    conditional_branch(state, &instr->CONDITIONAL_BRANCH);
+}
+
+static void thumb_swi(arm7tdmi_t* state, thumbinstr_t* instr) {
+    thumb_software_interrupt(state, &instr->THUMB_SOFTWARE_INTERRUPT);
+}
+
+static void thumb_unconditional_branch(arm7tdmi_t* state, thumbinstr_t* instr) {
+    unconditional_branch(state, &instr->UNCONDITIONAL_BRANCH);
+}
+
+static void thumb_long_branch_link(arm7tdmi_t* state, thumbinstr_t* instr) {
+    long_branch_link(state, &instr->LONG_BRANCH_LINK);
+}
+
+static void thumb_undefined(arm7tdmi_t* state, thumbinstr_t* instr) {
+    logfatal("Unimplemented THUMB mode instruction type: THUMB_UNDEFINED (0x%04X)", instr->raw)
+}
+
+thumb_handler_t thumb_handlers[THUMB_INSTR_HASH_SIZE];
+byte thumb_types[THUMB_INSTR_HASH_SIZE];
+
+// THUMB_UNDEFINED encodings land in thumb_undefined, so the step loop never needs to check for them.
+static void init_thumb_handlers() {
+    for (half hash = 0; hash < THUMB_INSTR_HASH_SIZE; hash++) {
+        thumbinstr_t instr;
+        instr.raw = hash << 6u;
+        thumb_types[hash] = get_thumb_instr_type(&instr);
+        switch (thumb_types[hash]) {
+            case MOVE_SHIFTED_REGISTER:
+                thumb_handlers[hash] = thumb_move_shifted_register;
+                break;
+            case ADD_SUBTRACT:
+                thumb_handlers[hash] = thumb_add_subtract;
+                break;
+            case IMMEDIATE_OPERATIONS:
+                thumb_handlers[hash] = thumb_immediate_operations;
+                break;
+            case ALU_OPERATIONS:
+                thumb_handlers[hash] = thumb_alu_operations;
+                break;
+            case HIGH_REGISTER_OPERATIONS:
+                thumb_handlers[hash] = thumb_high_register_operations;
+                break;
+            case PC_RELATIVE_LOAD:
+                thumb_handlers[hash] = thumb_pc_relative_load;
+                break;
+            case LOAD_STORE_RO:
+                thumb_handlers[hash] = thumb_load_store_ro;
+                break;
+            case LOAD_STORE_BYTE_HALFWORD:
+                thumb_handlers[hash] = thumb_load_store_byte_halfword;
+                break;
+            case LOAD_STORE_IO:
+                thumb_handlers[hash] = thumb_load_store_io;
+                break;
+            case LOAD_STORE_HALFWORD:
+                thumb_handlers[hash] = thumb_load_store_halfword;
+                break;
+            case SP_RELATIVE_LOAD_STORE:
+                thumb_handlers[hash] = thumb_sp_relative_load_store;
+                break;
+            case LOAD_ADDRESS:
+                thumb_handlers[hash] = thumb_load_address;
+                break;
+            case ADD_OFFSET_TO_STACK_POINTER:
+                thumb_handlers[hash] = thumb_add_offset_to_stack_pointer;
+                break;
+            case PUSH_POP_REGISTERS:
+                thumb_handlers[hash] = thumb_push_pop_registers;
+                break;
+            case MULTIPLE_LOAD_STORE:
+                thumb_handlers[hash] = thumb_multiple_load_store;
+                break;
+            case CONDITIONAL_BRANCH:
+                thumb_handlers[hash] = thumb_conditional_branch;
+                break;
+            case THUMB_SOFTWARE_INTERRUPT:
+                thumb_handlers[hash] = thumb_swi;
+                break;
+            case UNCONDITIONAL_BRANCH:
+                thumb_handlers[hash] = thumb_unconditional_branch;
+                break;
+            case LONG_BRANCH_LINK:
+                thumb_handlers[hash] = thumb_long_branch_link;
+                break;
+            case THUMB_UNDEFINED:
+                thumb_handlers[hash] = thumb_undefined;
+                break;
+            default:
+                logfatal("Hit default case in init_thumb_handlers switch. This should never happen!")
+        }
+    }
+}
+
 arm7tdmi_t* init_arm7tdmi(byte (*read_byte)(word),
                           half (*read_half)(word),
                           word (*read_word)(word),
@@ -122,6 +438,9 @@ arm7tdmi_t* init_arm7tdmi(byte (*read_byte)(word),
                           void (*write_word)(word, word)) {
     arm7tdmi_t* state = malloc(sizeof(arm7tdmi_t));
 
+    init_arm_handlers();
+    init_thumb_handlers();
+
     state->read_byte  = read_byte;
     state->read_half  = read_half;
     state->read_word  = read_word;
@@ -129,96 +448,75 @@ arm7tdmi_t* init_arm7tdmi(byte (*read_byte)(word),
     state->write_half = write_half;
     state->write_word = write_word;
 
-    state->pc       = 0x00000000;
+    // Start out in system mode, with every banked register cleared
+    memset(state->r, 0, sizeof(state->r));
+    memset(state->highreg_usr, 0, sizeof(state->highreg_usr));
+    memset(state->highreg_fiq, 0, sizeof(state->highreg_fiq));
+
     state->sp       = 0x03007F00;
     state->lr       = 0x08000000;
-    state->cpsr.raw = 0x0000005F;
-
-    for (int r = 0; r < 13; r++) {
-        state->r[r] = 0;
-    }
+    state->spsr.raw = 0x00000000;
+    state->cpsr.mode = MODE_SYSTEM; // So set_psr doesn't have anything to swap
+    set_psr(state, 0x0000005F);
 
+    state->sp_usr = 0x00000000;
     state->sp_fiq = 0x00000000;
     state->sp_svc = 0x00000000;
     state->sp_abt = 0x00000000;
     state->sp_irq = 0x00000000;
     state->sp_und = 0x00000000;
 
+    state->lr_usr = 0x00000000;
     state->lr_fiq = 0x00000000;
     state->lr_svc = 0x00000000;
     state->lr_abt = 0x00000000;
     state->lr_irq = 0x00000000;
     state->lr_und = 0x00000000;
 
-    state->highreg_fiq[0] = 0;
-    state->highreg_fiq[1] = 0;
-    state->highreg_fiq[2] = 0;
-    state->highreg_fiq[3] = 0;
-    state->highreg_fiq[4] = 0;
+    state->spsr_usr.raw = 0x00000000;
+    state->spsr_fiq.raw = 0x00000000;
+    state->spsr_svc.raw = 0x00000000;
+    state->spsr_abt.raw = 0x00000000;
+    state->spsr_irq.raw = 0x00000000;
+    state->spsr_und.raw = 0x00000000;
 
     state->irq = false;
     state->halt = false;
+    state->exit_block = false;
+    state->idle = false;
+    state->idle_block = NULL;
 
     fill_pipe(state);
     return state;
 }
 
-// EQ, NE, CS, CC, MI, PL, VS, VC, HI, LS, GE, LT, GT, LE, AL, NV
+// Which of the 16 NZCV combinations have each flag set
+#define FLAG_N 0xFF00
+#define FLAG_Z 0xF0F0
+#define FLAG_C 0xCCCC
+#define FLAG_V 0xAAAA
+
+const half cond_table[16] = {
+    [EQ] = FLAG_Z,
+    [NE] = (half)~FLAG_Z,
+    [CS] = FLAG_C,
+    [CC] = (half)~FLAG_C,
+    [MI] = FLAG_N,
+    [PL] = (half)~FLAG_N,
+    [VS] = FLAG_V,
+    [VC] = (half)~FLAG_V,
+    [HI] = FLAG_C & ~FLAG_Z,
+    [LS] = (half)~(FLAG_C & ~FLAG_Z),
+    [GE] = (half)~(FLAG_N ^ FLAG_V),
+    [LT] = FLAG_N ^ FLAG_V,
+    [GT] = (half)(~FLAG_Z & ~(FLAG_N ^ FLAG_V)),
+    [LE] = (half)~(~FLAG_Z & ~(FLAG_N ^ FLAG_V)),
+    [AL] = 0xFFFF,
+    [NV] = 0x0000
+};
+
 bool check_cond(arm7tdmi_t* state, arminstr_t* instr) {
-    bool passed = false;
-    switch (instr->parsed.cond) {
-        case EQ:
-            passed = state->cpsr.Z == 1;
-            break;
-        case NE:
-            passed = state->cpsr.Z == 0;
-            break;
-        case CS:
-            passed = state->cpsr.C == 1;
-            break;
-        case CC:
-            passed = state->cpsr.C == 0;
-            break;
-        case MI:
-            passed = state->cpsr.N == 1;
-            break;
-        case PL:
-            passed = state->cpsr.N == 0;
-            break;
-        case VS:
-            passed = state->cpsr.V == 1;
-            break;
-        case VC:
-            passed = state->cpsr.V == 0;
-            break;
-        case HI:
-            passed = state->cpsr.C == 1 && state->cpsr.Z == 0;
-            break;
-        case LS:
-            passed = state->cpsr.C == 0 || state->cpsr.Z == 1;
-            break;
-        case GE:
-            passed = (!state->cpsr.N == !state->cpsr.V);
-            break;
-        case LT:
-            passed = (!state->cpsr.N != !state->cpsr.V);
-            break;
-        case GT:
-            passed = (!state->cpsr.Z && !state->cpsr.N == !state->cpsr.V);
-            break;
-        case LE:
-            passed = (state->cpsr.Z || !state->cpsr.N != !state->cpsr.V);
-            break;
-        case AL:
-            passed = true;
-            break;
-        case NV:
-            passed = false;
-            break;
-        default:
-            logfatal("Unimplemented COND: %d", instr->parsed.cond)
-    }
-    return passed;
+    return cond_passed(state, instr->parsed.cond);
 }
 
 
@@ -246,121 +544,90 @@ thumbinstr_t next_thumb_instr(arm7tdmi_t* state) {
     return instr;
 }
 
-void set_sp(arm7tdmi_t* state, word newvalue) {
-    switch (state->cpsr.mode) {
-        case MODE_FIQ:
-            state->sp_fiq = newvalue;
-            break;
-        case MODE_SUPERVISOR:
-            state->sp_svc = newvalue;
-            break;
-        case MODE_ABORT:
-            state->sp_abt = newvalue;
-            break;
-        case MODE_IRQ:
-            state->sp_irq = newvalue;
-            break;
-        case MODE_UNDEFINED:
-            state->sp_und = newvalue;
-            break;
-        default:
-            state->sp = newvalue;
-            break;
+void set_register(arm7tdmi_t* state, word index, word newvalue) {
+    logdebug("Set r%d to 0x%08X", index, newvalue)
+
+    if (index == REG_PC) {
+        set_pc(state, newvalue);
+    } else {
+        state->r[index] = newvalue;
     }
 }
 
-word get_sp(arm7tdmi_t* state) {
-    switch (state->cpsr.mode) {
+INLINE word* banked_sp(arm7tdmi_t* state, unsigned mode) {
+    switch (mode) {
         case MODE_FIQ:
-            return state->sp_fiq;
+            return &state->sp_fiq;
         case MODE_SUPERVISOR:
-            return state->sp_svc;
+            return &state->sp_svc;
         case MODE_ABORT:
-            return state->sp_abt;
+            return &state->sp_abt;
         case MODE_IRQ:
-            return state->sp_irq;
+            return &state->sp_irq;
         case MODE_UNDEFINED:
-            return state->sp_und;
+            return &state->sp_und;
         default:
-            return state->sp;
+            return &state->sp_usr;
     }
 }
 
-void set_lr(arm7tdmi_t* state, word newvalue) {
-    switch (state->cpsr.mode) {
+INLINE word* banked_lr(arm7tdmi_t* state, unsigned mode) {
+    switch (mode) {
         case MODE_FIQ:
-            state->lr_fiq = newvalue;
-            break;
+            return &state->lr_fiq;
         case MODE_SUPERVISOR:
-            state->lr_svc = newvalue;
-            break;
+            return &state->lr_svc;
         case MODE_ABORT:
-            state->lr_abt = newvalue;
-            break;
+            return &state->lr_abt;
         case MODE_IRQ:
-            state->lr_irq = newvalue;
-            break;
+            return &state->lr_irq;
         case MODE_UNDEFINED:
-            state->lr_und = newvalue;
-            break;
+            return &state->lr_und;
         default:
-            state->lr = newvalue;
-            break;
+            return &state->lr_usr;
     }
 }
 
-word get_lr(arm7tdmi_t* state) {
-    switch (state->cpsr.mode) {
+INLINE status_register_t* banked_spsr(arm7tdmi_t* state, unsigned mode) {
+    switch (mode) {
         case MODE_FIQ:
-            return state->lr_fiq;
+            return &state->spsr_fiq;
         case MODE_SUPERVISOR:
-            return state->lr_svc;
+            return &state->spsr_svc;
         case MODE_ABORT:
-            return state->lr_abt;
+            return &state->spsr_abt;
         case MODE_IRQ:
-            return state->lr_irq;
+            return &state->spsr_irq;
         case MODE_UNDEFINED:
-            return state->lr_und;
+            return &state->spsr_und;
         default:
-            return state->lr;
+            return &state->spsr_usr;
     }
 }
 
-void set_register(arm7tdmi_t* state, word index, word newvalue) {
-    logdebug("Set r%d to 0x%08X", index, newvalue)
+void set_mode(arm7tdmi_t* state, unsigned mode) {
+    unsigned old_mode = state->cpsr.mode;
+    if (mode == old_mode) {
+        return;
+    }
+    logdebug("Switching from %s mode to %s mode", MODE_NAMES[old_mode], MODE_NAMES[mode])
 
-    if (state->cpsr.mode == MODE_FIQ && index >= 8 && index <= 12) {
-        state->highreg_fiq[index - 8] = newvalue;
-    } else if (index < 13) {
-        state->r[index] = newvalue;
-    } else if (index == 13) {
-        set_sp(state, newvalue);
-    } else if (index == 14) {
-        set_lr(state, newvalue);
-    } else if (index == 15) {
-        set_pc(state, newvalue);
-    } else {
-        logfatal("Attempted to write unknown register: r%d", index)
-    }
-}
-
-word get_register(arm7tdmi_t* state, word index) {
-    word value = 0;
-    if (state->cpsr.mode == MODE_FIQ && index >= 8 && index <= 12) {
-        value = state->highreg_fiq[index - 8];
-    } else if (index < 13) {
-        value = state->r[index];
-    } else if (index == 13) {
-        value = get_sp(state);
-    } else if (index == 14) {
-        value = get_lr(state);
-    } else if (index == 15) {
-        value = state->pc;
-    } else {
-        logfatal("Attempted to read unknown register: r%d", index)
+    *banked_sp(state, old_mode) = state->sp;
+    *banked_lr(state, old_mode) = state->lr;
+    *banked_spsr(state, old_mode) = state->spsr;
+
+    if (old_mode == MODE_FIQ) {
+        memcpy(state->highreg_fiq, &state->r[8], sizeof(state->highreg_fiq));
+        memcpy(&state->r[8], state->highreg_usr, sizeof(state->highreg_usr));
+    } else if (mode == MODE_FIQ) {
+        memcpy(state->highreg_usr, &state->r[8], sizeof(state->highreg_usr));
+        memcpy(&state->r[8], state->highreg_fiq, sizeof(state->highreg_fiq));
     }
 
-    return value;
+    state->cpsr.mode = mode;
+    state->sp = *banked_sp(state, mode);
+    state->lr = *banked_lr(state, mode);
+    state->spsr = *banked_spsr(state, mode);
 }
 
 #define cpsrflag(f, c) (f == 1?c:"-")
@@ -368,89 +635,9 @@ word get_register(arm7tdmi_t* state, word index) {
 int arm_mode_step(arm7tdmi_t* state, arminstr_t* instr) {
     logdebug("cond: %d", instr->parsed.cond)
     if (check_cond(state, instr)) {
-        arm_instr_type_t type = get_arm_instr_type(instr);
-        switch (type) {
-            case DATA_PROCESSING:
-                data_processing(state, &instr->parsed.DATA_PROCESSING);
-                break;
-            case STATUS_TRANSFER:
-                psr_transfer(state,
-                             instr->parsed.DATA_PROCESSING.immediate,
-                             instr->parsed.DATA_PROCESSING.opcode,
-                             instr->parsed.DATA_PROCESSING.rn,
-                             instr->parsed.DATA_PROCESSING.rd,
-                             instr->parsed.DATA_PROCESSING.operand2);
-                break;
-            case MULTIPLY:
-                multiply(state, &instr->parsed.MULTIPLY);
-                break;
-            case MULTIPLY_LONG:
-                multiply_long(state, &instr->parsed.MULTIPLY_LONG);
-                break;
-            case SINGLE_DATA_SWAP:
-                single_data_swap(state, &instr->parsed.SINGLE_DATA_SWAP);
-                break;
-            case BRANCH_EXCHANGE:
-                branch_exchange(state, &instr->parsed.BRANCH_EXCHANGE);
-                break;
-            case HALFWORD_DT_RO:
-                halfword_dt_ro(state,
-                               instr->parsed.HALFWORD_DT_RO.p,
-                               instr->parsed.HALFWORD_DT_RO.u,
-                               instr->parsed.HALFWORD_DT_RO.w,
-                               instr->parsed.HALFWORD_DT_RO.l,
-                               instr->parsed.HALFWORD_DT_RO.rn,
-                               instr->parsed.HALFWORD_DT_RO.rd,
-                               instr->parsed.HALFWORD_DT_RO.s,
-                               instr->parsed.HALFWORD_DT_RO.h,
-                               instr->parsed.HALFWORD_DT_RO.rm);
-                break;
-            case HALFWORD_DT_IO: {
-                byte offset = instr->parsed.HALFWORD_DT_IO.offset_low | (instr->parsed.HALFWORD_DT_IO.offset_high << 4u);
-                halfword_dt_io(state,
-                               instr->parsed.HALFWORD_DT_IO.p,
-                               instr->parsed.HALFWORD_DT_IO.u,
-                               instr->parsed.HALFWORD_DT_IO.w,
-                               instr->parsed.HALFWORD_DT_IO.l,
-                               instr->parsed.HALFWORD_DT_IO.rn,
-                               instr->parsed.HALFWORD_DT_IO.rd,
-                               offset,
-                               instr->parsed.HALFWORD_DT_IO.s,
-                               instr->parsed.HALFWORD_DT_IO.h);
-                break;
-            }
-            case SINGLE_DATA_TRANSFER:
-                single_data_transfer(state,
-                                     instr->parsed.SINGLE_DATA_TRANSFER.offset,
-                                     instr->parsed.SINGLE_DATA_TRANSFER.rd,
-                                     instr->parsed.SINGLE_DATA_TRANSFER.rn,
-                                     instr->parsed.SINGLE_DATA_TRANSFER.l,
-                                     instr->parsed.SINGLE_DATA_TRANSFER.w,
-                                     instr->parsed.SINGLE_DATA_TRANSFER.b,
-                                     instr->parsed.SINGLE_DATA_TRANSFER.u,
-                                     instr->parsed.SINGLE_DATA_TRANSFER.p,
-                                     instr->parsed.SINGLE_DATA_TRANSFER.i);
-                break;
-            case UNDEFINED:
-                logfatal("Unimplemented instruction type: UNDEFINED")
-            case BLOCK_DATA_TRANSFER:
-                block_data_transfer(state, &instr->parsed.BLOCK_DATA_TRANSFER);
-                break;
-            case BRANCH:
-                branch(state, &instr->parsed.BRANCH);
-                break;
-            case COPROCESSOR_DATA_TRANSFER:
-                logfatal("Unimplemented instruction type: COPROCESSOR_DATA_TRANSFER")
-            case COPROCESSOR_DATA_OPERATION:
-                logfatal("Unimplemented instruction type: COPROCESSOR_DATA_OPERATION")
-            case COPROCESSOR_REGISTER_TRANSFER:
-                logfatal("Unimplemented instruction type: COPROCESSOR_REGISTER_TRANSFER")
-            case SOFTWARE_INTERRUPT:
-                arm_software_interrupt(state, &instr->parsed.SOFTWARE_INTERRUPT);
-                break;
-            default:
-                logfatal("Hit default case in arm_mode_step switch. This should never happen!")
-        }
+        arm_operands_t ops;
+        decode_arm_operands(instr, &ops);
+        get_arm_handler(instr)(state, instr, &ops);
     }
     else { // Cond told us not to execute this instruction
         logdebug("Skipping instr because cond %d was not met.", instr->parsed.cond)
@@ -460,94 +647,23 @@ int arm_mode_step(arm7tdmi_t* state, arminstr_t* instr) {
 }
 
 int thumb_mode_step(arm7tdmi_t* state, thumbinstr_t* instr) {
-    thumb_instr_type_t type = get_thumb_instr_type(instr);
-
-    switch (type) {
-        case MOVE_SHIFTED_REGISTER:
-            move_shifted_register(state, &instr->MOVE_SHIFTED_REGISTER);
-            break;
-        case ADD_SUBTRACT:
-            add_subtract(state, &instr->ADD_SUBTRACT);
-            break;
-        case IMMEDIATE_OPERATIONS:
-            immediate_operations(state, &instr->IMMEDIATE_OPERATIONS);
-            break;
-        case ALU_OPERATIONS:
-            alu_operations(state, &instr->ALU_OPERATIONS);
-            break;
-        case HIGH_REGISTER_OPERATIONS:
-            high_register_operations(state, &instr->HIGH_REGISTER_OPERATIONS);
-            break;
-        case PC_RELATIVE_LOAD:
-            pc_relative_load(state, &instr->PC_RELATIVE_LOAD);
-            break;
-        case LOAD_STORE_RO:
-            load_store_ro(state, &instr->LOAD_STORE_RO);
-            break;
-        case LOAD_STORE_BYTE_HALFWORD:
-            load_store_byte_halfword(state, &instr->LOAD_STORE_BYTE_HALFWORD);
-            break;
-        case LOAD_STORE_IO:
-            load_store_io(state, &instr->LOAD_STORE_IO);
-            break;
-        case LOAD_STORE_HALFWORD:
-            load_store_halfword(state, &instr->LOAD_STORE_HALFWORD);
-            break;
-        case SP_RELATIVE_LOAD_STORE:
-            sp_relative_load_store(state, &instr->SP_RELATIVE_LOAD_STORE);
-            break;
-        case LOAD_ADDRESS:
-            load_address(state, &instr->LOAD_ADDRESS);
-            break;
-        case ADD_OFFSET_TO_STACK_POINTER:
-            add_offset_to_stack_pointer(state, &instr->ADD_OFFSET_TO_STACK_POINTER);
-            break;
-        case PUSH_POP_REGISTERS:
-            push_pop_registers(state, &instr->PUSH_POP_REGISTERS);
-            break;
-        case MULTIPLE_LOAD_STORE:
-            multiple_load_store(state, &instr->MULTIPLE_LOAD_STORE);
-            break;
-        case CONDITIONAL_BRANCH:
-            conditional_branch(state, &instr->CONDITIONAL_BRANCH);
-            break;
-        case THUMB_SOFTWARE_INTERRUPT:
-            thumb_software_interrupt(state, &instr->THUMB_SOFTWARE_INTERRUPT);
-            break;
-        case UNCONDITIONAL_BRANCH:
-            unconditional_branch(state, &instr->UNCONDITIONAL_BRANCH);
-            break;
-        case LONG_BRANCH_LINK:
-            long_branch_link(state, &instr->LONG_BRANCH_LINK);
-            break;
-        case THUMB_UNDEFINED:
-            logfatal("Unimplemented THUMB mode instruction type: THUMB_UNDEFINED")
-        default:
-            logfatal("Hit default case in arm_mode_step switch. This should never happen!")
-    }
-
+    get_thumb_handler(instr)(state, instr);
     return state->this_step_ticks;
 }
 
 void handle_irq(arm7tdmi_t* state) {
     logwarn("IRQ!")
-    status_register_t cpsr = state->cpsr;
+    status_register_t cpsr = *get_psr(state);
     state->halt = false;
-    state->cpsr.mode = MODE_IRQ;
+    set_mode(state, MODE_IRQ);
     set_spsr(state, cpsr.raw);
     state->cpsr.thumb = 0;
     state->cpsr.disable_irq = 1;
-    state->lr_irq = state->pc - (cpsr.thumb ? 2 : 4) + 4;
+    state->lr = state->pc - (cpsr.thumb ? 2 : 4) + 4;
     set_pc(state, 0x18); // IRQ handler
 }
 
-int arm7tdmi_step(arm7tdmi_t* state) {
-    if (state->irq && !state->cpsr.disable_irq) {
-        handle_irq(state);
-    }
-
-
-
+INLINE void step_prologue(arm7tdmi_t* state) {
     dbg_tick(INSTRUCTION);
 
     state->this_step_ticks = 0;
@@ -555,85 +671,363 @@ int arm7tdmi_step(arm7tdmi_t* state) {
     logdebug("r4:  %08X   r5: %08X   r6: %08X   r7: %08X", get_register(state, 4), get_register(state, 5), get_register(state, 6), get_register(state, 7))
     logdebug("r8:  %08X   r9: %08X  r10: %08X  r11: %08X", get_register(state, 8), get_register(state, 9), get_register(state, 10), get_register(state, 11))
     logdebug("r12: %08X  r13: %08X  r14: %08X  r15: %08X", get_register(state, 12), get_register(state, 13), get_register(state, 14), get_register(state, 15))
-    logdebug("cpsr: %08X [%s%s%s%s%s%s%s]", state->cpsr.raw, cpsrflag(state->cpsr.N, "N"), cpsrflag(state->cpsr.Z, "Z"),
-             cpsrflag(state->cpsr.C, "C"), cpsrflag(state->cpsr.V, "V"), cpsrflag(state->cpsr.disable_irq, "I"),
+    logdebug("cpsr: %08X [%s%s%s%s%s%s%s]", get_psr(state)->raw, cpsrflag(get_flag_N(state), "N"), cpsrflag(get_flag_Z(state), "Z"),
+             cpsrflag(get_flag_C(state), "C"), cpsrflag(get_flag_V(state), "V"), cpsrflag(state->cpsr.disable_irq, "I"),
              cpsrflag(state->cpsr.disable_fiq, "F"), cpsrflag(state->cpsr.thumb, "T"))
+}
+
+INLINE void log_thumb_instr(arm7tdmi_t* state, word instr) {
+    if (log_get_verbosity() >= LOG_VERBOSITY_INFO) {
+        word adjusted_pc = state->pc - 4;
+        disassemble_thumb(adjusted_pc, instr, (char *) &state->disassembled, sizeof(state->disassembled));
+        loginfo("[THM]  [%s] 0x%08X: %s", MODE_NAMES[state->cpsr.mode], adjusted_pc, state->disassembled)
+    }
+}
 
-     int cycles;
-     if (state->cpsr.thumb) {
-         thumbinstr_t instr = next_thumb_instr(state);
-         state->instr = instr.raw;
-         word adjusted_pc = state->pc - 4;
-         if (log_get_verbosity() >= LOG_VERBOSITY_INFO) {
-             disassemble_thumb(adjusted_pc, instr.raw, (char *) &state->disassembled, sizeof(state->disassembled));
-             loginfo("[THM]  [%s] 0x%08X: %s", MODE_NAMES[state->cpsr.mode], adjusted_pc, state->disassembled)
-         }
-         cycles = thumb_mode_step(state, &instr);
-     } else {
-         arminstr_t instr = next_arm_instr(state);
-         state->instr = instr.raw;
-         word adjusted_pc = state->pc - 8;
-         if (log_get_verbosity() >= LOG_VERBOSITY_INFO) {
-             disassemble_arm(adjusted_pc, instr.raw, (char *) &state->disassembled, sizeof(state->disassembled));
-             loginfo("[ARM] [%s] 0x%08X: %s", MODE_NAMES[state->cpsr.mode], adjusted_pc, state->disassembled)
-         }
-         cycles = arm_mode_step(state, &instr);
-     }
+INLINE void log_arm_instr(arm7tdmi_t* state, word instr) {
+    if (log_get_verbosity() >= LOG_VERBOSITY_INFO) {
+        word adjusted_pc = state->pc - 8;
+        disassemble_arm(adjusted_pc, instr, (char *) &state->disassembled, sizeof(state->disassembled));
+        loginfo("[ARM] [%s] 0x%08X: %s", MODE_NAMES[state->cpsr.mode], adjusted_pc, state->disassembled)
+    }
+}
+
+// Fetches, decodes and runs the instruction in the pipeline. Used for code we don't cache.
+INLINE int step_uncached(arm7tdmi_t* state) {
+    int cycles;
+    if (state->cpsr.thumb) {
+        thumbinstr_t instr = next_thumb_instr(state);
+        state->instr = instr.raw;
+        log_thumb_instr(state, instr.raw);
+        cycles = thumb_mode_step(state, &instr);
+    } else {
+        arminstr_t instr = next_arm_instr(state);
+        state->instr = instr.raw;
+        log_arm_instr(state, instr.raw);
+        cycles = arm_mode_step(state, &instr);
+    }
 
     // Assume a step of 0 cycles is an unknown number of cycles. Consider it 1 cycle
-     return cycles == 0 ? 1 : cycles;
+    return cycles == 0 ? 1 : cycles;
 }
 
-status_register_t* get_psr(arm7tdmi_t* state) {
-    return &state->cpsr;
+// Everything a cached instruction does before its handler runs, which the block decoder can't do ahead of time
+INLINE void begin_cached(arm7tdmi_t* state, bool thumb, cached_instr_t* cached) {
+    state->pipeline[0] = state->pipeline[1];
+    state->pipeline[1] = cached->fetch;
+    if (thumb) {
+        state->pc += 2;
+        state->instr = cached->instr.thumb.raw;
+        log_thumb_instr(state, state->instr);
+    } else {
+        state->pc += 4;
+        state->instr = cached->instr.arm.raw;
+        log_arm_instr(state, state->instr);
+    }
 }
 
-void set_psr(arm7tdmi_t* state, word value) {
-    state->cpsr.raw = value;
+INLINE void skip_cached(arm7tdmi_t* state, cached_instr_t* cached) {
+    logdebug("Skipping instr because cond %d was not met.", cached->cond)
+    tick(state, 1);
 }
 
-status_register_t* get_spsr(arm7tdmi_t* state) {
-    switch (state->cpsr.mode) {
-        case MODE_FIQ:
-            return &state->spsr_fiq;
-        case MODE_SUPERVISOR:
-            return &state->spsr_svc;
-        case MODE_ABORT:
-            return &state->spsr_abt;
-        case MODE_IRQ:
-            return &state->spsr_irq;
-        case MODE_UNDEFINED:
-            return &state->spsr_und;
-        default:
-            return &state->spsr;
+INLINE int cached_ticks(arm7tdmi_t* state) {
+    return state->this_step_ticks == 0 ? 1 : state->this_step_ticks;
+}
+
+// Same as step_uncached, but everything but the execution itself was done when the block was decoded.
+INLINE int step_cached(arm7tdmi_t* state, bool thumb, cached_instr_t* cached) {
+    begin_cached(state, thumb, cached);
+    if (thumb) {
+        cached->handler.thumb(state, &cached->instr.thumb);
+    } else if (cached->cond == AL || check_cond(state, &cached->instr.arm)) {
+        cached->handler.arm(state, &cached->instr.arm, &cached->ops);
+    } else {
+        skip_cached(state, cached);
+    }
+
+    return cached_ticks(state);
+}
+
+// Finds the cached block for the instruction in the pipeline, if it's safe to run it from the cache
+INLINE cached_block_t* block_at_pc(arm7tdmi_t* state, bool thumb) {
+    cached_block_t* block = get_cached_block(state, state->pc - (thumb ? 2 : 4), thumb);
+    // If memory changed after it was fetched, the pipeline has the old instruction, and that's what runs.
+    if (!block) {
+        return NULL;
+    } else if (thumb) {
+        return block->instrs[0].instr.thumb.raw == state->pipeline[0] ? block : NULL;
+    } else {
+        return block->instrs[0].instr.arm.raw == state->pipeline[0] ? block : NULL;
+    }
+}
+
+int arm7tdmi_step(arm7tdmi_t* state) {
+    if (state->irq && !state->cpsr.disable_irq) {
+        handle_irq(state);
+    }
+
+    step_prologue(state);
+
+    bool thumb = state->cpsr.thumb;
+    cached_block_t* block = block_at_pc(state, thumb);
+    if (block) {
+        return step_cached(state, thumb, &block->instrs[0]);
+    } else {
+        return step_uncached(state);
+    }
+}
+
+int interpret_block(arm7tdmi_t* state, cached_block_t* block) {
+    bool thumb = block->thumb;
+    word size = thumb ? 2 : 4;
+    int cycles = 0;
+    state->exit_block = false;
+    for (int i = 0; i < block->length; i++) {
+        step_prologue(state);
+        word next_pc = state->pc + size;
+        cycles += step_cached(state, thumb, &block->instrs[i]);
+        // Stop if we branched, or the bus wants the rest of the system to catch up
+        if (state->pc != next_pc || state->cpsr.thumb != thumb || state->exit_block) {
+            break;
+        }
     }
+
+    return cycles;
 }
 
-void set_spsr(arm7tdmi_t* state, word value) {
-    status_register_t* spsr = get_spsr(state);
-    spsr->raw = value;
+// Called after every block. A loop that only reads memory and ends up with the same registers and flags it started
+// with is going to do exactly the same thing next time around, until something outside the CPU changes memory.
+INLINE void check_idle_loop(arm7tdmi_t* state, cached_block_t* block) {
+    word size = block->thumb ? 2 : 4;
+    if (block->idle_loop == IDLE_NO || state->pc - size != block->loop_start || state->cpsr.thumb != block->thumb) {
+        state->idle_block = NULL;
+        return;
+    }
+
+    if (block->idle_loop == IDLE_MAYBE) {
+        word nzcv = get_nzcv(state);
+        if (state->idle_block != block || state->idle_nzcv != nzcv || memcmp(state->idle_regs, state->r, sizeof(state->r)) != 0) {
+            state->idle_block = block;
+            state->idle_nzcv = nzcv;
+            memcpy(state->idle_regs, state->r, sizeof(state->r));
+            return;
+        }
+    }
+
+    logdebug("Idle loop at 0x%08X", block->loop_start)
+    state->idle = true;
+    state->exit_block = true;
+    state->idle_block = NULL;
 }
 
-void set_flags_nz(arm7tdmi_t* state, word newvalue) {
-    status_register_t* psr = get_psr(state);
-    psr->Z = newvalue == 0;
-    psr->N = newvalue >> 31u;
+int arm7tdmi_run_block(arm7tdmi_t* state) {
+    if (state->irq && !state->cpsr.disable_irq) {
+        handle_irq(state);
+    }
+
+    bool thumb = state->cpsr.thumb;
+    cached_block_t* block = block_at_pc(state, thumb);
+    if (!block) {
+        state->idle_block = NULL;
+        step_prologue(state);
+        return step_uncached(state);
+    }
+
+    int cycles = 0;
+    if (jit_enabled) {
+        cycles = jit_run_block(state, block);
+    }
+    if (cycles == 0) {
+        cycles = interpret_block(state, block);
+    }
+
+    check_idle_loop(state, block);
+    return cycles;
 }
 
-void set_flags_add(arm7tdmi_t* state, uint64_t op1, uint64_t op2) {
-    uint32_t result = op1 + op2;
-    state->cpsr.C = op1 + op2 > 0xFFFFFFFF;
-    state->cpsr.V = ((op1 ^ result) & (~op1 ^ op2)) >> 31u;
+// The loop stops when any of these change: the CPU mode and the THUMB bit
+#define CPSR_MODE_BITS 0x3F
+
+#ifdef THREADED_INTERPRETER
+// One of these for every instruction type. The handler is known here, so it's called directly, and the next
+// instruction is dispatched from the end of this one.
+#define THREADED_THUMB(handler) \
+    do_##handler: \
+        step_prologue(state); \
+        next_pc = state->pc + 2; \
+        begin_cached(state, true, cached); \
+        handler(state, &cached->instr.thumb); \
+        cycles += cached_ticks(state); \
+        cached++; \
+        if (state->pc != next_pc || !state->cpsr.thumb || state->exit_block || cycles >= budget) { \
+            goto block_done; \
+        } \
+        goto *dispatch[cached->kind];
+
+#define THREADED_ARM(handler) \
+    do_##handler: \
+        step_prologue(state); \
+        next_pc = state->pc + 4; \
+        begin_cached(state, false, cached); \
+        if (cached->cond == AL || check_cond(state, &cached->instr.arm)) { \
+            handler(state, &cached->instr.arm, &cached->ops); \
+        } else { \
+            skip_cached(state, cached); \
+        } \
+        cycles += cached_ticks(state); \
+        cached++; \
+        if (state->pc != next_pc || state->cpsr.thumb || state->exit_block || cycles >= budget) { \
+            goto block_done; \
+        } \
+        goto *dispatch[cached->kind];
+
+int arm7tdmi_run(arm7tdmi_t* state, int budget) {
+    static void* const dispatch[] = {
+        [KIND_THUMB + MOVE_SHIFTED_REGISTER] = &&do_thumb_move_shifted_register,
+        [KIND_THUMB + ADD_SUBTRACT] = &&do_thumb_add_subtract,
+        [KIND_THUMB + IMMEDIATE_OPERATIONS] = &&do_thumb_immediate_operations,
+        [KIND_THUMB + ALU_OPERATIONS] = &&do_thumb_alu_operations,
+        [KIND_THUMB + HIGH_REGISTER_OPERATIONS] = &&do_thumb_high_register_operations,
+        [KIND_THUMB + PC_RELATIVE_LOAD] = &&do_thumb_pc_relative_load,
+        [KIND_THUMB + LOAD_STORE_RO] = &&do_thumb_load_store_ro,
+        [KIND_THUMB + LOAD_STORE_BYTE_HALFWORD] = &&do_thumb_load_store_byte_halfword,
+        [KIND_THUMB + LOAD_STORE_IO] = &&do_thumb_load_store_io,
+        [KIND_THUMB + LOAD_STORE_HALFWORD] = &&do_thumb_load_store_halfword,
+        [KIND_THUMB + SP_RELATIVE_LOAD_STORE] = &&do_thumb_sp_relative_load_store,
+        [KIND_THUMB + LOAD_ADDRESS] = &&do_thumb_load_address,
+        [KIND_THUMB + ADD_OFFSET_TO_STACK_POINTER] = &&do_thumb_add_offset_to_stack_pointer,
+        [KIND_THUMB + PUSH_POP_REGISTERS] = &&do_thumb_push_pop_registers,
+        [KIND_THUMB + MULTIPLE_LOAD_STORE] = &&do_thumb_multiple_load_store,
+        [KIND_THUMB + CONDITIONAL_BRANCH] = &&do_thumb_conditional_branch,
+        [KIND_THUMB + THUMB_SOFTWARE_INTERRUPT] = &&do_thumb_swi,
+        [KIND_THUMB + UNCONDITIONAL_BRANCH] = &&do_thumb_unconditional_branch,
+        [KIND_THUMB + LONG_BRANCH_LINK] = &&do_thumb_long_branch_link,
+        [KIND_THUMB + THUMB_UNDEFINED] = &&do_thumb_undefined,
+        [KIND_ARM + DATA_PROCESSING] = &&do_arm_data_processing,
+        [KIND_ARM + STATUS_TRANSFER] = &&do_arm_status_transfer,
+        [KIND_ARM + MULTIPLY] = &&do_arm_multiply,
+        [KIND_ARM + MULTIPLY_LONG] = &&do_arm_multiply_long,
+        [KIND_ARM + SINGLE_DATA_SWAP] = &&do_arm_single_data_swap,
+        [KIND_ARM + BRANCH_EXCHANGE] = &&do_arm_branch_exchange,
+        [KIND_ARM + HALFWORD_DT_RO] = &&do_arm_halfword_dt_ro,
+        [KIND_ARM + HALFWORD_DT_IO] = &&do_arm_halfword_dt_io,
+        [KIND_ARM + SINGLE_DATA_TRANSFER] = &&do_arm_single_data_transfer,
+        [KIND_ARM + UNDEFINED] = &&do_arm_undefined,
+        [KIND_ARM + BLOCK_DATA_TRANSFER] = &&do_arm_block_data_transfer,
+        [KIND_ARM + BRANCH] = &&do_arm_branch,
+        [KIND_ARM + COPROCESSOR_DATA_TRANSFER] = &&do_arm_coprocessor_data_transfer,
+        [KIND_ARM + COPROCESSOR_DATA_OPERATION] = &&do_arm_coprocessor_data_operation,
+        [KIND_ARM + COPROCESSOR_REGISTER_TRANSFER] = &&do_arm_coprocessor_register_transfer,
+        [KIND_ARM + SOFTWARE_INTERRUPT] = &&do_arm_swi,
+        [KIND_BLOCK_END] = &&block_done
+    };
+
+    int cycles = 0;
+    word mode = state->cpsr.raw & CPSR_MODE_BITS;
+    cached_block_t* block;
+    cached_instr_t* cached;
+    word next_pc;
+
+    state->exit_block = false;
+
+next_block:
+    if (state->irq && !state->cpsr.disable_irq) {
+        handle_irq(state);
+    }
+
+    block = block_at_pc(state, state->cpsr.thumb);
+    if (!block) {
+        state->idle_block = NULL;
+        step_prologue(state);
+        cycles += step_uncached(state);
+        goto block_end;
+    }
+
+    if (jit_enabled) {
+        int jit_cycles = jit_run_block(state, block);
+        if (jit_cycles > 0) {
+            cycles += jit_cycles;
+            goto block_done;
+        }
+    }
+
+    cached = block->instrs;
+    goto *dispatch[cached->kind];
+
+    THREADED_THUMB(thumb_move_shifted_register)
+    THREADED_THUMB(thumb_add_subtract)
+    THREADED_THUMB(thumb_immediate_operations)
+    THREADED_THUMB(thumb_alu_operations)
+    THREADED_THUMB(thumb_high_register_operations)
+    THREADED_THUMB(thumb_pc_relative_load)
+    THREADED_THUMB(thumb_load_store_ro)
+    THREADED_THUMB(thumb_load_store_byte_halfword)
+    THREADED_THUMB(thumb_load_store_io)
+    THREADED_THUMB(thumb_load_store_halfword)
+    THREADED_THUMB(thumb_sp_relative_load_store)
+    THREADED_THUMB(thumb_load_address)
+    THREADED_THUMB(thumb_add_offset_to_stack_pointer)
+    THREADED_THUMB(thumb_push_pop_registers)
+    THREADED_THUMB(thumb_multiple_load_store)
+    THREADED_THUMB(thumb_conditional_branch)
+    THREADED_THUMB(thumb_swi)
+    THREADED_THUMB(thumb_unconditional_branch)
+    THREADED_THUMB(thumb_long_branch_link)
+    THREADED_THUMB(thumb_undefined)
+
+    THREADED_ARM(arm_data_processing)
+    THREADED_ARM(arm_status_transfer)
+    THREADED_ARM(arm_multiply)
+    THREADED_ARM(arm_multiply_long)
+    THREADED_ARM(arm_single_data_swap)
+    THREADED_ARM(arm_branch_exchange)
+    THREADED_ARM(arm_halfword_dt_ro)
+    THREADED_ARM(arm_halfword_dt_io)
+    THREADED_ARM(arm_single_data_transfer)
+    THREADED_ARM(arm_undefined)
+    THREADED_ARM(arm_block_data_transfer)
+    THREADED_ARM(arm_branch)
+    THREADED_ARM(arm_coprocessor_data_transfer)
+    THREADED_ARM(arm_coprocessor_data_operation)
+    THREADED_ARM(arm_coprocessor_register_transfer)
+    THREADED_ARM(arm_swi)
+
+block_done:
+    check_idle_loop(state, block);
+
+block_end:
+    if (state->exit_block || cycles >= budget || (state->cpsr.raw & CPSR_MODE_BITS) != mode) {
+        return cycles;
+    }
+    goto next_block;
 }
+#else
+int arm7tdmi_run(arm7tdmi_t* state, int budget) {
+    int cycles = 0;
+    word mode = state->cpsr.raw & CPSR_MODE_BITS;
+    do {
+        cycles += arm7tdmi_run_block(state);
+    } while (!state->exit_block && cycles < budget && (state->cpsr.raw & CPSR_MODE_BITS) == mode);
+    return cycles;
+}
+#endif
 
-void set_flags_sub(arm7tdmi_t* state, word op1, word op2, word result) {
-    state->cpsr.C = op2 <= op1;
-    state->cpsr.V = ((op1 ^ op2) & (~op2 ^ result)) >> 31u;
+status_register_t* get_psr(arm7tdmi_t* state) {
+    state->cpsr.N = get_flag_N(state);
+    state->cpsr.Z = get_flag_Z(state);
+    state->cpsr.C = get_flag_C(state);
+    state->cpsr.V = get_flag_V(state);
+    return &state->cpsr;
 }
 
-void set_flags_sbc(arm7tdmi_t* state, word op1, word op2, uint64_t tmp, word result) {
-    state->cpsr.C = tmp <= op1;
-    state->cpsr.V = ((op1 ^ op2) & (~op2 ^ result)) >> 31u;
+void set_psr(arm7tdmi_t* state, word value) {
+    set_mode(state, value & 0b11111);
+    state->cpsr.raw = value;
+    set_flags_n_z(state, state->cpsr.N, state->cpsr.Z);
+    state->flags.op = FLAGS_STORED;
+    state->flags.C = state->cpsr.C;
+    state->flags.V = state->cpsr.V;
 }
 
 void skip_bios(arm7tdmi_t* state) {
@@ -656,5 +1050,5 @@ void skip_bios(arm7tdmi_t* state) {
     set_register(state, REG_LR, 0x00000000);
 
     set_pc(state, 0x08000000);
-    state->cpsr.raw = 0x6000001F;
+    set_psr(state, 0x6000001F);
 }
@@ -4,6 +4,9 @@
 #include <stdbool.h>
 
 #include "../common/util.h"
+#include "arm_instr/arm_instr.h"
+#include "thumb_instr/thumb_instr.h"
+
 #define MODE_USER 0b10000
 #define MODE_FIQ 0b10001
 #define MODE_SUPERVISOR 0b10011
@@ -36,6 +39,30 @@ typedef union status_register {
     };
 } status_register_t;
 
+// How C and V are worked out from the last flag-setting operation
+typedef enum flag_op {
+    FLAGS_STORED, // C and V were set directly
+    FLAGS_ADD,
+    FLAGS_SUB,
+    FLAGS_SBC
+} flag_op_t;
+
+// N/Z/C/V aren't kept in the CPSR. Flag-setting instructions only record what they did here, and the flags are
+// worked out when something actually reads them. get_psr() packs them back into the CPSR.
+typedef struct lazy_flags {
+    word nz_result; // N and Z come from this, unless nz_stored is set
+    bool nz_stored;
+    bool N;
+    bool Z;
+    bool C;
+    bool V;
+    flag_op_t op;
+    uint64_t op1;
+    uint64_t op2;
+    uint64_t tmp;
+    word result;
+} lazy_flags_t;
+
 typedef struct arm7tdmi {
     // Connections to the bus
     byte (*read_byte)(word);
@@ -47,40 +74,42 @@ typedef struct arm7tdmi {
 
     // Registers
     // http://problemkaputt.de/gbatek.htm#armcpuflagsconditionfieldcond
-    word r[13]; // General registers. Shared between modes.
+    // r[] always holds the registers of the current mode. The banked copies below are only swapped in and out
+    // by set_mode(), so reading or writing a register never has to look at the mode.
+    union {
+        word r[16];
+        struct {
+            word r0_r12[13]; // Use r[] for these
+            word sp;
+            word lr;
+            word pc;
+        };
+    };
 
-    // !!!!! NOTE !!!!!
-    // r8-r12 have separate values for FIQ mode, but that's only called by hardware debuggers
-    // There is no way to trigger it from software, other than setting the mode bits directly.
+    // r8-r12 are banked in FIQ mode. highreg_usr holds everyone else's while in FIQ mode, highreg_fiq holds FIQ's the rest of the time.
+    word highreg_usr[5];
     word highreg_fiq[5];
 
-    // These are technically r13, r14, and r15.
-    word sp;
+    // r13 and r14 of the modes that aren't the current one. User and system mode share theirs.
+    word sp_usr;
     word sp_fiq;
     word sp_svc;
     word sp_abt;
     word sp_irq;
     word sp_und;
 
-    word lr;
+    word lr_usr;
     word lr_fiq;
     word lr_svc;
     word lr_abt;
     word lr_irq;
     word lr_und;
 
-    word pc;
-
-    // Copies of registers for supervisor mode
-    word r13_svc;
-    word r14_svc;
-
-    // Copies of registers for abort mode
-    word r13_abt;
-    word r14_abt;
-
-    status_register_t cpsr;
-    status_register_t spsr;
+    status_register_t cpsr; // The flag bits in here are stale, use get_psr()
+    lazy_flags_t flags;
+    status_register_t spsr; // SPSR of the current mode
+    // User and system mode don't really have an SPSR, but writes to it are kept around anyway.
+    status_register_t spsr_usr;
     status_register_t spsr_fiq;
     status_register_t spsr_svc;
     status_register_t spsr_abt;
@@ -92,6 +121,13 @@ typedef struct arm7tdmi {
 
     bool irq; // Should the CPU IRQ next chance it gets?
     bool halt; // Should the CPU do nothing (except interrupts?)
+    bool exit_block; // Set when something happens that the rest of the system has to see before the next instruction
+    bool idle; // Stuck in a loop that won't go anywhere until an IRQ, DMA or the PPU changes something
+
+    // The last block that might be an idle loop, and the registers and flags after it went around
+    const void* idle_block;
+    word idle_regs[16];
+    word idle_nzcv;
 
     word instr; // last instr the CPU executed
 
@@ -100,6 +136,77 @@ typedef struct arm7tdmi {
     char disassembled[50];
 } arm7tdmi_t;
 
+// Operands of data processing and load/store instructions, pulled out of the encoding once so cached blocks don't
+// have to do it every time they run. Other instructions ignore them.
+typedef struct arm_operands {
+    word immediate; // Operand2 already rotated for data processing, the offset for LDR/STR and LDRH/STRH
+    byte rd;
+    byte rn;
+    byte rm;
+    byte rs;
+    byte shift_type;
+    byte shift_amount;
+    bool use_immediate; // Operand2/offset is immediate rather than a (shifted) register
+    bool shift_by_register;
+    bool immediate_carry; // The immediate was rotated, so its top bit is the carry out
+} arm_operands_t;
+
+INLINE void decode_arm_operands(arminstr_t* instr, arm_operands_t* ops) {
+    word raw = instr->raw;
+    ops->rd = (raw >> 12u) & 0xFu;
+    ops->rn = (raw >> 16u) & 0xFu;
+    ops->rm = raw & 0xFu;
+    ops->rs = (raw >> 8u) & 0xFu;
+    ops->shift_type = (raw >> 5u) & 3u;
+    ops->shift_amount = (raw >> 7u) & 0x1Fu;
+    ops->shift_by_register = (raw >> 4u) & 1u;
+    ops->immediate_carry = false;
+    if ((raw & 0x0C000000u) == 0x04000000u) { // LDR/STR, I is set for a register offset
+        ops->immediate = raw & 0xFFFu;
+        ops->use_immediate = !((raw >> 25u) & 1u);
+    } else if ((raw & 0x0E000000u) == 0x02000000u) { // Data processing with an immediate operand2
+        word rotate = (raw >> 7u) & 0x1Eu;
+        ops->immediate = ((raw & 0xFFu) >> rotate) | ((raw & 0xFFu) << (-rotate & 31u));
+        ops->immediate_carry = rotate != 0;
+        ops->use_immediate = true;
+    } else if ((raw & 0x0E000090u) == 0x00000090u) { // LDRH/STRH and friends, offset is split around bits 7-4
+        ops->immediate = (raw & 0xFu) | ((raw >> 4u) & 0xF0u);
+        ops->use_immediate = (raw >> 22u) & 1u;
+    } else {
+        ops->immediate = 0;
+        ops->use_immediate = false;
+    }
+}
+
+// Every ARM instruction is dispatched straight through this table, indexed by ARM_INSTR_HASH.
+typedef void (*arm_handler_t)(arm7tdmi_t* state, arminstr_t* instr, arm_operands_t* ops);
+extern arm_handler_t arm_handlers[ARM_INSTR_HASH_SIZE];
+
+INLINE arm_handler_t get_arm_handler(arminstr_t* instr) {
+    return arm_handlers[ARM_INSTR_HASH(instr->raw)];
+}
+
+// The type of every hash, for the threaded interpreter to jump straight to the code for the handler
+extern byte arm_types[ARM_INSTR_HASH_SIZE];
+
+INLINE arm_instr_type_t get_arm_type(arminstr_t* instr) {
+    return arm_types[ARM_INSTR_HASH(instr->raw)];
+}
+
+// Same thing for THUMB instructions, indexed by THUMB_INSTR_HASH.
+typedef void (*thumb_handler_t)(arm7tdmi_t* state, thumbinstr_t* instr);
+extern thumb_handler_t thumb_handlers[THUMB_INSTR_HASH_SIZE];
+
+INLINE thumb_handler_t get_thumb_handler(thumbinstr_t* instr) {
+    return thumb_handlers[THUMB_INSTR_HASH(instr->raw)];
+}
+
+extern byte thumb_types[THUMB_INSTR_HASH_SIZE];
+
+INLINE thumb_instr_type_t get_thumb_type(thumbinstr_t* instr) {
+    return thumb_types[THUMB_INSTR_HASH(instr->raw)];
+}
+
 arm7tdmi_t* init_arm7tdmi(byte (*read_byte)(word),
                           half (*read_half)(word),
                           word (*read_word)(word),
@@ -108,26 +215,138 @@ arm7tdmi_t* init_arm7tdmi(byte (*read_byte)(word),
                           void (*write_word)(word, word));
 
 int arm7tdmi_step(arm7tdmi_t* state);
+// Runs the rest of the cached block at the PC. Returns early if the bus sets exit_block.
+// Both of these set idle (and exit_block) if the CPU is in an idle loop.
+int arm7tdmi_run_block(arm7tdmi_t* state);
+// Keeps running blocks until at least budget cycles have passed, the bus sets exit_block, or the mode changes.
+// Built with THREADED_INTERPRETER, there's a computed goto target for every instruction type, each calling its handler
+// directly and jumping straight to the next instruction's, instead of returning after every block.
+int arm7tdmi_run(arm7tdmi_t* state, int budget);
+
+INLINE word get_register(arm7tdmi_t* state, word index) {
+    return state->r[index];
+}
 
-word get_register(arm7tdmi_t* state, word index);
 void set_register(arm7tdmi_t* state, word index, word newvalue);
 
-word get_sp(arm7tdmi_t* state);
+INLINE word get_sp(arm7tdmi_t* state) {
+    return state->sp;
+}
+
+// Changes the mode bits of the CPSR, swapping the banked registers of the old mode out and the new mode's in.
+// Anything that changes the mode has to go through this (or set_psr).
+void set_mode(arm7tdmi_t* state, unsigned mode);
 
 void set_pc(arm7tdmi_t* state, word new_pc);
 
-// PSR, processor status register
+// PSR, processor status register. Packs the flags into it first.
 status_register_t* get_psr(arm7tdmi_t* state);
 void set_psr(arm7tdmi_t* state, word value);
 
 // SPSR, saved processor status register
-status_register_t* get_spsr(arm7tdmi_t* state);
-void set_spsr(arm7tdmi_t* state, word value);
-
-void set_flags_nz(arm7tdmi_t* state, word newvalue);
-void set_flags_add(arm7tdmi_t* state, uint64_t op1, uint64_t op2);
-void set_flags_sub(arm7tdmi_t* state, word op1, word op2, word result);
-void set_flags_sbc(arm7tdmi_t* state, word op1, word op2, uint64_t tmp, word result);
+INLINE status_register_t* get_spsr(arm7tdmi_t* state) {
+    return &state->spsr;
+}
+
+INLINE void set_spsr(arm7tdmi_t* state, word value) {
+    state->spsr.raw = value;
+}
+
+INLINE bool get_flag_N(arm7tdmi_t* state) {
+    return state->flags.nz_stored ? state->flags.N : state->flags.nz_result >> 31u;
+}
+
+INLINE bool get_flag_Z(arm7tdmi_t* state) {
+    return state->flags.nz_stored ? state->flags.Z : state->flags.nz_result == 0;
+}
+
+INLINE bool get_flag_C(arm7tdmi_t* state) {
+    lazy_flags_t* flags = &state->flags;
+    switch (flags->op) {
+        case FLAGS_ADD:
+            return flags->op1 + flags->op2 > 0xFFFFFFFF;
+        case FLAGS_SUB:
+            return (word)flags->op2 <= (word)flags->op1;
+        case FLAGS_SBC:
+            return flags->tmp <= (word)flags->op1;
+        default:
+            return flags->C;
+    }
+}
+
+INLINE bool get_flag_V(arm7tdmi_t* state) {
+    lazy_flags_t* flags = &state->flags;
+    switch (flags->op) {
+        case FLAGS_ADD: {
+            uint32_t result = flags->op1 + flags->op2;
+            return ((flags->op1 ^ result) & (~flags->op1 ^ flags->op2)) >> 31u;
+        }
+        case FLAGS_SUB:
+        case FLAGS_SBC: {
+            word op1 = flags->op1;
+            word op2 = flags->op2;
+            return ((op1 ^ op2) & (~op2 ^ flags->result)) >> 31u;
+        }
+        default:
+            return flags->V;
+    }
+}
+
+INLINE void set_flags_nz(arm7tdmi_t* state, word newvalue) {
+    state->flags.nz_result = newvalue;
+    state->flags.nz_stored = false;
+}
+
+// For when N and Z don't come from a 32 bit result
+INLINE void set_flags_n_z(arm7tdmi_t* state, bool n, bool z) {
+    state->flags.N = n;
+    state->flags.Z = z;
+    state->flags.nz_stored = true;
+}
+
+INLINE void set_flags_add(arm7tdmi_t* state, uint64_t op1, uint64_t op2) {
+    state->flags.op = FLAGS_ADD;
+    state->flags.op1 = op1;
+    state->flags.op2 = op2;
+}
+
+INLINE void set_flags_sub(arm7tdmi_t* state, word op1, word op2, word result) {
+    state->flags.op = FLAGS_SUB;
+    state->flags.op1 = op1;
+    state->flags.op2 = op2;
+    state->flags.result = result;
+}
+
+INLINE void set_flags_sbc(arm7tdmi_t* state, word op1, word op2, uint64_t tmp, word result) {
+    state->flags.op = FLAGS_SBC;
+    state->flags.op1 = op1;
+    state->flags.op2 = op2;
+    state->flags.tmp = tmp;
+    state->flags.result = result;
+}
+
+// Sets C on its own, so V has to be worked out now before the operation it comes from is forgotten.
+INLINE void set_flag_C(arm7tdmi_t* state, bool c) {
+    if (state->flags.op != FLAGS_STORED) {
+        state->flags.V = get_flag_V(state);
+        state->flags.op = FLAGS_STORED;
+    }
+    state->flags.C = c;
+}
+
+// Bit n of cond_table[cond] is set if cond passes when the flags are n (N is bit 3, Z bit 2, C bit 1 and V bit 0).
+// Shared by ARM instructions and THUMB conditional branches.
+extern const half cond_table[16];
+
+INLINE word get_nzcv(arm7tdmi_t* state) {
+    return (get_flag_N(state) << 3u) | (get_flag_Z(state) << 2u) | (get_flag_C(state) << 1u) | get_flag_V(state);
+}
+
+INLINE bool cond_passed(arm7tdmi_t* state, arm_cond_t cond) {
+    return (cond_table[cond] >> get_nzcv(state)) & 1u;
+}
+
+bool check_cond(arm7tdmi_t* state, arminstr_t* instr);
 
 void skip_bios(arm7tdmi_t* state);
 
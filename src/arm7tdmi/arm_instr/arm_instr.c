@@ -2,8 +2,7 @@
 #include "../../common/util.h"
 
 arm_instr_type_t get_arm_instr_type(arminstr_t* instr) {
-    word hash = instr->raw;
-    hash = ((hash >> 16u) & 0xFF0u) | ((hash >> 4u) & 0xFu);
+    word hash = ARM_INSTR_HASH(instr->raw);
 
     if ((hash & 0b111100000000u) == 0b111100000000u) {
         return SOFTWARE_INTERRUPT;
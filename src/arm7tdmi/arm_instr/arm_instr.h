@@ -197,5 +197,10 @@ typedef union arminstr {
     } parsed;
 } arminstr_t;
 
+// Bits 27-20 and 7-4 of an instruction are enough to tell every ARM instruction type apart.
+#define ARM_INSTR_HASH(raw) ((((raw) >> 16u) & 0xFF0u) | (((raw) >> 4u) & 0xFu))
+#define ARM_INSTR_HASH_SIZE 4096
+
+// Slow, readable decoder. Only used to build the handler table and by debugging code.
 arm_instr_type_t get_arm_instr_type(arminstr_t* instr);
 #endif
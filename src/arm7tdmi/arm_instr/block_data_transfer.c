@@ -40,7 +40,7 @@ void block_data_transfer(arm7tdmi_t* state, block_data_transfer_t* instr) {
 
     byte original_mode = state->cpsr.mode;
     if (instr->s) {
-        state->cpsr.mode = MODE_USER;
+        set_mode(state, MODE_USER);
     }
 
     if (instr->rlist == 0u) {
@@ -112,6 +112,6 @@ void block_data_transfer(arm7tdmi_t* state, block_data_transfer_t* instr) {
     }
 
     if (instr->s) {
-        state->cpsr.mode = original_mode;
+        set_mode(state, original_mode);
     }
 }
@@ -4,32 +4,14 @@
 #include "../../common/log.h"
 #include "../shifts.h"
 
-typedef union nonimmediate_flags {
-    struct {
-        unsigned:7; // common flags
-        unsigned shift_amount:5;
-    } shift_immediate;
-    struct {
-        unsigned:8; // common flags
-        unsigned rs:4;
-    } shift_register;
-    // Common to both
-    struct {
-        unsigned rm:4;
-        bool r:1; // 1: shift by register, 0, shift by immediate.
-        shift_type_t shift_type:2;
-    };
-    unsigned raw:12;
-} nonimmediate_flags_t;
-
 // http://problemkaputt.de/gbatek.htm#armopcodesdataprocessingalu
-void data_processing(arm7tdmi_t* state, data_processing_t* instr) {
+void data_processing(arm7tdmi_t* state, data_processing_t* instr, arm_operands_t* ops) {
     bool s = instr->s;
-    byte rn = instr->rn;
-    byte rd = instr->rd;
+    byte rn = ops->rn;
+    byte rd = ops->rd;
 
 
-    if (instr->rd == 15) {
+    if (rd == 15) {
         s = false; // Don't update flags if we're dealing with the program counter
     }
 
@@ -37,48 +19,32 @@ void data_processing(arm7tdmi_t* state, data_processing_t* instr) {
 
     word rndata = get_register(state, rn);
 
-    if (instr->immediate) { // Operand2 comes from an immediate value
-        operand2 = instr->operand2 & 0xFFu; // Last 8 bits of operand2 are the pre-shift value
-
-        // first 4 bytes * 7 are the shift value
-        // Only shift by 7 because we were going to multiply it by 2 anyway
-        word shift = (instr->operand2 & 0xF00u) >> 7u;
-
-        logdebug("Shift amount: %d", shift)
-        logdebug("Operand2 before shift: %d", operand2)
-
-        shift &= 31u;
-        if (shift != 0) {
-            operand2 = (operand2 >> shift) | (operand2 << (-shift & 31u));
-            if (s) {
-                state->cpsr.C = operand2 >> 31u;
-            }
+    if (ops->use_immediate) { // Operand2 comes from an immediate value, rotated when the block was decoded
+        operand2 = ops->immediate;
+        if (ops->immediate_carry && s) {
+            set_flag_C(state, operand2 >> 31u);
         }
     }
     else { // Operand2 comes from another register
         byte shift_amount;
 
-        nonimmediate_flags_t flags;
-        flags.raw = instr->operand2;
-
-        //unimplemented(flags.rm == 15, "r15 is a special case")
-        operand2 = get_register(state, flags.rm);
-        if (flags.r && flags.rm == 15u) {
+        operand2 = get_register(state, ops->rm);
+        if (ops->shift_by_register && ops->rm == 15u) {
             operand2 += 4; // Special case for R15 when immediate
         }
 
         // Shift by register
-        if (flags.r) {
-            unimplemented(flags.shift_register.rs == 15, "r15 is a special case")
-            shift_amount = get_register(state, flags.shift_register.rs) & 0xFFu; // Only lowest 8 bits used
-            logdebug("Shift amount (r%d): 0x%02X", flags.shift_register.rs, shift_amount)
+        if (ops->shift_by_register) {
+            unimplemented(ops->rs == 15, "r15 is a special case")
+            shift_amount = get_register(state, ops->rs) & 0xFFu; // Only lowest 8 bits used
+            logdebug("Shift amount (r%d): 0x%02X", ops->rs, shift_amount)
             if (rn == 15) {
                 rndata += 4;
             }
         }
         // Shift by immediate
         else {
-            shift_amount = flags.shift_immediate.shift_amount;
+            shift_amount = ops->shift_amount;
             logdebug("Shift amount (immediate): 0x%02X", shift_amount)
         }
 
@@ -86,14 +52,14 @@ void data_processing(arm7tdmi_t* state, data_processing_t* instr) {
 
         logdebug("Operand before shift: 0x%08X", operand2)
 
-        // Only pass cpsr if it should be updated
-        status_register_t* cpsr = s?&state->cpsr:NULL;
+        // Only let the shift set the carry flag if it should be updated
+        arm7tdmi_t* carry = s ? state : NULL;
 
         // Special case when shifting by immediate 0
-        if (!flags.r && shift_amount == 0) {
-            operand2 = arm_shift_special_zero_behavior(state, cpsr, flags.shift_type, operand2);
+        if (!ops->shift_by_register && shift_amount == 0) {
+            operand2 = arm_shift_special_zero_behavior(state, carry, ops->shift_type, operand2);
         } else {
-            operand2 = arm_shift(cpsr, flags.shift_type, operand2, shift_amount);
+            operand2 = arm_shift(carry, ops->shift_type, operand2, shift_amount);
         }
     }
 
@@ -145,7 +111,7 @@ void data_processing(arm7tdmi_t* state, data_processing_t* instr) {
             break;
         }
         case 0x5: { // ADC: Rd = Rn+Op2+C
-            uint64_t op2c = operand2 + state->cpsr.C;
+            uint64_t op2c = operand2 + get_flag_C(state);
             uint64_t newvalue64 = rndata + op2c;
             if (s) {
                 set_flags_nz(state, newvalue64);
@@ -157,7 +123,7 @@ void data_processing(arm7tdmi_t* state, data_processing_t* instr) {
         }
         case 0x6: { // SBC: Rd = Rn-Op2+C-1
             uint64_t tmp = operand2;
-            tmp -= state->cpsr.C;
+            tmp -= get_flag_C(state);
             tmp += 1;
             newvalue = rndata - tmp;
             if (s) {
@@ -169,7 +135,7 @@ void data_processing(arm7tdmi_t* state, data_processing_t* instr) {
         }
         case 0x7: { // RSC: RD = Op2-Rn+C-1
             uint64_t tmp = rndata;
-            tmp -= state->cpsr.C;
+            tmp -= get_flag_C(state);
             tmp += 1;
             newvalue = operand2 - tmp;
             if (s) {
@@ -5,6 +5,6 @@
 #include "../arm7tdmi.h"
 #include "arm_instr.h"
 
-void data_processing(arm7tdmi_t* state, data_processing_t* data_processing);
+void data_processing(arm7tdmi_t* state, data_processing_t* data_processing, arm_operands_t* ops);
 
 #endif //GBA_DATA_PROCESSING_H
@@ -45,9 +45,7 @@ void multiply_long(arm7tdmi_t* state, multiply_long_t* instr) {
     }
 
     if (instr->s) {
-        status_register_t* psr = get_psr(state);
-        psr->Z = result == 0;
-        psr->N = result >> 63;
+        set_flags_n_z(state, result >> 63, result == 0);
     }
 
     word high = (result >> 32u) & 0xFFFFFFFF;
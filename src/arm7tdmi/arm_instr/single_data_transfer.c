@@ -3,31 +3,18 @@
 #include "../../common/log.h"
 #include "../shifts.h"
 
-typedef union immediate_as_offset_flags {
-    struct {
-        unsigned rm:4;
-        bool reg_op:1; // Must be 0?
-        unsigned shift_type:2;
-        unsigned shift_amount:5;
-        unsigned:4;
-    };
-    half raw;
-} immediate_as_offset_flags_t;
-
 // http://problemkaputt.de/gbatek.htm#armopcodesmemorysingledatatransferldrstrpld
 void single_data_transfer(arm7tdmi_t* state,
-                          unsigned int offset,
-                          unsigned int rd, // dest if this is LDR, source if this is STR
-                          unsigned int rn,
+                          arm_operands_t* ops, // rd is the dest if this is LDR, source if this is STR
                           bool l,   // 0 == str, 1 == ldr
                           bool w,   // different meanings depending on state of P (writeback)
                           bool b,   // (byte) when 0, transfer word, when 1, transfer byte
                           bool up,  // When 0, subtract offset from base, when 1, add to base
-                          bool pre, // when 0, offset after transfer, when 1, before transfer.
-                          bool immediate_offset_type) { //  When 0, Immediate as Offset
-    //  When 1, Register shifted by Immediate as Offset
-    logdebug("l: %d w: %d b: %d u: %d p: %d i: %d", l, w, b, up, pre, immediate_offset_type)
-    logdebug("rn: %d rd: %d, offset: 0x%03X", rn, rd, offset)
+                          bool pre) { // when 0, offset after transfer, when 1, before transfer.
+    byte rd = ops->rd;
+    byte rn = ops->rn;
+    logdebug("l: %d w: %d b: %d u: %d p: %d i: %d", l, w, b, up, pre, !ops->use_immediate)
+    logdebug("rn: %d rd: %d, offset: 0x%03X", rn, rd, ops->immediate)
     if (!pre) {
         w = true;
     }
@@ -37,21 +24,19 @@ void single_data_transfer(arm7tdmi_t* state,
 
     int actual_offset;
 
-    if (immediate_offset_type) {
-        immediate_as_offset_flags_t flags;
-        flags.raw = offset;
-        unimplemented(flags.rm == 15, "Can't use r15 here!")
+    if (!ops->use_immediate) { // Register shifted by immediate as offset
+        unimplemented(ops->rm == 15, "Can't use r15 here!")
 
-        unimplemented(flags.reg_op != 0, "The documentation told me this was always going to be 0")
+        unimplemented(ops->shift_by_register, "The documentation told me this was always going to be 0")
 
-        logdebug("Doing a shift type %d to the value of r%d by amount %d", flags.shift_type, flags.rm, flags.shift_amount)
-        if (flags.shift_amount == 0) {
-            actual_offset = arm_shift_special_zero_behavior(state, NULL, flags.shift_type, get_register(state, flags.rm));
+        logdebug("Doing a shift type %d to the value of r%d by amount %d", ops->shift_type, ops->rm, ops->shift_amount)
+        if (ops->shift_amount == 0) {
+            actual_offset = arm_shift_special_zero_behavior(state, NULL, ops->shift_type, get_register(state, ops->rm));
         } else {
-            actual_offset = arm_shift(NULL, flags.shift_type, get_register(state, flags.rm), flags.shift_amount);
+            actual_offset = arm_shift(NULL, ops->shift_type, get_register(state, ops->rm), ops->shift_amount);
         }
     } else {
-        actual_offset = (int) offset;
+        actual_offset = (int) ops->immediate;
     }
 
     if (!up) {
@@ -5,13 +5,10 @@
 #include "../arm7tdmi.h"
 
 void single_data_transfer(arm7tdmi_t* state,
-                          unsigned int offset,
-                          unsigned int rd, // dest if this is LDR, source if this is STR
-                          unsigned int rn,
+                          arm_operands_t* ops, // rd is the dest if this is LDR, source if this is STR
                           bool l,
                           bool w,
                           bool b,
                           bool up,
-                          bool pre,
-                          bool immediate_offset_type);
+                          bool pre);
 #endif
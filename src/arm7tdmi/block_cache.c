@@ -0,0 +1,295 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "block_cache.h"
+#include "sign_extension.h"
+#include "../common/log.h"
+
+#define BLOCK_CACHE_BUCKETS 0x10000
+#define MAX_IDLE_LOOPS 16
+
+static cached_block_t* buckets[BLOCK_CACHE_BUCKETS];
+
+bool code_pages[CODE_PAGES];
+static word page_generation[CODE_PAGES];
+
+bool idle_loop_detection = true;
+static word idle_loops[MAX_IDLE_LOOPS];
+static int num_idle_loops = 0;
+
+INLINE word bucket_for(word address, bool thumb) {
+    return ((address >> 1u) ^ (address >> 17u) ^ thumb) & (BLOCK_CACHE_BUCKETS - 1);
+}
+
+// Does this instruction (potentially) write to the PC or change the CPU state in a way that needs a new block?
+static bool arm_ends_block(arminstr_t* instr) {
+    switch (get_arm_instr_type(instr)) {
+        case DATA_PROCESSING:
+            return instr->parsed.DATA_PROCESSING.rd == REG_PC;
+        case MULTIPLY:
+            return instr->parsed.MULTIPLY.rd == REG_PC;
+        case MULTIPLY_LONG:
+            return instr->parsed.MULTIPLY_LONG.rdhi == REG_PC || instr->parsed.MULTIPLY_LONG.rdlo == REG_PC;
+        case SINGLE_DATA_SWAP:
+            return instr->parsed.SINGLE_DATA_SWAP.rd == REG_PC;
+        case HALFWORD_DT_RO:
+        case HALFWORD_DT_IO:
+            // RO and IO share the p/w/l/rn/rd bits
+            return (instr->parsed.HALFWORD_DT_RO.l && instr->parsed.HALFWORD_DT_RO.rd == REG_PC)
+                || (instr->parsed.HALFWORD_DT_RO.rn == REG_PC && (instr->parsed.HALFWORD_DT_RO.w || !instr->parsed.HALFWORD_DT_RO.p));
+        case SINGLE_DATA_TRANSFER:
+            return (instr->parsed.SINGLE_DATA_TRANSFER.l && instr->parsed.SINGLE_DATA_TRANSFER.rd == REG_PC)
+                || (instr->parsed.SINGLE_DATA_TRANSFER.rn == REG_PC && (instr->parsed.SINGLE_DATA_TRANSFER.w || !instr->parsed.SINGLE_DATA_TRANSFER.p));
+        case BLOCK_DATA_TRANSFER:
+            return (instr->parsed.BLOCK_DATA_TRANSFER.l && (instr->parsed.BLOCK_DATA_TRANSFER.rlist & (1u << REG_PC)))
+                || (instr->parsed.BLOCK_DATA_TRANSFER.w && instr->parsed.BLOCK_DATA_TRANSFER.rn == REG_PC);
+        default:
+            // Branches, SWIs, PSR transfers (mode and IRQ changes) and anything we can't run
+            return true;
+    }
+}
+
+static bool thumb_ends_block(thumbinstr_t* instr) {
+    switch (get_thumb_instr_type(instr)) {
+        case HIGH_REGISTER_OPERATIONS:
+            return instr->HIGH_REGISTER_OPERATIONS.opcode == 0b11 // BX
+                || (instr->HIGH_REGISTER_OPERATIONS.opcode != 0b01 && instr->HIGH_REGISTER_OPERATIONS.h1 && instr->HIGH_REGISTER_OPERATIONS.rdhd == 7);
+        case PUSH_POP_REGISTERS:
+            return instr->PUSH_POP_REGISTERS.l && instr->PUSH_POP_REGISTERS.r;
+        case LONG_BRANCH_LINK:
+            return instr->LONG_BRANCH_LINK.h; // Only the second half actually branches
+        case CONDITIONAL_BRANCH:
+        case UNCONDITIONAL_BRANCH:
+        case THUMB_SOFTWARE_INTERRUPT:
+        case THUMB_UNDEFINED:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Can this instruction be part of a loop that just waits for something to change?
+// Anything that writes to memory or changes the CPU state means it can't be.
+static bool arm_is_idle(arminstr_t* instr) {
+    switch (get_arm_instr_type(instr)) {
+        case DATA_PROCESSING:
+            return instr->parsed.DATA_PROCESSING.rd != REG_PC;
+        case SINGLE_DATA_TRANSFER:
+            return instr->parsed.SINGLE_DATA_TRANSFER.l;
+        case HALFWORD_DT_RO:
+        case HALFWORD_DT_IO:
+            return instr->parsed.HALFWORD_DT_RO.l;
+        default:
+            return false;
+    }
+}
+
+static bool thumb_is_idle(thumbinstr_t* instr) {
+    switch (get_thumb_instr_type(instr)) {
+        case MOVE_SHIFTED_REGISTER:
+        case ADD_SUBTRACT:
+        case IMMEDIATE_OPERATIONS:
+        case ALU_OPERATIONS:
+        case PC_RELATIVE_LOAD:
+        case LOAD_ADDRESS:
+            return true;
+        case LOAD_STORE_RO:
+            return instr->LOAD_STORE_RO.l;
+        case LOAD_STORE_BYTE_HALFWORD:
+            return instr->LOAD_STORE_BYTE_HALFWORD.s || instr->LOAD_STORE_BYTE_HALFWORD.h; // Everything but STRH
+        case LOAD_STORE_IO:
+            return instr->LOAD_STORE_IO.l;
+        case LOAD_STORE_HALFWORD:
+            return instr->LOAD_STORE_HALFWORD.l;
+        case SP_RELATIVE_LOAD_STORE:
+            return instr->SP_RELATIVE_LOAD_STORE.l;
+        default:
+            return false;
+    }
+}
+
+// Where the instruction at address branches to, or 0 if it isn't a plain branch
+static word branch_target(cached_instr_t* instr, word address, bool thumb) {
+    if (thumb) {
+        thumbinstr_t* thumb_instr = &instr->instr.thumb;
+        switch (get_thumb_instr_type(thumb_instr)) {
+            case CONDITIONAL_BRANCH:
+                return address + 4 + (sign_extend_word(thumb_instr->CONDITIONAL_BRANCH.soffset, 8, 32) << 1);
+            case UNCONDITIONAL_BRANCH:
+                return address + 4 + (sign_extend_word(thumb_instr->UNCONDITIONAL_BRANCH.offset, 11, 32) << 1);
+            default:
+                return 0;
+        }
+    } else if (get_arm_instr_type(&instr->instr.arm) == BRANCH && !instr->instr.arm.parsed.BRANCH.link) {
+        return address + 8 + (sign_extend_word(instr->instr.arm.parsed.BRANCH.offset, 24, 32) << 2);
+    }
+    return 0;
+}
+
+void add_idle_loop(word address) {
+    if (num_idle_loops == MAX_IDLE_LOOPS) {
+        logfatal("Too many idle loops! At most %d are supported.", MAX_IDLE_LOOPS)
+    }
+    idle_loops[num_idle_loops++] = address & ~1u;
+}
+
+static idle_loop_t find_idle_loop(cached_instr_t* instrs, int length, word address, bool thumb, word* loop_start) {
+    word size = thumb ? sizeof(half) : sizeof(word);
+    word target = branch_target(&instrs[length - 1], address + (length - 1) * size, thumb);
+    *loop_start = target;
+    if (target == 0) {
+        return IDLE_NO;
+    }
+
+    for (int i = 0; i < num_idle_loops; i++) {
+        if (idle_loops[i] == target) {
+            return IDLE_ALWAYS;
+        }
+    }
+
+    if (!idle_loop_detection || target != address) {
+        return IDLE_NO;
+    }
+    for (int i = 0; i < length - 1; i++) {
+        if (thumb ? !thumb_is_idle(&instrs[i].instr.thumb) : !arm_is_idle(&instrs[i].instr.arm)) {
+            return IDLE_NO;
+        }
+    }
+    return IDLE_MAYBE;
+}
+
+INLINE int code_page(word address) {
+    if ((address >> 24) == 0x2) {
+        return IWRAM_CODE_PAGES + ((address & 0x3FFFF) >> CODE_PAGE_SHIFT);
+    } else {
+        return (address & 0x7FFF) >> CODE_PAGE_SHIFT;
+    }
+}
+
+INLINE word block_generation(int first_page, int num_pages) {
+    word generation = 0;
+    for (int page = first_page; page < first_page + num_pages; page++) {
+        generation += page_generation[page];
+    }
+    return generation;
+}
+
+static cached_block_t* decode_block(arm7tdmi_t* state, word address, bool thumb, bool ram) {
+    cached_instr_t instrs[BLOCK_MAX_INSTRS + 1];
+    word size = thumb ? sizeof(half) : sizeof(word);
+    int length = 0;
+    bool end = false;
+
+    while (!end && length < BLOCK_MAX_INSTRS) {
+        word pc = address + length * size;
+        cached_instr_t* instr = &instrs[length++];
+        if (thumb) {
+            instr->instr.thumb.raw = state->read_half(pc);
+            instr->handler.thumb = get_thumb_handler(&instr->instr.thumb);
+            instr->fetch = state->read_half(pc + 2 * size);
+            instr->cond = AL;
+            instr->kind = KIND_THUMB + get_thumb_type(&instr->instr.thumb);
+            end = thumb_ends_block(&instr->instr.thumb);
+        } else {
+            instr->instr.arm.raw = state->read_word(pc);
+            instr->handler.arm = get_arm_handler(&instr->instr.arm);
+            decode_arm_operands(&instr->instr.arm, &instr->ops);
+            instr->fetch = state->read_word(pc + 2 * size);
+            instr->cond = instr->instr.arm.parsed.cond;
+            instr->kind = KIND_ARM + get_arm_type(&instr->instr.arm);
+            end = arm_ends_block(&instr->instr.arm);
+        }
+    }
+
+    instrs[length].kind = KIND_BLOCK_END;
+
+    int first_page = 0;
+    int num_pages = 0;
+    if (ram) {
+        // The block covers every instruction, plus the two words the pipeline fetches past its end
+        first_page = code_page(address);
+        int last_page = code_page(address + (length + 2) * size - 1);
+        if (last_page < first_page) {
+            return NULL; // Wraps around the end of the region, don't bother
+        }
+        num_pages = last_page - first_page + 1;
+    }
+
+    cached_block_t* block = malloc(sizeof(cached_block_t) + (length + 1) * sizeof(cached_instr_t));
+    block->start = address;
+    block->thumb = thumb;
+    block->ram = ram;
+    block->first_page = first_page;
+    block->num_pages = num_pages;
+    block->executions = 0;
+    block->jit_code = NULL;
+    block->jit_epoch = 0;
+    block->idle_loop = find_idle_loop(instrs, length, address, thumb, &block->loop_start);
+    block->length = length;
+    memcpy(block->instrs, instrs, (length + 1) * sizeof(cached_instr_t));
+
+    for (int page = first_page; page < first_page + num_pages; page++) {
+        code_pages[page] = true;
+    }
+    block->generation = block_generation(first_page, num_pages);
+
+    logdebug("Decoded %s block at 0x%08X: %d instructions%s", thumb ? "THUMB" : "ARM", address, length,
+             block->idle_loop == IDLE_NO ? "" : ", idle loop")
+    return block;
+}
+
+cached_block_t* get_cached_block(arm7tdmi_t* state, word address, bool thumb) {
+    bool ram;
+    switch (address >> 24) {
+        case 0x0: // BIOS
+            if (address >= 0x4000) {
+                return NULL;
+            }
+            ram = false;
+            break;
+        case 0x2: // EWRAM
+        case 0x3: // IWRAM
+            ram = true;
+            break;
+        case 0x8: // ROM (and its mirrors). Never written, never invalidated.
+        case 0x9:
+        case 0xA:
+        case 0xB:
+        case 0xC:
+        case 0xD:
+            ram = false;
+            break;
+        default:
+            return NULL;
+    }
+
+    word bucket = bucket_for(address, thumb);
+    cached_block_t** link = &buckets[bucket];
+    while (*link && ((*link)->start != address || (*link)->thumb != thumb)) {
+        link = &(*link)->next;
+    }
+
+    cached_block_t* block = *link;
+    if (block) {
+        if (!block->ram || block->generation == block_generation(block->first_page, block->num_pages)) {
+            return block;
+        }
+        // Stale, something wrote to the memory it was decoded from
+        *link = block->next;
+        free(block);
+    }
+
+    block = decode_block(state, address, thumb, ram);
+    if (block) {
+        block->next = buckets[bucket];
+        buckets[bucket] = block;
+    }
+    return block;
+}
+
+void invalidate_code_page(arm7tdmi_t* state, int page) {
+    logdebug("Invalidating cached code in page %d", page)
+    page_generation[page]++;
+    code_pages[page] = false;
+    state->exit_block = true;
+}
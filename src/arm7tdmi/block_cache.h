@@ -0,0 +1,97 @@
+#ifndef __BLOCK_CACHE_H__
+#define __BLOCK_CACHE_H__
+
+#include <stdbool.h>
+
+#include "../common/util.h"
+#include "arm7tdmi.h"
+
+// Longest run of instructions decoded into one block
+#define BLOCK_MAX_INSTRS 32
+
+// IWRAM and EWRAM are split into pages of this size to track which parts of them hold cached code
+#define CODE_PAGE_SHIFT 7
+#define IWRAM_CODE_PAGES (0x8000 >> CODE_PAGE_SHIFT)
+#define EWRAM_CODE_PAGES (0x40000 >> CODE_PAGE_SHIFT)
+#define CODE_PAGES (IWRAM_CODE_PAGES + EWRAM_CODE_PAGES)
+
+// Where the threaded interpreter jumps to run an instruction: KIND_THUMB plus its thumb_instr_type_t, or KIND_ARM plus
+// its arm_instr_type_t. Every block ends with a BLOCK_END entry.
+typedef enum instr_kind {
+    KIND_THUMB,
+    KIND_ARM = KIND_THUMB + THUMB_UNDEFINED + 1,
+    KIND_BLOCK_END = KIND_ARM + SOFTWARE_INTERRUPT + 1
+} instr_kind_t;
+
+typedef struct cached_instr {
+    union {
+        arm_handler_t arm;
+        thumb_handler_t thumb;
+    } handler;
+    union {
+        arminstr_t arm;
+        thumbinstr_t thumb;
+    } instr;
+    arm_operands_t ops; // Only filled in for ARM
+    // What the pipeline fetches while this instruction executes: the instruction two slots ahead.
+    word fetch;
+    arm_cond_t cond; // Always AL for THUMB, and checked before anything else for ARM
+    instr_kind_t kind;
+} cached_instr_t;
+
+typedef enum idle_loop {
+    IDLE_NO,
+    IDLE_MAYBE, // Only reads memory and branches back to its start. Idle if going around once doesn't change anything.
+    IDLE_ALWAYS // Branches back to an address given to add_idle_loop()
+} idle_loop_t;
+
+typedef struct cached_block {
+    word start;
+    bool thumb;
+    bool ram; // Lives in IWRAM/EWRAM, and so can be invalidated by writes
+    int first_page;
+    int num_pages;
+    word generation; // Sum of the generations of the pages this block covers when it was decoded
+    struct cached_block* next;
+    // Used by the JIT
+    int executions;
+    void* jit_code;
+    word jit_epoch; // jit_code is only valid if this matches the JIT's current epoch
+    idle_loop_t idle_loop;
+    word loop_start; // Where the last instruction branches to, if it's an idle loop
+    int length;
+    cached_instr_t instrs[]; // length instructions, then the BLOCK_END entry
+} cached_block_t;
+
+extern bool code_pages[CODE_PAGES];
+
+// Returns the block starting at address, decoding it first if it isn't cached or is stale.
+// Returns NULL for code in regions that aren't cached (VRAM, open bus, etc.)
+cached_block_t* get_cached_block(arm7tdmi_t* state, word address, bool thumb);
+
+void invalidate_code_page(arm7tdmi_t* state, int page);
+
+// Turns detection of IDLE_MAYBE loops on or off, only affects blocks decoded after the call.
+extern bool idle_loop_detection;
+// Treats any loop back to address as idle, without checking. For games whose idle loops do more than just poll.
+void add_idle_loop(word address);
+
+// Runs the block through the interpreter, stopping early if it branches or the bus sets exit_block.
+int interpret_block(arm7tdmi_t* state, cached_block_t* block);
+
+// Called by the bus for every write to IWRAM/EWRAM, index is the offset into the region.
+INLINE void iwram_code_write(arm7tdmi_t* state, word index) {
+    int page = index >> CODE_PAGE_SHIFT;
+    if (code_pages[page]) {
+        invalidate_code_page(state, page);
+    }
+}
+
+INLINE void ewram_code_write(arm7tdmi_t* state, word index) {
+    int page = IWRAM_CODE_PAGES + (index >> CODE_PAGE_SHIFT);
+    if (code_pages[page]) {
+        invalidate_code_page(state, page);
+    }
+}
+
+#endif
@@ -0,0 +1,749 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "jit.h"
+#include "../common/log.h"
+
+bool jit_enabled = false;
+
+#if defined(__x86_64__)
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "shifts.h"
+#include "x86_64_emitter.h"
+
+// Blocks are compiled into this buffer one after another. When it fills up, everything in it is thrown away.
+#define JIT_BUFFER_SIZE (16 * 1024 * 1024)
+
+// Writes buffered while verifying a single block
+#define VERIFY_MAX_WRITES 1024
+
+typedef int (*jit_block_t)(arm7tdmi_t* state);
+
+static byte* jit_buffer = NULL;
+static byte* jit_ptr = NULL;
+static word jit_epoch = 1; // Bumped when the buffer is flushed. Blocks compiled in an older epoch have to be recompiled.
+
+static jit_memory_t jit_mem;
+static bool jit_verify = false;
+static FILE* perf_map = NULL;
+
+#define STATE(field) ((word)offsetof(arm7tdmi_t, field))
+#define REG(index) (STATE(r) + (index) * sizeof(word))
+
+// Register usage in compiled code:
+// rbx: arm7tdmi_t* state
+// r12: cycles taken so far
+// rax, rcx, rdx, rsi, rdi: scratch, clobbered by every call into the interpreter
+
+INLINE word instr_size(cached_block_t* block) {
+    return block->thumb ? sizeof(half) : sizeof(word);
+}
+
+// What the PC is after instruction i ran, if it didn't branch
+INLINE word pc_after(cached_block_t* block, int i) {
+    return block->start + (i + 2) * instr_size(block);
+}
+
+// Leaves pc, pipeline and instr the way step_cached would after running instruction i.
+// Everything but the first instruction's pipeline shift is a constant, so this can be done as late as we like.
+static void emit_sync(x86_emitter_t* e, cached_block_t* block, int i) {
+    cached_instr_t* cached = &block->instrs[i];
+    if (i == 0) {
+        emit_load32(e, RAX, RBX, STATE(pipeline[1]));
+        emit_store32(e, RBX, STATE(pipeline[0]), RAX);
+    } else {
+        emit_store32_imm(e, RBX, STATE(pipeline[0]), block->instrs[i - 1].fetch);
+    }
+    emit_store32_imm(e, RBX, STATE(pipeline[1]), cached->fetch);
+    emit_store32_imm(e, RBX, STATE(pc), pc_after(block, i));
+    emit_store32_imm(e, RBX, STATE(instr), block->thumb ? cached->instr.thumb.raw : cached->instr.arm.raw);
+}
+
+// function(state, arg, arg2)
+static void emit_call(x86_emitter_t* e, uintptr_t function, void* arg, void* arg2) {
+    emit_mov64_reg(e, RDI, RBX);
+    emit_mov64_imm(e, RSI, (uintptr_t)arg);
+    if (arg2) {
+        emit_mov64_imm(e, RDX, (uintptr_t)arg2);
+    }
+    emit_mov64_imm(e, RAX, function);
+    emit_call_reg(e, RAX);
+}
+
+// Runs instruction i through its interpreter handler, and adds the cycles it took to r12
+static void emit_interpreted(x86_emitter_t* e, cached_block_t* block, int i) {
+    cached_instr_t* cached = &block->instrs[i];
+    emit_store32_imm(e, RBX, STATE(this_step_ticks), 0);
+    if (block->thumb) {
+        emit_call(e, (uintptr_t)cached->handler.thumb, &cached->instr.thumb, NULL);
+    } else if (cached->cond == AL) {
+        emit_call(e, (uintptr_t)cached->handler.arm, &cached->instr.arm, &cached->ops);
+    } else {
+        emit_call(e, (uintptr_t)check_cond, &cached->instr.arm, NULL);
+        emit_movzx8(e, RAX, RAX);
+        emit_alu32_reg(e, OP_TEST, RAX, RAX);
+        byte* skip = emit_jcc(e, CC_Z);
+        emit_call(e, (uintptr_t)cached->handler.arm, &cached->instr.arm, &cached->ops);
+        byte* done = emit_jmp(e);
+        emit_patch_jump(e, skip);
+        emit_store32_imm(e, RBX, STATE(this_step_ticks), 1);
+        emit_patch_jump(e, done);
+    }
+
+    // Assume a step of 0 cycles is an unknown number of cycles. Consider it 1 cycle
+    emit_load32(e, RAX, RBX, STATE(this_step_ticks));
+    emit_mov32_imm(e, RCX, 1);
+    emit_alu32_reg(e, OP_TEST, RAX, RAX);
+    emit_cmovz(e, RAX, RCX);
+    emit_alu32_reg(e, OP_ADD, R12, RAX);
+}
+
+// Leaves the block if the last instruction branched or the bus wants the rest of the system to catch up
+static void emit_exit_checks(x86_emitter_t* e, cached_block_t* block, int i, byte** exits, int* num_exits) {
+    if (i == block->length - 1) {
+        return; // Falls through to the end of the block anyway
+    }
+    emit_load32(e, RAX, RBX, STATE(pc));
+    emit_alu32_imm(e, ALU_CMP, RAX, pc_after(block, i));
+    exits[(*num_exits)++] = emit_jcc(e, CC_NZ);
+    emit_cmp8_mem_imm(e, RBX, STATE(exit_block), 0);
+    exits[(*num_exits)++] = emit_jcc(e, CC_NZ);
+}
+
+// Stores the x86 flags of the last operation as NZCV. ARM's carry for subtraction is the inverse of x86's borrow.
+static void emit_nzcv(x86_emitter_t* e, bool subtract) {
+    emit_setcc_mem(e, CC_S, RBX, STATE(flags.N));
+    emit_setcc_mem(e, CC_Z, RBX, STATE(flags.Z));
+    emit_setcc_mem(e, subtract ? CC_NC : CC_C, RBX, STATE(flags.C));
+    emit_setcc_mem(e, CC_O, RBX, STATE(flags.V));
+    emit_store8_imm(e, RBX, STATE(flags.nz_stored), true);
+    emit_store32_imm(e, RBX, STATE(flags.op), FLAGS_STORED);
+}
+
+// THUMB ALU instructions that only touch r0-r7 and the flags. Returns false if the instruction isn't one of them.
+static bool emit_thumb_alu(x86_emitter_t* e, thumbinstr_t* instr) {
+    switch (get_thumb_instr_type(instr)) {
+        case IMMEDIATE_OPERATIONS: {
+            immediate_operations_t* op = &instr->IMMEDIATE_OPERATIONS;
+            switch (op->opcode) {
+                case 0: // MOV
+                    emit_store32_imm(e, RBX, REG(op->rd), op->offset);
+                    emit_store32_imm(e, RBX, STATE(flags.nz_result), op->offset);
+                    emit_store8_imm(e, RBX, STATE(flags.nz_stored), false);
+                    return true;
+                case 1: // CMP
+                    emit_load32(e, RCX, RBX, REG(op->rd));
+                    emit_alu32_imm(e, ALU_CMP, RCX, op->offset);
+                    emit_nzcv(e, true);
+                    return true;
+                case 2: // ADD
+                    emit_load32(e, RCX, RBX, REG(op->rd));
+                    emit_alu32_imm(e, ALU_ADD, RCX, op->offset);
+                    emit_nzcv(e, false);
+                    emit_store32(e, RBX, REG(op->rd), RCX);
+                    return true;
+                default:
+                    // The interpreter's SUB passes its operands to set_flags_sub in a different order than everything
+                    // else does. Let it keep doing that, so the two can't disagree.
+                    return false;
+            }
+        }
+        case ADD_SUBTRACT: {
+            add_subtract_t* op = &instr->ADD_SUBTRACT;
+            emit_load32(e, RCX, RBX, REG(op->rs));
+            if (op->i) {
+                emit_alu32_imm(e, op->op ? ALU_SUB : ALU_ADD, RCX, op->rn_or_offset);
+            } else {
+                emit_load32(e, RDX, RBX, REG(op->rn_or_offset));
+                emit_alu32_reg(e, op->op ? OP_SUB : OP_ADD, RCX, RDX);
+            }
+            emit_nzcv(e, op->op);
+            emit_store32(e, RBX, REG(op->rd), RCX);
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+// Skips the code emitted until the returned jump is patched if the ARM instruction's condition fails.
+// Returns NULL if there's nothing to check.
+static byte* emit_cond_check(x86_emitter_t* e, cached_instr_t* cached) {
+    if (cached->cond == AL) {
+        return NULL;
+    }
+    emit_call(e, (uintptr_t)check_cond, &cached->instr.arm, NULL);
+    emit_movzx8(e, RAX, RAX);
+    emit_alu32_reg(e, OP_TEST, RAX, RAX);
+    return emit_jcc(e, CC_Z);
+}
+
+// ARM data processing with an immediate or a register shifted by a constant as operand2, and without r15 anywhere.
+// ADC/SBC/RSC, and logical instructions that would set the carry from the shifter, are left to the interpreter.
+// Returns false if the instruction isn't one of these. Skipped or not, it takes a cycle.
+static bool emit_arm_data_processing(x86_emitter_t* e, cached_instr_t* cached) {
+    data_processing_t* op = &cached->instr.arm.parsed.DATA_PROCESSING;
+    arm_operands_t* ops = &cached->ops;
+    if (get_arm_instr_type(&cached->instr.arm) != DATA_PROCESSING || ops->rd == 15 || ops->rn == 15) {
+        return false;
+    }
+
+    bool logical;
+    switch (op->opcode) {
+        case 0x0: case 0x1: case 0x8: case 0x9: case 0xC: case 0xD: case 0xE: case 0xF:
+            logical = true;
+            break;
+        case 0x2: case 0x3: case 0x4: case 0xA: case 0xB:
+            logical = false;
+            break;
+        default:
+            return false;
+    }
+
+    bool shifted = false;
+    if (!ops->use_immediate) {
+        if (ops->shift_by_register || ops->rm == 15) {
+            return false;
+        }
+        shifted = ops->shift_amount != 0;
+        // Shifting by 0 means shifting by 32 (or RRX) for everything but LSL
+        if (ops->shift_type == ROR || (ops->shift_type != LSL && !shifted)) {
+            return false;
+        }
+    }
+    if (logical && op->s && (ops->immediate_carry || shifted)) {
+        return false;
+    }
+
+    byte* skip = emit_cond_check(e, cached);
+
+    // rcx: Rn, rdx: operand2
+    if (ops->use_immediate) {
+        emit_mov32_imm(e, RDX, ops->immediate);
+    } else {
+        emit_load32(e, RDX, RBX, REG(ops->rm));
+        if (shifted && ops->shift_type == LSL) {
+            emit_shift_imm(e, false, RDX, ops->shift_amount);
+        } else if (shifted && ops->shift_type == LSR) {
+            emit_shift_imm(e, true, RDX, ops->shift_amount);
+        } else if (shifted) {
+            emit_sar_imm(e, RDX, ops->shift_amount);
+        }
+    }
+    if (op->opcode != 0xD && op->opcode != 0xF) {
+        emit_load32(e, RCX, RBX, REG(ops->rn));
+    }
+
+    x86_reg_t result = RCX;
+    bool write = true;
+    switch (op->opcode) {
+        case 0x0: // AND
+        case 0x8: // TST
+            emit_alu32_reg(e, OP_AND, RCX, RDX);
+            break;
+        case 0x1: // EOR
+        case 0x9: // TEQ
+            emit_alu32_reg(e, OP_XOR, RCX, RDX);
+            break;
+        case 0x2: // SUB
+        case 0xA: // CMP
+            emit_alu32_reg(e, OP_SUB, RCX, RDX);
+            break;
+        case 0x3: // RSB
+            emit_alu32_reg(e, OP_SUB, RDX, RCX);
+            result = RDX;
+            break;
+        case 0x4: // ADD
+        case 0xB: // CMN
+            emit_alu32_reg(e, OP_ADD, RCX, RDX);
+            break;
+        case 0xC: // ORR
+            emit_alu32_reg(e, OP_OR, RCX, RDX);
+            break;
+        case 0xD: // MOV
+            result = RDX;
+            break;
+        case 0xE: // BIC
+            emit_not32(e, RDX);
+            emit_alu32_reg(e, OP_AND, RCX, RDX);
+            break;
+        case 0xF: // MVN
+            emit_not32(e, RDX);
+            result = RDX;
+            break;
+    }
+    if (op->opcode >= 0x8 && op->opcode <= 0xB) {
+        write = false;
+    }
+
+    if (op->s && logical) {
+        // Same as set_flags_nz(), C and V are left alone
+        emit_store32(e, RBX, STATE(flags.nz_result), result);
+        emit_store8_imm(e, RBX, STATE(flags.nz_stored), false);
+    } else if (op->s) {
+        emit_nzcv(e, op->opcode == 0x2 || op->opcode == 0x3 || op->opcode == 0xA);
+    }
+    if (write) {
+        emit_store32(e, RBX, REG(ops->rd), result);
+    }
+
+    if (skip) {
+        emit_patch_jump(e, skip);
+    }
+    return true;
+}
+
+// [rax + rsi] <-> rd
+static void emit_memory_access(x86_emitter_t* e, bool load, int rd, int size) {
+    if (load) {
+        emit_load_indexed(e, size, RCX, RAX, RSI);
+        emit_store32(e, RBX, REG(rd), RCX);
+    } else {
+        emit_load32(e, RCX, RBX, REG(rd));
+        emit_store_indexed(e, size, RAX, RSI, RCX);
+    }
+}
+
+// LDR/STR/LDRB/STRB of rd at rn + offset. Aligned accesses to IWRAM, EWRAM and ROM are done inline, anything else
+// (IO, VRAM, misaligned words, writes to pages holding cached code) goes through the interpreter and the bus.
+// pre: the offset is added before the access, writeback: rn + offset is written back to rn afterwards.
+// skip: a jump from emit_cond_check() for the instruction, or NULL.
+// synced: the instruction pc, pipeline and instr are up to date for, see emit_block(). Syncing instruction 0 again
+// would shift the pipeline twice.
+static void emit_load_store(x86_emitter_t* e, cached_block_t* block, int i, byte** exits, int* num_exits, int synced,
+                            byte* skip, int rd, int rn, word offset, int size, bool load, bool pre, bool writeback) {
+    byte* slow[4];
+    int num_slow = 0;
+    byte* fast[3];
+    int num_fast = 0;
+
+    emit_load32(e, RSI, RBX, REG(rn));
+    if (pre && offset != 0) {
+        emit_alu32_imm(e, ALU_ADD, RSI, offset);
+    }
+    if (size == sizeof(word)) {
+        emit_alu32_reg(e, OP_MOV, RCX, RSI);
+        emit_alu32_imm(e, ALU_AND, RCX, 3);
+        slow[num_slow++] = emit_jcc(e, CC_NZ);
+    }
+    emit_alu32_reg(e, OP_MOV, RAX, RSI);
+    emit_shift_imm(e, true, RAX, 24);
+
+    struct {
+        word region;
+        word mask;
+        byte* base;
+        int first_page;
+    } rams[] = {
+            {0x2, 0x3FFFF, jit_mem.ewram, IWRAM_CODE_PAGES},
+            {0x3, 0x7FFF, jit_mem.iwram, 0}
+    };
+
+    for (int r = 0; r < 2; r++) {
+        emit_alu32_imm(e, ALU_CMP, RAX, rams[r].region);
+        byte* next = emit_jcc(e, CC_NZ);
+        emit_alu32_imm(e, ALU_AND, RSI, rams[r].mask);
+        if (!load) {
+            // Let the bus invalidate the code
+            emit_alu32_reg(e, OP_MOV, RDX, RSI);
+            emit_shift_imm(e, true, RDX, CODE_PAGE_SHIFT);
+            emit_mov64_imm(e, RCX, (uintptr_t)&code_pages[rams[r].first_page]);
+            emit_load_indexed(e, 1, RCX, RCX, RDX);
+            emit_alu32_reg(e, OP_TEST, RCX, RCX);
+            slow[num_slow++] = emit_jcc(e, CC_NZ);
+        }
+        emit_mov64_imm(e, RAX, (uintptr_t)rams[r].base);
+        emit_memory_access(e, load, rd, size);
+        fast[num_fast++] = emit_jmp(e);
+        emit_patch_jump(e, next);
+    }
+
+    if (load && jit_mem.rom_size >= sizeof(word)) {
+        // Only the first mirror, and never past the end of the ROM
+        word rom_size = jit_mem.rom_size < 0x1000000 ? jit_mem.rom_size : 0x1000000;
+        emit_alu32_imm(e, ALU_CMP, RAX, 0x8);
+        slow[num_slow++] = emit_jcc(e, CC_NZ);
+        emit_alu32_imm(e, ALU_AND, RSI, 0xFFFFFF);
+        emit_alu32_imm(e, ALU_CMP, RSI, rom_size - size + 1);
+        slow[num_slow++] = emit_jcc(e, CC_NC);
+        emit_mov64_imm(e, RAX, (uintptr_t)jit_mem.rom);
+        emit_memory_access(e, load, rd, size);
+        fast[num_fast++] = emit_jmp(e);
+    }
+
+    for (int s = 0; s < num_slow; s++) {
+        emit_patch_jump(e, slow[s]);
+    }
+    if (synced != i) {
+        emit_sync(e, block, i);
+    }
+    emit_interpreted(e, block, i);
+    emit_exit_checks(e, block, i, exits, num_exits);
+    byte* done = emit_jmp(e);
+
+    for (int f = 0; f < num_fast; f++) {
+        emit_patch_jump(e, fast[f]);
+    }
+    if (writeback) {
+        emit_load32(e, RCX, RBX, REG(rn));
+        emit_alu32_imm(e, ALU_ADD, RCX, offset);
+        emit_store32(e, RBX, REG(rn), RCX);
+    }
+    if (skip) {
+        emit_patch_jump(e, skip);
+    }
+    emit_alu32_imm(e, ALU_ADD, R12, 1);
+    emit_patch_jump(e, done);
+}
+
+static void emit_thumb_load_store_io(x86_emitter_t* e, cached_block_t* block, int i, byte** exits, int* num_exits,
+                                     int synced) {
+    load_store_io_t* op = &block->instrs[i].instr.thumb.LOAD_STORE_IO;
+    int size = op->b ? sizeof(byte) : sizeof(word);
+    word offset = op->offset << (op->b ? 0 : 2);
+    emit_load_store(e, block, i, exits, num_exits, synced, NULL, op->rd, op->rb, offset, size, op->l, true, false);
+}
+
+// ARM LDR/STR/LDRB/STRB with an immediate offset and no r15. Returns false if the instruction isn't one of them.
+static bool emit_arm_load_store(x86_emitter_t* e, cached_block_t* block, int i, byte** exits, int* num_exits,
+                                int synced) {
+    cached_instr_t* cached = &block->instrs[i];
+    single_data_transfer_t* op = &cached->instr.arm.parsed.SINGLE_DATA_TRANSFER;
+    arm_operands_t* ops = &cached->ops;
+    if (get_arm_instr_type(&cached->instr.arm) != SINGLE_DATA_TRANSFER || !ops->use_immediate || ops->rd == 15 || ops->rn == 15) {
+        return false;
+    }
+
+    int size = op->b ? sizeof(byte) : sizeof(word);
+    word offset = op->u ? ops->immediate : -ops->immediate;
+    // Post-indexed always writes back, a load into the base register wins over the writeback
+    bool writeback = (op->w || !op->p) && (!op->l || ops->rd != ops->rn);
+    byte* skip = emit_cond_check(e, cached);
+    emit_load_store(e, block, i, exits, num_exits, synced, skip, ops->rd, ops->rn, offset, size, op->l, op->p, writeback);
+    return true;
+}
+
+
+static void emit_block(x86_emitter_t* e, cached_block_t* block) {
+    byte* exits[BLOCK_MAX_INSTRS * 2];
+    int num_exits = 0;
+
+    emit_push(e, RBX);
+    emit_push(e, R12);
+    emit_push(e, R13); // Only here to keep the stack 16 byte aligned for calls
+    emit_mov64_reg(e, RBX, RDI);
+    emit_mov32_imm(e, R12, 0);
+    emit_store8_imm(e, RBX, STATE(exit_block), 0);
+    emit_sync(e, block, 0);
+
+    int synced = 0; // Instruction pc, pipeline and instr are currently up to date for
+    int pending_cycles = 0; // Cycles of inline instructions not yet added to r12
+
+    for (int i = 0; i < block->length; i++) {
+        cached_instr_t* cached = &block->instrs[i];
+        if (block->thumb ? emit_thumb_alu(e, &cached->instr.thumb) : emit_arm_data_processing(e, cached)) {
+            pending_cycles++;
+            continue;
+        }
+
+        if (pending_cycles > 0) {
+            emit_alu32_imm(e, ALU_ADD, R12, pending_cycles);
+            pending_cycles = 0;
+        }
+
+        if (block->thumb && get_thumb_instr_type(&cached->instr.thumb) == LOAD_STORE_IO) {
+            emit_thumb_load_store_io(e, block, i, exits, &num_exits, synced);
+        } else if (block->thumb || !emit_arm_load_store(e, block, i, exits, &num_exits, synced)) {
+            if (synced != i) {
+                emit_sync(e, block, i);
+                synced = i;
+            }
+            emit_interpreted(e, block, i);
+            emit_exit_checks(e, block, i, exits, &num_exits);
+        }
+    }
+
+    if (pending_cycles > 0) {
+        emit_alu32_imm(e, ALU_ADD, R12, pending_cycles);
+    }
+    if (synced != block->length - 1) {
+        emit_sync(e, block, block->length - 1);
+    }
+
+    for (int i = 0; i < num_exits; i++) {
+        emit_patch_jump(e, exits[i]);
+    }
+    emit_alu32_reg(e, OP_MOV, RAX, R12);
+    emit_pop(e, R13);
+    emit_pop(e, R12);
+    emit_pop(e, RBX);
+    emit_ret(e);
+}
+
+// The buffer is never writable and executable at the same time. The pages a block is emitted into are made writable
+// first, and executable once it's done. Nothing compiled runs while a block is being compiled.
+static void jit_protect(byte* start, byte* end, int prot) {
+    uintptr_t page_size = sysconf(_SC_PAGESIZE);
+    uintptr_t first = (uintptr_t)start & ~(page_size - 1);
+    uintptr_t last = ((uintptr_t)end + page_size - 1) & ~(page_size - 1);
+    if (mprotect((void*)first, last - first, prot) != 0) {
+        logfatal("Unable to change the protection of the JIT buffer")
+    }
+}
+
+static void compile_block(cached_block_t* block) {
+    x86_emitter_t e = {jit_ptr, jit_buffer + JIT_BUFFER_SIZE};
+    jit_protect(jit_ptr, e.end, PROT_READ | PROT_WRITE);
+    emit_block(&e, block);
+    if (e.ptr > e.end) {
+        logwarn("JIT buffer is full, throwing away all compiled code")
+        jit_epoch++;
+        jit_ptr = jit_buffer;
+        e.ptr = jit_ptr;
+        jit_protect(jit_ptr, e.end, PROT_READ | PROT_WRITE);
+        emit_block(&e, block);
+        if (e.ptr > e.end) {
+            logfatal("Block at 0x%08X doesn't fit in an empty JIT buffer", block->start)
+        }
+    }
+    jit_protect(jit_ptr, e.ptr, PROT_READ | PROT_EXEC);
+
+    size_t size = e.ptr - jit_ptr;
+    block->jit_code = jit_ptr;
+    block->jit_epoch = jit_epoch;
+    jit_ptr += (size + 15) & ~15;
+
+    logdebug("Compiled %s block at 0x%08X: %d instructions, %zu bytes", block->thumb ? "THUMB" : "ARM", block->start, block->length, size)
+    if (perf_map) {
+        fprintf(perf_map, "%lx %zx gba_%s_%08X\n", (uintptr_t)block->jit_code, size, block->thumb ? "thumb" : "arm", block->start);
+        fflush(perf_map);
+    }
+}
+
+// Verification: the interpreter runs the block first, with every write it makes held back in a buffer so the bus doesn't
+// see anything twice. Then the compiled block runs for real, and everything the two did is compared.
+
+typedef struct buffered_write {
+    word address;
+    int size;
+    word value;
+} buffered_write_t;
+
+static buffered_write_t buffered_writes[VERIFY_MAX_WRITES];
+static int num_buffered_writes = 0;
+static arm7tdmi_t* verify_state = NULL;
+static arm7tdmi_t bus_callbacks; // Only the callbacks are used
+
+INLINE bool is_ram(word address) {
+    return (address >> 24) == 0x2 || (address >> 24) == 0x3;
+}
+
+// Removes the mirroring, so buffered writes can be compared by address
+INLINE word ram_address(word address) {
+    if ((address >> 24) == 0x2) {
+        return 0x02000000 | (address & 0x3FFFF);
+    } else {
+        return 0x03000000 | (address & 0x7FFF);
+    }
+}
+
+INLINE byte* ram_ptr(word address) {
+    if ((address >> 24) == 0x2) {
+        return &jit_mem.ewram[address & 0x3FFFF];
+    } else {
+        return &jit_mem.iwram[address & 0x7FFF];
+    }
+}
+
+static byte buffered_read_byte(word address) {
+    byte value = bus_callbacks.read_byte(address);
+    if (is_ram(address)) {
+        address = ram_address(address);
+        for (int i = 0; i < num_buffered_writes; i++) {
+            buffered_write_t* write = &buffered_writes[i];
+            if (address >= write->address && address < write->address + write->size) {
+                value = write->value >> ((address - write->address) * 8);
+            }
+        }
+    }
+    return value;
+}
+
+static half buffered_read_half(word address) {
+    if (!is_ram(address)) {
+        return bus_callbacks.read_half(address);
+    }
+    address &= ~1;
+    return buffered_read_byte(address) | (buffered_read_byte(address + 1) << 8);
+}
+
+static word buffered_read_word(word address) {
+    if (!is_ram(address)) {
+        return bus_callbacks.read_word(address);
+    }
+    address &= ~3;
+    return buffered_read_half(address) | (buffered_read_half(address + 2) << 16);
+}
+
+static void buffer_write(word address, int size, word value) {
+    address &= ~(size - 1);
+    if (address >= 0x04000000 && address < 0x04000400) {
+        verify_state->exit_block = true; // Same as the bus does for IO writes
+    } else if (is_ram(address)) {
+        address = ram_address(address);
+        int page = (address >> 24) == 0x2
+                ? IWRAM_CODE_PAGES + ((address & 0x3FFFF) >> CODE_PAGE_SHIFT)
+                : (address & 0x7FFF) >> CODE_PAGE_SHIFT;
+        if (code_pages[page]) {
+            verify_state->exit_block = true; // The real write would invalidate code
+        }
+    }
+
+    if (num_buffered_writes == VERIFY_MAX_WRITES) {
+        logfatal("Too many writes while verifying a JIT block")
+    }
+    buffered_write_t* write = &buffered_writes[num_buffered_writes++];
+    write->address = address;
+    write->size = size;
+    write->value = value;
+}
+
+static void buffered_write_byte(word address, byte value) {
+    buffer_write(address, sizeof(byte), value);
+}
+
+static void buffered_write_half(word address, half value) {
+    buffer_write(address, sizeof(half), value);
+}
+
+static void buffered_write_word(word address, word value) {
+    buffer_write(address, sizeof(word), value);
+}
+
+static int verify_block(arm7tdmi_t* state, cached_block_t* block) {
+    arm7tdmi_t before = *state;
+
+    bus_callbacks = *state;
+    verify_state = state;
+    num_buffered_writes = 0;
+    state->read_byte = buffered_read_byte;
+    state->read_half = buffered_read_half;
+    state->read_word = buffered_read_word;
+    state->write_byte = buffered_write_byte;
+    state->write_half = buffered_write_half;
+    state->write_word = buffered_write_word;
+
+    int expected_cycles = interpret_block(state, block);
+    arm7tdmi_t expected = *state;
+
+    *state = before;
+    int cycles = ((jit_block_t)block->jit_code)(state);
+
+    // The two can record the same flags differently, only compare what they come out to
+    get_psr(&expected);
+    get_psr(state);
+    expected.flags = state->flags;
+
+    bool mismatch = false;
+    // Every register, banked or not, the PSRs and the pipeline
+    for (size_t offset = offsetof(arm7tdmi_t, r); offset < offsetof(arm7tdmi_t, irq); offset += sizeof(word)) {
+        word expected_value = *(word*)((byte*)&expected + offset);
+        word value = *(word*)((byte*)state + offset);
+        if (expected_value != value) {
+            logwarn("JIT: word at offset %zu of the CPU state is 0x%08X, the interpreter says 0x%08X", offset, value, expected_value)
+            mismatch = true;
+        }
+    }
+    if (expected.instr != state->instr || expected.exit_block != state->exit_block || expected_cycles != cycles) {
+        logwarn("JIT: instr 0x%08X exit_block %d cycles %d, the interpreter says instr 0x%08X exit_block %d cycles %d",
+                state->instr, state->exit_block, cycles, expected.instr, expected.exit_block, expected_cycles)
+        mismatch = true;
+    }
+
+    // The last value buffered for every byte of RAM should be what's in RAM now
+    for (int i = 0; i < num_buffered_writes; i++) {
+        buffered_write_t* write = &buffered_writes[i];
+        if (!is_ram(write->address)) {
+            continue;
+        }
+        for (int b = 0; b < write->size; b++) {
+            word address = write->address + b;
+            bool overwritten = false;
+            for (int later = i + 1; later < num_buffered_writes; later++) {
+                overwritten |= address >= buffered_writes[later].address
+                        && address < buffered_writes[later].address + buffered_writes[later].size;
+            }
+            byte expected_value = write->value >> (b * 8);
+            if (!overwritten && *ram_ptr(address) != expected_value) {
+                logwarn("JIT: 0x%08X is 0x%02X, the interpreter says 0x%02X", address, *ram_ptr(address), expected_value)
+                mismatch = true;
+            }
+        }
+    }
+
+    if (mismatch) {
+        logfatal("JIT and interpreter disagree on the %s block at 0x%08X", block->thumb ? "THUMB" : "ARM", block->start)
+    }
+    return cycles;
+}
+
+bool jit_init(jit_memory_t memory, bool verify, bool write_perf_map) {
+    // Check up front that the pages can be made executable, compile_block() flips them between RW and RX
+    jit_buffer = mmap(NULL, JIT_BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (jit_buffer != MAP_FAILED && mprotect(jit_buffer, JIT_BUFFER_SIZE, PROT_READ | PROT_EXEC) != 0) {
+        munmap(jit_buffer, JIT_BUFFER_SIZE);
+        jit_buffer = MAP_FAILED;
+    }
+    if (jit_buffer == MAP_FAILED) {
+        jit_buffer = NULL;
+        logwarn("Unable to allocate executable memory for the JIT, falling back to the interpreter")
+        return false;
+    }
+    jit_ptr = jit_buffer;
+    jit_mem = memory;
+    jit_verify = verify;
+
+    if (write_perf_map) {
+        char path[64];
+        snprintf(path, sizeof(path), "/tmp/perf-%d.map", getpid());
+        perf_map = fopen(path, "w");
+        if (!perf_map) {
+            logwarn("Unable to open %s for writing", path)
+        }
+    }
+
+    jit_enabled = true;
+    return true;
+}
+
+int jit_run_block(arm7tdmi_t* state, cached_block_t* block) {
+    if (block->jit_epoch != jit_epoch) {
+        // The interpreter logs every instruction at this verbosity, compiled code can't
+        if (++block->executions < JIT_HOT_THRESHOLD || log_get_verbosity() >= LOG_VERBOSITY_INFO) {
+            return 0;
+        }
+        compile_block(block);
+    }
+
+    if (jit_verify) {
+        return verify_block(state, block);
+    } else {
+        return ((jit_block_t)block->jit_code)(state);
+    }
+}
+
+#else
+
+bool jit_init(jit_memory_t memory, bool verify, bool write_perf_map) {
+    logwarn("The JIT only supports x86-64, falling back to the interpreter")
+    return false;
+}
+
+int jit_run_block(arm7tdmi_t* state, cached_block_t* block) {
+    return 0;
+}
+
+#endif
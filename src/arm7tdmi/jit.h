@@ -0,0 +1,33 @@
+#ifndef __JIT_H__
+#define __JIT_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "../common/util.h"
+#include "arm7tdmi.h"
+#include "block_cache.h"
+
+// A block has to run this many times through the interpreter before it gets compiled
+#define JIT_HOT_THRESHOLD 16
+
+extern bool jit_enabled;
+
+// Compiled code accesses these directly, everything else goes through the CPU's bus callbacks.
+typedef struct jit_memory {
+    byte* ewram;
+    byte* iwram;
+    byte* rom;
+    size_t rom_size;
+} jit_memory_t;
+
+// verify: run every block through the interpreter first and compare the results (slow!)
+// perf_map: write /tmp/perf-<pid>.map so perf can name the compiled blocks
+// Returns false (and leaves the JIT disabled) if it's not supported on this machine.
+bool jit_init(jit_memory_t memory, bool verify, bool perf_map);
+
+// Runs the compiled version of the block, compiling it first if it's hot enough.
+// Returns the number of cycles taken, or 0 if the interpreter should run the block instead.
+int jit_run_block(arm7tdmi_t* state, cached_block_t* block);
+
+#endif
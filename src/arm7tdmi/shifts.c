@@ -2,7 +2,7 @@
 #include "arm7tdmi.h"
 #include "shifts.h"
 
-word arm_lsr(status_register_t* cpsr, word data, word shift_amount) {
+word arm_lsr(arm7tdmi_t* carry, word data, word shift_amount) {
     logdebug("LSR shift")
     word result;
 
@@ -12,25 +12,25 @@ word arm_lsr(status_register_t* cpsr, word data, word shift_amount) {
 
     if (shift_amount < 32) {
         result = data >> shift_amount;
-        if (cpsr) {
-            cpsr->C = (data >> (shift_amount - 1u)) & 1u;
+        if (carry) {
+            set_flag_C(carry, (data >> (shift_amount - 1u)) & 1u);
         }
 
     } else {
         result = 0;
-        if (cpsr) {
+        if (carry) {
             // This has to be a special case since C doesn't like it when you >> by >= the width of a type
             if (shift_amount == 32) {
-                cpsr->C = data >> 31u;
+                set_flag_C(carry, data >> 31u);
             } else {
-                cpsr->C = 0;
+                set_flag_C(carry, 0);
             }
         }
     }
     return result;
 }
 
-word arm_lsl(status_register_t* cpsr, word data, word shift_amount) {
+word arm_lsl(arm7tdmi_t* carry, word data, word shift_amount) {
     logdebug("LSL shift")
     if (shift_amount == 0) {
         return data;
@@ -38,18 +38,18 @@ word arm_lsl(status_register_t* cpsr, word data, word shift_amount) {
         word result;
         if (shift_amount < 32) {
             result = data << shift_amount;
-            if (cpsr) {
-                cpsr->C = (data << (shift_amount - 1u)) >> 31u;
+            if (carry) {
+                set_flag_C(carry, (data << (shift_amount - 1u)) >> 31u);
             }
         }
         else {
             result = 0;
-            if (cpsr) {
+            if (carry) {
                 // This has to be a special case since C doesn't like it when you << by >= the width of a type
                 if (shift_amount == 32) {
-                    cpsr->C = data & 1u;
+                    set_flag_C(carry, data & 1u);
                 } else {
-                    cpsr->C = 0;
+                    set_flag_C(carry, 0);
                 }
             }
         }
@@ -59,14 +59,14 @@ word arm_lsl(status_register_t* cpsr, word data, word shift_amount) {
 
 }
 
-word arm_asr(status_register_t* cpsr, word data, word shift_amount) {
+word arm_asr(arm7tdmi_t* carry, word data, word shift_amount) {
     word result;
     if (shift_amount == 0) {
         result = data;
     } else {
         if (shift_amount < 32) {
-            if (cpsr) {
-                cpsr->C = (data >> (shift_amount - 1u)) & 1u;
+            if (carry) {
+                set_flag_C(carry, (data >> (shift_amount - 1u)) & 1u);
             }
             int32_t signed_data = data;
             signed_data >>= shift_amount;
@@ -77,8 +77,8 @@ word arm_asr(status_register_t* cpsr, word data, word shift_amount) {
             signed_data >>= 31u;
             result = signed_data;
 
-            if (cpsr) {
-                cpsr->C = result & 1u;
+            if (carry) {
+                set_flag_C(carry, result & 1u);
             }
         }
     }
@@ -86,46 +86,46 @@ word arm_asr(status_register_t* cpsr, word data, word shift_amount) {
     return result;
 }
 
-word arm_ror(status_register_t* cpsr, word data, word shift_amount) {
+word arm_ror(arm7tdmi_t* carry, word data, word shift_amount) {
     if (shift_amount == 0) {
         return data;
     }
 
     shift_amount &= 31u;
     word result = (data >> shift_amount) | (data << (-shift_amount & 31u));
-    if (cpsr) cpsr->C = result >> 31u;
+    if (carry) set_flag_C(carry, result >> 31u);
     return result;
 }
 
-word arm_shift(status_register_t* cpsr, shift_type_t type, word data, word shift_amount) {
+word arm_shift(arm7tdmi_t* carry, shift_type_t type, word data, word shift_amount) {
     switch (type) {
         case LSL:
-            return arm_lsl(cpsr, data, shift_amount);
+            return arm_lsl(carry, data, shift_amount);
         case LSR:
-            return arm_lsr(cpsr, data, shift_amount);
+            return arm_lsr(carry, data, shift_amount);
         case ASR:
-            return arm_asr(cpsr, data, shift_amount);
+            return arm_asr(carry, data, shift_amount);
         case ROR:
-            return arm_ror(cpsr, data, shift_amount);
+            return arm_ror(carry, data, shift_amount);
         default:
             logfatal("Unknown shift type: %d", type)
     }
 }
-word arm_shift_special_zero_behavior(arm7tdmi_t* state, status_register_t* cpsr, shift_type_t type, word data) {
+word arm_shift_special_zero_behavior(arm7tdmi_t* state, arm7tdmi_t* carry, shift_type_t type, word data) {
     logdebug("----handling special case, immediate shift amount 0----")
     switch (type) {
         case LSL:
             return data; // Not affected.
         case LSR:
             // Treat it as LSR#32
-            return arm_shift(cpsr, LSR, data, 32);
+            return arm_shift(carry, LSR, data, 32);
         case ASR:
             // Treat it as ASR#32
-            return arm_shift(cpsr, ASR, data, 32);
+            return arm_shift(carry, ASR, data, 32);
         case ROR: {
-            word oldc = state->cpsr.C;
-            if (cpsr) {
-                cpsr->C = data & 1u;
+            word oldc = get_flag_C(state);
+            if (carry) {
+                set_flag_C(carry, data & 1u);
             }
             return (oldc << 31u) | (data >> 1u);
         }
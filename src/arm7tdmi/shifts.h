@@ -4,6 +4,8 @@
 #include "../common/util.h"
 #include "arm7tdmi.h"
 
+// The carry argument is the CPU whose C flag gets the carry out of the shift, or NULL to leave the flags alone.
+
 typedef enum shift_type {
     LSL,
     LSR,
@@ -11,12 +13,12 @@ typedef enum shift_type {
     ROR
 } shift_type_t;
 
-word arm_lsl(status_register_t* cpsr, word data, word shift_amount);
-word arm_lsr(status_register_t* cpsr, word data, word shift_amount);
-word arm_asr(status_register_t* cpsr, word data, word shift_amount);
-word arm_ror(status_register_t* cpsr, word data, word shift_amount);
+word arm_lsl(arm7tdmi_t* carry, word data, word shift_amount);
+word arm_lsr(arm7tdmi_t* carry, word data, word shift_amount);
+word arm_asr(arm7tdmi_t* carry, word data, word shift_amount);
+word arm_ror(arm7tdmi_t* carry, word data, word shift_amount);
 
-word arm_shift(status_register_t* cpsr, shift_type_t type, word data, word shift_amount);
-word arm_shift_special_zero_behavior(arm7tdmi_t* state, status_register_t* cpsr, shift_type_t type, word data);
+word arm_shift(arm7tdmi_t* carry, shift_type_t type, word data, word shift_amount);
+word arm_shift_special_zero_behavior(arm7tdmi_t* state, arm7tdmi_t* carry, shift_type_t type, word data);
 
 #endif //GBA_SHIFTS_H
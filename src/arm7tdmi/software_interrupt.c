@@ -86,11 +86,11 @@ static const char* SWI_NAMES[] = {
 void software_interrupt(arm7tdmi_t* state, byte comment) {
     word adjusted_pc = state->pc - (state->cpsr.thumb ? 4 : 8);
     logwarn("adjusted pc: 0x%08X: SWI: 0x%X - %s", adjusted_pc, comment, SWI_NAMES[comment])
-    status_register_t cpsr = state->cpsr;
-    state->cpsr.mode = MODE_SUPERVISOR;
+    status_register_t cpsr = *get_psr(state);
+    set_mode(state, MODE_SUPERVISOR);
     set_spsr(state, cpsr.raw);
 
-    state->lr_svc = state->pc - (state->cpsr.thumb ? 2 : 4);
+    state->lr = state->pc - (state->cpsr.thumb ? 2 : 4);
 
     state->cpsr.thumb = 0;
     state->cpsr.disable_irq = 1;
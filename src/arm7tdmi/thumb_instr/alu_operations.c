@@ -19,7 +19,7 @@ void alu_operations(arm7tdmi_t* state, alu_operations_t* instr) {
         case 0x2: { // LSL: Rd = Rd << Rs
             word newvalue = get_register(state, instr->rd);
             word shift_amount = get_register(state, instr->rs);
-            newvalue = arm_shift(&state->cpsr, LSL, newvalue, shift_amount);
+            newvalue = arm_shift(state, LSL, newvalue, shift_amount);
             set_flags_nz(state, newvalue);
             set_register(state, instr->rd, newvalue);
             break;
@@ -27,7 +27,7 @@ void alu_operations(arm7tdmi_t* state, alu_operations_t* instr) {
         case 0x3: { // LSR: Rd = Rd >> Rs
             word newvalue = get_register(state, instr->rd);
             word shift_amount = get_register(state, instr->rs);
-            newvalue = arm_lsr(&state->cpsr, newvalue, shift_amount);
+            newvalue = arm_lsr(state, newvalue, shift_amount);
             set_flags_nz(state, newvalue);
             set_register(state, instr->rd, newvalue);
             break;
@@ -35,14 +35,14 @@ void alu_operations(arm7tdmi_t* state, alu_operations_t* instr) {
         case 0x4: { // ASR: Rd = Rd ASR Rs
             word newvalue = get_register(state, instr->rd);
             word shift_amount = get_register(state, instr->rs);
-            newvalue = arm_asr(&state->cpsr, newvalue, shift_amount);
+            newvalue = arm_asr(state, newvalue, shift_amount);
             set_flags_nz(state, newvalue);
             set_register(state, instr->rd, newvalue);
             break;
         }
         case 0x5: { // ADC: Rd = Rd + Rs + C
             uint64_t rddata = get_register(state, instr->rd);
-            uint64_t rsdata = get_register(state, instr->rs) + state->cpsr.C;
+            uint64_t rsdata = get_register(state, instr->rs) + get_flag_C(state);
             word result = rddata + rsdata;
             set_flags_add(state, rddata, rsdata);
             set_flags_nz(state, result);
@@ -52,7 +52,7 @@ void alu_operations(arm7tdmi_t* state, alu_operations_t* instr) {
         case 0x6: { // SBC: Rd = Rd - Rs - (~C)
             word rddata = get_register(state, instr->rd);
             word rsdata = get_register(state, instr->rs);
-            uint64_t tmp = rsdata - state->cpsr.C + 1;
+            uint64_t tmp = rsdata - get_flag_C(state) + 1;
 
             word result = rddata - tmp;
 
@@ -64,7 +64,7 @@ void alu_operations(arm7tdmi_t* state, alu_operations_t* instr) {
         case 0x7: { // ROR: Rd = Rd ROR Rs
             word newvalue = get_register(state, instr->rd);
             word shift_amount = get_register(state, instr->rs);
-            newvalue = arm_ror(&state->cpsr, newvalue, shift_amount);
+            newvalue = arm_ror(state, newvalue, shift_amount);
             set_flags_nz(state, newvalue);
             set_register(state, instr->rd, newvalue);
             break;
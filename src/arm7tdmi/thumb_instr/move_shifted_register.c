@@ -8,9 +8,9 @@ void move_shifted_register(arm7tdmi_t* state, move_shifted_register_t* instr) {
             word value = get_register(state, instr->rs);
             if (instr->offset == 0) {
                 // No shift performed and carry flag not updated
-                value = arm_shift_special_zero_behavior(state, &state->cpsr, LSL, value);
+                value = arm_shift_special_zero_behavior(state, state, LSL, value);
             } else {
-                value = arm_shift(&state->cpsr, LSL, value, instr->offset);
+                value = arm_shift(state, LSL, value, instr->offset);
             }
             set_register(state, instr->rd, value);
             set_flags_nz(state, value);
@@ -20,9 +20,9 @@ void move_shifted_register(arm7tdmi_t* state, move_shifted_register_t* instr) {
             word value = get_register(state, instr->rs);
             if (instr->offset == 0) {
                 // No shift performed and carry flag not updated
-                value = arm_shift_special_zero_behavior(state, &state->cpsr, LSR, value);
+                value = arm_shift_special_zero_behavior(state, state, LSR, value);
             } else {
-                value = arm_shift(&state->cpsr, LSR, value, instr->offset);
+                value = arm_shift(state, LSR, value, instr->offset);
             }
             set_register(state, instr->rd, value);
             set_flags_nz(state, value);
@@ -32,9 +32,9 @@ void move_shifted_register(arm7tdmi_t* state, move_shifted_register_t* instr) {
             word value = get_register(state, instr->rs);
             if (instr->offset == 0) {
                 // No shift performed and carry flag not updated
-                value = arm_shift_special_zero_behavior(state, &state->cpsr, ASR, value);
+                value = arm_shift_special_zero_behavior(state, state, ASR, value);
             } else {
-                value = arm_shift(&state->cpsr, ASR, value, instr->offset);
+                value = arm_shift(state, ASR, value, instr->offset);
             }
             set_register(state, instr->rd, value);
             set_flags_nz(state, value);
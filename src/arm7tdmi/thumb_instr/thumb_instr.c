@@ -3,7 +3,7 @@
 #include "../../common/util.h"
 
 thumb_instr_type_t get_thumb_instr_type(thumbinstr_t* instr) {
-    half hash = instr->raw >> 6u;
+    half hash = THUMB_INSTR_HASH(instr->raw);
 
     if ((hash & 0b1111100000u) == 0b0001100000u) {
         return ADD_SUBTRACT;
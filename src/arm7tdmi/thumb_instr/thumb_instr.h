@@ -195,6 +195,11 @@ typedef union thumbinstr {
     half raw;
 } thumbinstr_t;
 
+// The top 10 bits of a THUMB instruction are enough to tell every instruction type apart.
+#define THUMB_INSTR_HASH(raw) (((raw) >> 6u) & 0x3FFu)
+#define THUMB_INSTR_HASH_SIZE 1024
+
+// Slow, readable decoder. Only used to build the handler table and by debugging code.
 thumb_instr_type_t get_thumb_instr_type(thumbinstr_t* instr);
 
 #endif
@@ -0,0 +1,274 @@
+#ifndef __X86_64_EMITTER_H__
+#define __X86_64_EMITTER_H__
+
+#include <stdint.h>
+#include <string.h>
+
+#include "../common/util.h"
+#include "../common/log.h"
+
+// Just enough of an x86-64 assembler for the JIT. Every helper appends one instruction at emitter->ptr.
+
+typedef enum x86_reg {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15
+} x86_reg_t;
+
+typedef enum x86_cond {
+    CC_O = 0x0, CC_NO = 0x1, CC_C = 0x2, CC_NC = 0x3, CC_Z = 0x4, CC_NZ = 0x5, CC_S = 0x8
+} x86_cond_t;
+
+typedef struct x86_emitter {
+    byte* ptr;
+    byte* end;
+} x86_emitter_t;
+
+INLINE void emit_byte(x86_emitter_t* e, byte b) {
+    if (e->ptr < e->end) {
+        *e->ptr = b;
+    }
+    e->ptr++;
+}
+
+INLINE void emit_word(x86_emitter_t* e, word w) {
+    emit_byte(e, w & 0xFF);
+    emit_byte(e, (w >> 8) & 0xFF);
+    emit_byte(e, (w >> 16) & 0xFF);
+    emit_byte(e, (w >> 24) & 0xFF);
+}
+
+INLINE void emit_rex(x86_emitter_t* e, bool w, x86_reg_t reg, x86_reg_t rm, bool force) {
+    byte rex = 0x40 | (w << 3) | ((reg >> 3) << 2) | (rm >> 3);
+    if (rex != 0x40 || force) {
+        emit_byte(e, rex);
+    }
+}
+
+// ModRM for [base + disp32]. Every base we use for this (RBX, RAX) avoids the RSP/R12 SIB special case.
+INLINE void emit_modrm_disp32(x86_emitter_t* e, x86_reg_t reg, x86_reg_t base, word disp) {
+    emit_byte(e, 0x80 | ((reg & 7) << 3) | (base & 7));
+    emit_word(e, disp);
+}
+
+INLINE void emit_modrm_reg(x86_emitter_t* e, byte reg, x86_reg_t rm) {
+    emit_byte(e, 0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+// mov r32, [base + disp32]
+INLINE void emit_load32(x86_emitter_t* e, x86_reg_t dst, x86_reg_t base, word disp) {
+    emit_rex(e, false, dst, base, false);
+    emit_byte(e, 0x8B);
+    emit_modrm_disp32(e, dst, base, disp);
+}
+
+// mov [base + disp32], r32
+INLINE void emit_store32(x86_emitter_t* e, x86_reg_t base, word disp, x86_reg_t src) {
+    emit_rex(e, false, src, base, false);
+    emit_byte(e, 0x89);
+    emit_modrm_disp32(e, src, base, disp);
+}
+
+// mov dword [base + disp32], imm32
+INLINE void emit_store32_imm(x86_emitter_t* e, x86_reg_t base, word disp, word imm) {
+    emit_rex(e, false, 0, base, false);
+    emit_byte(e, 0xC7);
+    emit_modrm_disp32(e, 0, base, disp);
+    emit_word(e, imm);
+}
+
+// mov byte [base + disp32], imm8
+INLINE void emit_store8_imm(x86_emitter_t* e, x86_reg_t base, word disp, byte imm) {
+    emit_rex(e, false, 0, base, false);
+    emit_byte(e, 0xC6);
+    emit_modrm_disp32(e, 0, base, disp);
+    emit_byte(e, imm);
+}
+
+// cmp byte [base + disp32], imm8
+INLINE void emit_cmp8_mem_imm(x86_emitter_t* e, x86_reg_t base, word disp, byte imm) {
+    emit_rex(e, false, 0, base, false);
+    emit_byte(e, 0x80);
+    emit_modrm_disp32(e, 7, base, disp);
+    emit_byte(e, imm);
+}
+
+// <op> r32, imm32, where op is the /digit of the 0x81 group (0 = add, 4 = and, 5 = sub, 7 = cmp)
+INLINE void emit_alu32_imm(x86_emitter_t* e, byte op, x86_reg_t reg, word imm) {
+    emit_rex(e, false, 0, reg, false);
+    emit_byte(e, 0x81);
+    emit_modrm_reg(e, op, reg);
+    emit_word(e, imm);
+}
+
+#define ALU_ADD 0
+#define ALU_OR  1
+#define ALU_AND 4
+#define ALU_SUB 5
+#define ALU_CMP 7
+
+// <op> dst, src (32 bit), op is the opcode of the r/m32, r32 form (0x01 add, 0x09 or, 0x21 and, 0x29 sub, 0x31 xor,
+// 0x39 cmp, 0x85 test, 0x89 mov)
+INLINE void emit_alu32_reg(x86_emitter_t* e, byte opcode, x86_reg_t dst, x86_reg_t src) {
+    emit_rex(e, false, src, dst, false);
+    emit_byte(e, opcode);
+    emit_modrm_reg(e, src, dst);
+}
+
+#define OP_ADD  0x01
+#define OP_OR   0x09
+#define OP_AND  0x21
+#define OP_SUB  0x29
+#define OP_XOR  0x31
+#define OP_CMP  0x39
+#define OP_TEST 0x85
+#define OP_MOV  0x89
+
+// shl/shr r32, imm8
+INLINE void emit_shift_imm(x86_emitter_t* e, bool right, x86_reg_t reg, byte amount) {
+    emit_rex(e, false, 0, reg, false);
+    emit_byte(e, 0xC1);
+    emit_modrm_reg(e, right ? 5 : 4, reg);
+    emit_byte(e, amount);
+}
+
+// sar r32, imm8
+INLINE void emit_sar_imm(x86_emitter_t* e, x86_reg_t reg, byte amount) {
+    emit_rex(e, false, 0, reg, false);
+    emit_byte(e, 0xC1);
+    emit_modrm_reg(e, 7, reg);
+    emit_byte(e, amount);
+}
+
+// not r32
+INLINE void emit_not32(x86_emitter_t* e, x86_reg_t reg) {
+    emit_rex(e, false, 0, reg, false);
+    emit_byte(e, 0xF7);
+    emit_modrm_reg(e, 2, reg);
+}
+
+// mov r32, imm32
+INLINE void emit_mov32_imm(x86_emitter_t* e, x86_reg_t reg, word imm) {
+    emit_rex(e, false, 0, reg, false);
+    emit_byte(e, 0xB8 + (reg & 7));
+    emit_word(e, imm);
+}
+
+// mov r64, imm64
+INLINE void emit_mov64_imm(x86_emitter_t* e, x86_reg_t reg, uint64_t imm) {
+    emit_rex(e, true, 0, reg, false);
+    emit_byte(e, 0xB8 + (reg & 7));
+    emit_word(e, imm & 0xFFFFFFFF);
+    emit_word(e, imm >> 32);
+}
+
+// mov r64, r64
+INLINE void emit_mov64_reg(x86_emitter_t* e, x86_reg_t dst, x86_reg_t src) {
+    emit_rex(e, true, src, dst, false);
+    emit_byte(e, 0x89);
+    emit_modrm_reg(e, src, dst);
+}
+
+// setcc r8
+INLINE void emit_setcc(x86_emitter_t* e, x86_cond_t cond, x86_reg_t reg) {
+    emit_rex(e, false, 0, reg, reg >= RSP); // SPL..DIL need a REX prefix to not mean AH..BH
+    emit_byte(e, 0x0F);
+    emit_byte(e, 0x90 | cond);
+    emit_modrm_reg(e, 0, reg);
+}
+
+// setcc byte [base + disp32]
+INLINE void emit_setcc_mem(x86_emitter_t* e, x86_cond_t cond, x86_reg_t base, word disp) {
+    emit_rex(e, false, 0, base, false);
+    emit_byte(e, 0x0F);
+    emit_byte(e, 0x90 | cond);
+    emit_modrm_disp32(e, 0, base, disp);
+}
+
+// movzx r32, r8
+INLINE void emit_movzx8(x86_emitter_t* e, x86_reg_t dst, x86_reg_t src) {
+    emit_rex(e, false, dst, src, src >= RSP);
+    emit_byte(e, 0x0F);
+    emit_byte(e, 0xB6);
+    emit_modrm_reg(e, dst, src);
+}
+
+// cmovz r32, r32
+INLINE void emit_cmovz(x86_emitter_t* e, x86_reg_t dst, x86_reg_t src) {
+    emit_rex(e, false, dst, src, false);
+    emit_byte(e, 0x0F);
+    emit_byte(e, 0x44);
+    emit_modrm_reg(e, dst, src);
+}
+
+// Loads and stores through [base + index], both 64 bit registers. size is 1 (zero extended) or 4.
+INLINE void emit_load_indexed(x86_emitter_t* e, int size, x86_reg_t dst, x86_reg_t base, x86_reg_t index) {
+    emit_rex(e, false, dst, base, false);
+    if (index >= R8) {
+        logfatal("emit_load_indexed: extended index registers aren't supported")
+    }
+    if (size == 1) {
+        emit_byte(e, 0x0F);
+        emit_byte(e, 0xB6);
+    } else {
+        emit_byte(e, 0x8B);
+    }
+    emit_byte(e, ((dst & 7) << 3) | 0b100);
+    emit_byte(e, ((index & 7) << 3) | (base & 7));
+}
+
+INLINE void emit_store_indexed(x86_emitter_t* e, int size, x86_reg_t base, x86_reg_t index, x86_reg_t src) {
+    emit_rex(e, false, src, base, size == 1 && src >= RSP);
+    if (index >= R8) {
+        logfatal("emit_store_indexed: extended index registers aren't supported")
+    }
+    emit_byte(e, size == 1 ? 0x88 : 0x89);
+    emit_byte(e, ((src & 7) << 3) | 0b100);
+    emit_byte(e, ((index & 7) << 3) | (base & 7));
+}
+
+INLINE void emit_push(x86_emitter_t* e, x86_reg_t reg) {
+    emit_rex(e, false, 0, reg, false);
+    emit_byte(e, 0x50 + (reg & 7));
+}
+
+INLINE void emit_pop(x86_emitter_t* e, x86_reg_t reg) {
+    emit_rex(e, false, 0, reg, false);
+    emit_byte(e, 0x58 + (reg & 7));
+}
+
+INLINE void emit_ret(x86_emitter_t* e) {
+    emit_byte(e, 0xC3);
+}
+
+// call r64
+INLINE void emit_call_reg(x86_emitter_t* e, x86_reg_t reg) {
+    emit_rex(e, false, 0, reg, false);
+    emit_byte(e, 0xFF);
+    emit_modrm_reg(e, 2, reg);
+}
+
+// Jumps with a 32 bit displacement. They return where the displacement is, to be fixed up by emit_patch_jump.
+INLINE byte* emit_jcc(x86_emitter_t* e, x86_cond_t cond) {
+    emit_byte(e, 0x0F);
+    emit_byte(e, 0x80 | cond);
+    byte* displacement = e->ptr;
+    emit_word(e, 0);
+    return displacement;
+}
+
+INLINE byte* emit_jmp(x86_emitter_t* e) {
+    emit_byte(e, 0xE9);
+    byte* displacement = e->ptr;
+    emit_word(e, 0);
+    return displacement;
+}
+
+// Points a jump emitted earlier at the current position
+INLINE void emit_patch_jump(x86_emitter_t* e, byte* displacement) {
+    if (e->ptr <= e->end) {
+        int32_t rel = e->ptr - (displacement + 4);
+        memcpy(displacement, &rel, sizeof(rel));
+    }
+}
+
+#endif
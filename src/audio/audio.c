@@ -1,10 +1,11 @@
 #include <stdlib.h>
-#include <stdio.h>
+#include <string.h>
 #include "audio.h"
 #include "../common/log.h"
 
 gba_apu_t* init_apu() {
     gba_apu_t* apu = malloc(sizeof(gba_apu_t));
+    memset(apu, 0, sizeof(gba_apu_t));
 
     return apu;
 }
@@ -17,10 +18,8 @@ void write_fifo(gba_apu_t* apu, int n, word value) {
 }
 
 INLINE void dmasound_tick(gba_apu_t* apu, int n) {
-    // TODO: send this sample to the sound processor instead
     if (apu->fifo[n].read_index < apu->fifo[n].write_index) {
-        byte sample = apu->fifo[n].buf[(apu->fifo[n].read_index++) % SOUND_FIFO_SIZE];
-        printf("Sample for DMA sound %s: 0x%02X\n", n == 0 ? "A" : "B", sample);
+        apu->dmasound_sample[n] = apu->fifo[n].buf[(apu->fifo[n].read_index++) % SOUND_FIFO_SIZE];
     }
 }
 
@@ -35,3 +34,13 @@ void sound_timer_overflow(gba_apu_t* apu, int n) {
         dmasound_tick(apu, 1);
     }
 }
+
+void apu_sample(gba_apu_t* apu) {
+    // Full volume is twice half volume. Both channels at full volume still fit in 16 bits.
+    int a = apu->dmasound_sample[0] << (apu->SOUNDCNT_H.dmasound_a_volume ? 7 : 6);
+    int b = apu->dmasound_sample[1] << (apu->SOUNDCNT_H.dmasound_b_volume ? 7 : 6);
+
+    int16_t* sample = apu->samples[apu->sample_index++ % AUDIO_BUFFER_SAMPLES];
+    sample[0] = (apu->SOUNDCNT_H.dmasound_a_enable_left ? a : 0) + (apu->SOUNDCNT_H.dmasound_b_enable_left ? b : 0);
+    sample[1] = (apu->SOUNDCNT_H.dmasound_a_enable_right ? a : 0) + (apu->SOUNDCNT_H.dmasound_b_enable_right ? b : 0);
+}
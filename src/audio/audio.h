@@ -6,6 +6,9 @@
 #include "../common/util.h"
 
 #define SOUND_FIFO_SIZE 32
+// DMA sound is mixed down at 32768Hz, the rate SOUNDBIAS starts out at
+#define AUDIO_SAMPLE_CYCLES 512
+#define AUDIO_BUFFER_SAMPLES 4096
 
 typedef union SOUNDCNT_H {
     struct {
@@ -30,6 +33,15 @@ typedef union SOUNDCNT_L {
     half raw;
 } SOUNDCNT_L_t;
 
+typedef union SOUNDCNT_X {
+    struct {
+        unsigned:7; // The low 4 say which PSG channels are playing
+        bool master_enable:1;
+        unsigned:8;
+    };
+    half raw;
+} SOUNDCNT_X_t;
+
 typedef struct sound_fifo {
     byte buf[SOUND_FIFO_SIZE];
     uint64_t read_index;
@@ -38,12 +50,21 @@ typedef struct sound_fifo {
 
 typedef struct gba_apu {
     sound_fifo_t fifo[2];
+    int8_t dmasound_sample[2]; // What each FIFO is playing right now
+
+    // Left and right, for the frontend to play
+    int16_t samples[AUDIO_BUFFER_SAMPLES][2];
+    word sample_index; // Where the next one goes
+    bool sampling; // EVENT_AUDIO_SAMPLE is scheduled
 
     SOUNDCNT_H_t SOUNDCNT_H;
     SOUNDCNT_L_t SOUNDCNT_L;
+    SOUNDCNT_X_t SOUNDCNT_X;
 } gba_apu_t;
 
 gba_apu_t* init_apu();
+// Mixes what's playing into the next sample, every AUDIO_SAMPLE_CYCLES while sound is on
+void apu_sample(gba_apu_t* apu);
 void sound_timer_overflow(gba_apu_t* apu, int n);
 void write_fifo(gba_apu_t* apu, int n, word value);
 
@@ -4,10 +4,21 @@
 #include "common/log.h"
 #include "mem/gbabus.h"
 #include "arm7tdmi/arm7tdmi.h"
+#include "arm7tdmi/jit.h"
+#include "arm7tdmi/block_cache.h"
 #include "gba_system.h"
 #include "graphics/debug.h"
 #include "mem/gbabios.h"
 
+void add_idle_loop_arg(const char* arg) {
+    char* end;
+    word address = strtoul(arg, &end, 16);
+    if (*arg == '\0' || *end != '\0') {
+        logfatal("Invalid idle loop address: %s", arg)
+    }
+    add_idle_loop(address);
+}
+
 void usage(cflags_t* flags) {
     cflags_print_usage(flags,
                        "[OPTION]... FILE",
@@ -19,10 +30,21 @@ int main(int argc, char** argv) {
     cflags_t* flags = cflags_init();
     bool debug = false;
     bool should_skip_bios = false;
+    bool jit = false;
+    bool jit_verify = false;
+    bool perf_map = false;
+    bool threaded = false;
+    bool no_idle_detection = false;
     const char* bios_file = NULL;
     cflags_add_bool(flags, 'd', "debug", &debug, "enable debug mode at start");
     cflags_add_string(flags, 'b', "bios", &bios_file, "Alternative BIOS to load");
     cflags_add_bool(flags, 's', "skip-bios", &should_skip_bios, "skip-bios");
+    cflags_add_bool(flags, 't', "threaded", &threaded, "run the CPU until the next event instead of one block at a time");
+    cflags_add_string_callback(flags, 'i', "idle-loop", add_idle_loop_arg, "hex address of a loop the game idles in until the next event, can be given more than once");
+    cflags_add_bool(flags, '\0', "no-idle-detection", &no_idle_detection, "don't look for idle loops, only skip the ones given with --idle-loop");
+    cflags_add_bool(flags, 'j', "jit", &jit, "compile hot code to x86-64 instead of interpreting it");
+    cflags_add_bool(flags, '\0', "jit-verify", &jit_verify, "run every compiled block through the interpreter too, and stop if they disagree (implies --jit)");
+    cflags_add_bool(flags, '\0', "perf-map", &perf_map, "write /tmp/perf-<pid>.map for the code the JIT generates");
 
     cflags_flag_t * verbose = cflags_add_bool(flags, 'v', "verbose", NULL, "enables verbose output, repeat up to 4 times for more verbosity");
 
@@ -38,6 +60,12 @@ int main(int argc, char** argv) {
     init_gbasystem(flags->argv[0], bios_file);
 
     loginfo("ROM loaded: %lu bytes", mem->rom_size)
+    if (jit || jit_verify) {
+        jit_memory_t jit_memory = {mem->ewram, mem->iwram, mem->rom, mem->rom_mask + 1};
+        jit_init(jit_memory, jit_verify, perf_map);
+    }
+    threaded_interpreter = threaded;
+    idle_loop_detection = !no_idle_detection;
     if (should_skip_bios) {
         logwarn("Skipping BIOS")
         skip_bios(cpu);
@@ -1,10 +1,14 @@
+#include <limits.h>
+
 #include "mem/gbabus.h"
 #include "mem/gbarom.h"
 #include "mem/gbabios.h"
+#include "mem/backup.h"
 #include "common/log.h"
 #include "audio/audio.h"
-
-int cycles = 0;
+#include "scheduler.h"
+#include "mem/timer.h"
+#include "mem/dma.h"
 
 arm7tdmi_t* cpu = NULL;
 gba_ppu_t* ppu = NULL;
@@ -12,11 +16,25 @@ gbabus_t* bus = NULL;
 gbamem_t* mem = NULL;
 gba_apu_t* apu = NULL;
 bool should_quit = false;
+bool threaded_interpreter = false;
+
+static void hblank_event(uint64_t time);
+static void hdraw_event(uint64_t time);
+static void audio_sample_event(uint64_t time);
+
+static const event_handler_t event_handlers[NUM_EVENTS] = {
+        [EVENT_HBLANK] = hblank_event,
+        [EVENT_HDRAW] = hdraw_event,
+        [EVENT_TIMER_OVERFLOW] = timer_overflow_event,
+        [EVENT_DMA] = dma_event,
+        [EVENT_AUDIO_SAMPLE] = audio_sample_event
+};
 
 void init_gbasystem(const char* romfile, const char* bios_file) {
     mem = init_mem();
 
     load_gbarom(romfile);
+    init_backup(romfile);
     if (bios_file) {
         load_alternate_bios(bios_file);
     }
@@ -30,106 +48,90 @@ void init_gbasystem(const char* romfile, const char* bios_file) {
                         gba_write_word);
 
     ppu = init_ppu();
+    apu = init_apu(); // Before the bus, which maps the sound registers into it
     bus = init_gbabus();
-    apu = init_apu();
+
+    init_scheduler(event_handlers);
+    schedule_event(EVENT_HBLANK, HBLANK_START_CYCLES);
 }
 
+static void hblank_event(uint64_t time) {
+    ppu_hblank(ppu);
+    schedule_event(EVENT_HDRAW, time + LINE_CYCLES - HBLANK_START_CYCLES);
+}
 
-int timer_freq[4] = {1, 64, 256, 1024};
-
-INLINE void timer_tick(int cyc) {
-    bool previous_overflow = false;
-    for (int n = 0; n < 4; n++) {
-        bool overflow = false;
-
-        if (bus->TMCNT_H[n].start) {
-            unimplemented(bus->TMCNT_H[n].cascade, "Timer cascade")
-            if (previous_overflow && bus->TMCNT_H[n].cascade) {
-                logfatal("Timer cascade - need to inc this timer here, and ONLY here. (don't inc normally)")
-            }
-
-            if (!bus->TMINT[n].previously_enabled) {
-                bus->TMINT[n].previously_enabled = true;
-                bus->TMINT[n].ticks = 0;
-                bus->TMINT[n].value = bus->TMCNT_L[n].timer_reload;
-            }
-
-            if (bus->TMCNT_H[n].cascade && !previous_overflow) {
-                previous_overflow = false;
-                continue; // Don't inc
-            }
-
-            bus->TMINT[n].ticks += cyc;
-
-            while (bus->TMINT[n].ticks >= timer_freq[bus->TMCNT_H[n].frequency]) {
-                bus->TMINT[n].ticks -= timer_freq[bus->TMCNT_H[n].frequency];
-                if (bus->TMINT[n].value == 0xFFFF) {
-                    bus->TMINT[n].value = bus->TMCNT_L[n].timer_reload;
-                    overflow = true;
-                    if (bus->TMCNT_H[n].timer_irq_enable) {
-                        switch (n) {
-                            case 0:
-                                request_interrupt(IRQ_TIMER0);
-                                break;
-                            case 1:
-                                request_interrupt(IRQ_TIMER1);
-                                break;
-                            case 2:
-                                request_interrupt(IRQ_TIMER2);
-                                break;
-                            case 3:
-                                request_interrupt(IRQ_TIMER3);
-                                break;
-                        }
-                    }
-
-                    if (n == 0 || n == 1) {
-                        sound_timer_overflow(apu, n);
-                    }
-                } else {
-                    bus->TMINT[n].value++;
-                }
-            }
-        } else {
-            bus->TMINT[n].previously_enabled = false;
-        }
+static void hdraw_event(uint64_t time) {
+    ppu_hdraw(ppu);
+    schedule_event(EVENT_HBLANK, time + HBLANK_START_CYCLES);
+}
 
-        previous_overflow = overflow;
+static void audio_sample_event(uint64_t time) {
+    if (!apu->SOUNDCNT_X.master_enable) {
+        apu->sampling = false;
+        return;
+    }
+    apu_sample(apu);
+    schedule_event(EVENT_AUDIO_SAMPLE, time + AUDIO_SAMPLE_CYCLES);
+}
+
+// For when the CPU is halted or in an idle loop: nothing changes until the next event.
+INLINE void skip_to_next_event() {
+    uint64_t next_event = next_event_time();
+    if (next_event > current_cycle && next_event != UINT64_MAX) {
+        current_cycle = next_event;
     }
 }
 
 bool cpu_stepped = false;
 
+typedef enum run_mode {
+    RUN_STEP,    // One instruction
+    RUN_BLOCK,   // The rest of the cached block
+    RUN_THREADED // Until something else has to happen
+} run_mode_t;
+
+INLINE int run_cpu(run_mode_t mode) {
+    switch (mode) {
+        case RUN_STEP:
+            return arm7tdmi_step(cpu);
+        case RUN_BLOCK:
+            return arm7tdmi_run_block(cpu);
+        case RUN_THREADED: {
+            // Nothing the CPU can see changes until the next event. With nothing scheduled, it can run for as long
+            // as the budget goes.
+            uint64_t next_event = next_event_time();
+            uint64_t budget = next_event <= current_cycle ? 0 : next_event - current_cycle;
+            return arm7tdmi_run(cpu, budget > INT_MAX ? INT_MAX : (int)budget);
+        }
+    }
+    logfatal("Unknown run mode %d", mode)
+}
 
-INLINE void _gba_system_step() {
+INLINE void _gba_system_step(run_mode_t mode) {
     cpu_stepped = false;
-    int dma_cycles = gba_dma();
     cpu->irq = (bus->interrupt_enable.raw & bus->IF.raw) != 0;
-    if (dma_cycles > 0) {
-        cycles += dma_cycles;
+    if (cpu->halt && !cpu->irq) {
+        // Only an event can raise an IRQ or start a DMA
+        skip_to_next_event();
     } else {
-        if (cpu->halt && !cpu->irq) {
-            cycles += 1;
-        } else {
-            cpu_stepped = true;
-            cycles += arm7tdmi_step(cpu);
+        cpu_stepped = true;
+        current_cycle += run_cpu(mode);
+        if (cpu->idle) {
+            cpu->idle = false;
+            skip_to_next_event();
         }
     }
 
-    while (cycles > 4) {
-        ppu_step(ppu);
-        timer_tick(4);
-        cycles -= 4;
-    }
+    run_events();
 }
 
-// Non-inlined version of the above
+// Non-inlined version of the above. Runs a single instruction, for tools that need to see every one.
 void gba_system_step() {
-    _gba_system_step();
+    _gba_system_step(RUN_STEP);
 }
 
 void gba_system_loop() {
     while (!should_quit) {
-        _gba_system_step();
+        _gba_system_step(threaded_interpreter ? RUN_THREADED : RUN_BLOCK);
     }
 }
\ No newline at end of file
@@ -13,6 +13,7 @@ extern gbabus_t* bus;
 extern gbamem_t* mem;
 extern gba_apu_t* apu;
 extern bool should_quit;
+extern bool threaded_interpreter; // Let the CPU run until the next event instead of one block at a time
 
 void init_gbasystem(const char* romfile, const char* bios_file);
 void gba_system_step();
@@ -7,6 +7,7 @@
 #include "../common/log.h"
 #include "render.h"
 #include "../gba_system.h"
+#include "../mem/timer.h"
 
 #define WINDOW_WIDTH 1400
 #define WINDOW_HEIGHT 1050
@@ -89,7 +90,7 @@ int tab_index = TAB_CPU_REGISTERS;
 
 #define print_bgofs(n, hofs, vofs) DUI_Println("BG%dOFS: %08Xh / %08Xh", n, hofs.raw, vofs.raw)
 
-void print_timer(int n, TMCNT_H_t* tmcnth, int timer_reload, TMINT_t* tmint) {
+void print_timer(int n, TMCNT_H_t* tmcnth, int timer_reload, int value) {
     const char* prescaler_selection = "UNKNOWN";
     switch (tmcnth->frequency) {
         case 0:
@@ -118,7 +119,7 @@ void print_timer(int n, TMCNT_H_t* tmcnth, int timer_reload, TMINT_t* tmint) {
                 tm0msg,
                 tmcnth->cascade,
                 tmcnth->timer_irq_enable,
-                tmint->value);
+                value);
 }
 
 void ramdump(word base_address, word size) {
@@ -200,7 +201,7 @@ void dbg_tick(dbg_tick_t tick_time) {
                     break;
             }
 
-            printcpsr(cpu->cpsr);
+            printcpsr((*get_psr(cpu)));
 
             for (int r = 0; r < 16; r++) {
                 DUI_Println("r%02d:  %08Xh", r, get_register(cpu, r));
@@ -209,7 +210,7 @@ void dbg_tick(dbg_tick_t tick_time) {
             DUI_Println("\n--- Timers ---");
 
             for (int t = 0; t < 4; t++) {
-                print_timer(t, &bus->TMCNT_H[t], bus->TMCNT_L[t].timer_reload, &(bus->TMINT[t]));
+                print_timer(t, &bus->TMCNT_H[t], bus->TMCNT_L[t].timer_reload, timer_counter(t));
             }
 
             DUI_Println("KEYINPUT: 0x%04X", bus->KEYINPUT.raw);
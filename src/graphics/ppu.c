@@ -1,3 +1,11 @@
+#include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include "ppu.h"
 #include "../common/log.h"
 #include "../mem/gbabus.h"
@@ -5,10 +13,23 @@
 #include "debug.h"
 #include "../mem/dma.h"
 
-gba_color_t bgbuf[4][GBA_SCREEN_X];
-gba_color_t objbuf[GBA_SCREEN_X];
+// Pixels with an A of 0 are transparent. They still have the color of palette entry 0 of their bank.
+color_t bgbuf[4][GBA_SCREEN_X];
+color_t objbuf[GBA_SCREEN_X];
 byte obj_priorities[GBA_SCREEN_X];
 
+uint64_t vram_dirty_tiles[VRAM_TILES / 64];
+// Every 32 bytes of VRAM as a 4bpp tile, one byte per pixel. 8bpp tiles already are one byte per pixel.
+static byte decoded_tiles[VRAM_TILES][64];
+
+// Every 15 bit color, converted for the screen
+static color_t color_lut[0x8000];
+uint64_t pram_dirty_colors[PRAM_SIZE / 2 / 64];
+// The palette run through color_lut, refreshed before every line for the entries in pram_dirty_colors
+static color_t palette_colors[PRAM_SIZE / 2];
+
+bool oam_dirty;
+
 typedef struct obj_affine {
     int16_t pa;
     int16_t pb;
@@ -36,9 +57,13 @@ gba_ppu_t* init_ppu() {
     ppu->BG3HOFS.raw = 0;
     ppu->BG3VOFS.raw = 0;
 
-    ppu->x = 0;
     ppu->y = 0;
 
+    for (int i = 0; i < 2; i++) {
+        ppu->affine_x[i] = 0;
+        ppu->affine_y[i] = 0;
+    }
+
     for (int i = 0; i < VRAM_SIZE; i++) {
         ppu->vram[i] = 0;
     }
@@ -51,11 +76,22 @@ gba_ppu_t* init_ppu() {
         ppu->oam[i] = 0;
     }
 
-    return ppu;
-}
+    vram_range_written(0, VRAM_SIZE);
+    oam_written();
 
-INLINE bool is_hblank(gba_ppu_t* ppu) {
-    return ppu->x > GBA_SCREEN_X;
+    for (int i = 0; i < 0x8000; i++) {
+        gba_color_t color;
+        color.raw = i;
+        color_lut[i].a = 0xFF;
+        color_lut[i].r = FIVEBIT_TO_EIGHTBIT_COLOR(color.r);
+        color_lut[i].g = FIVEBIT_TO_EIGHTBIT_COLOR(color.g);
+        color_lut[i].b = FIVEBIT_TO_EIGHTBIT_COLOR(color.b);
+    }
+    for (int i = 0; i < PRAM_SIZE; i += 2) {
+        pram_written(i);
+    }
+
+    return ppu;
 }
 
 INLINE bool is_vblank(gba_ppu_t* ppu) {
@@ -74,28 +110,76 @@ INLINE bool is_win1(gba_ppu_t* ppu, int x, int y) {
     return is_win(x, y, ppu->WIN1H.x1, ppu->WIN1H.x2, ppu->WIN1V.y1, ppu->WIN1V.y2);
 }
 
+// VRAM is 96KB mirrored in a 128KB window, with the last 32KB mirroring the 32KB before them. Same as the bus.
+INLINE word vram_index(word offset) {
+    offset &= 0x1FFFF;
+    return offset < VRAM_SIZE ? offset : offset - 0x8000;
+}
+
+INLINE byte vram_byte(gba_ppu_t* ppu, word offset) {
+    return ppu->vram[vram_index(offset)];
+}
+
+INLINE half vram_half(gba_ppu_t* ppu, word offset) {
+    return ppu->vram_halves[vram_index(offset) >> 1];
+}
+
+void vram_range_written(word index, word length) {
+    for (word tile = index >> 5; tile <= (index + length - 1) >> 5; tile++) {
+        vram_dirty_tiles[tile >> 6] |= 1ull << (tile & 63);
+    }
+}
+
+void pram_range_written(word index, word length) {
+    for (word color = index >> 1; color <= (index + length - 1) >> 1; color++) {
+        pram_dirty_colors[color >> 6] |= 1ull << (color & 63);
+    }
+}
+
+static void decode_tile(gba_ppu_t* ppu, word tile) {
+    const byte* data = &ppu->vram[tile * 0x20];
+    for (int i = 0; i < 0x20; i++) {
+        decoded_tiles[tile][i * 2] = data[i] & 0xF;
+        decoded_tiles[tile][i * 2 + 1] = data[i] >> 4;
+    }
+    vram_dirty_tiles[tile >> 6] &= ~(1ull << (tile & 63));
+}
+
+// The 8 pixels in a row of the tile at tile_address, one palette index per byte
+INLINE const byte* tile_row(gba_ppu_t* ppu, word tile_address, bool is_256color, int row) {
+    if (is_256color) {
+        return &ppu->vram[vram_index(tile_address + row * 8)];
+    }
+    word tile = vram_index(tile_address) >> 5;
+    if (vram_dirty_tiles[tile >> 6] & (1ull << (tile & 63))) {
+        decode_tile(ppu, tile);
+    }
+    return &decoded_tiles[tile][row * 8];
+}
+
+static void refresh_palette_colors(gba_ppu_t* ppu) {
+    for (int i = 0; i < PRAM_SIZE / 2 / 64; i++) {
+        while (pram_dirty_colors[i]) {
+            int color = i * 64 + __builtin_ctzll(pram_dirty_colors[i]);
+            palette_colors[color] = color_lut[ppu->palette[color] & 0x7FFF];
+            pram_dirty_colors[i] &= pram_dirty_colors[i] - 1;
+        }
+    }
+}
+
 #define PALETTE_BANK_BACKGROUND 0
+#define PALETTE_BANK_OBJ 0x100
 
 void render_line_mode3(gba_ppu_t* ppu) {
     if (ppu->DISPCNT.screen_display_bg2) {
         for (int x = 0; x < GBA_SCREEN_X; x++) {
             int offset = x + (ppu->y * GBA_SCREEN_X); // Calculate this based on BG2X/Y/VOFS/HOFS/etc
-            offset *= 2;
-
-            gba_color_t color;
-            color.raw = gba_read_half(0x06000000 + offset) & 0x7FFF;
 
-            ppu->screen[ppu->y][x].a = 0xFF;
-            ppu->screen[ppu->y][x].r = FIVEBIT_TO_EIGHTBIT_COLOR(color.r);
-            ppu->screen[ppu->y][x].g = FIVEBIT_TO_EIGHTBIT_COLOR(color.g);
-            ppu->screen[ppu->y][x].b = FIVEBIT_TO_EIGHTBIT_COLOR(color.b);
+            ppu->screen[ppu->y][x] = color_lut[ppu->vram_halves[offset] & 0x7FFF];
         }
     } else {
         for (int x = 0; x < GBA_SCREEN_X; x++) {
-            ppu->screen[ppu->y][x].a = 0;
-            ppu->screen[ppu->y][x].r = 0;
-            ppu->screen[ppu->y][x].g = 0;
-            ppu->screen[ppu->y][x].b = 0;
+            ppu->screen[ppu->y][x].raw = 0;
         }
     }
 }
@@ -107,26 +191,14 @@ void render_line_mode4(gba_ppu_t* ppu) {
             int index = ppu->DISPCNT.display_frame_select * 0xA000 + offset;
             int tile = ppu->vram[index];
             if (tile == 0) {
-                ppu->screen[ppu->y][x].a = 0;
-                ppu->screen[ppu->y][x].r = 0;
-                ppu->screen[ppu->y][x].g = 0;
-                ppu->screen[ppu->y][x].b = 0;
+                ppu->screen[ppu->y][x].raw = 0;
             } else {
-                gba_color_t color;
-                color.raw = gba_read_half(0x05000000 | (0x20 * PALETTE_BANK_BACKGROUND + 2 * tile)) & 0x7FFF;
-
-                ppu->screen[ppu->y][x].a = 0xFF;
-                ppu->screen[ppu->y][x].r = FIVEBIT_TO_EIGHTBIT_COLOR(color.r);
-                ppu->screen[ppu->y][x].g = FIVEBIT_TO_EIGHTBIT_COLOR(color.g);
-                ppu->screen[ppu->y][x].b = FIVEBIT_TO_EIGHTBIT_COLOR(color.b);
+                ppu->screen[ppu->y][x] = palette_colors[PALETTE_BANK_BACKGROUND + tile];
             }
         }
     } else {
         for (int x = 0; x < GBA_SCREEN_X; x++) {
-            ppu->screen[ppu->y][x].a = 0;
-            ppu->screen[ppu->y][x].r = 0;
-            ppu->screen[ppu->y][x].g = 0;
-            ppu->screen[ppu->y][x].b = 0;
+            ppu->screen[ppu->y][x].raw = 0;
         }
     }
 }
@@ -146,166 +218,220 @@ int sprite_widths[3][4] = {
 };
 
 #define OBJ_TILE_SIZE 0x20
-void render_obj(gba_ppu_t* ppu) {
+#define OBJ_TILE_BASE 0x10000
+// A sprite out of OAM, decoded so render_obj() doesn't have to go through the attributes again on every line
+typedef struct obj {
     obj_attr0_t attr0;
     obj_attr1_t attr1;
     obj_attr2_t attr2;
-    for (int x = 0; x < GBA_SCREEN_X; x++) {
-        obj_priorities[x] = 0;
-        objbuf[x].transparent = true;
-        objbuf[x].r = 0;
-        objbuf[x].g = 0;
-        objbuf[x].b = 0;
-    }
-
+    int width;
+    int height;
+    bool is_affine;
+    bool is_double_affine;
+    // Where the sprite is on the screen, moved by half its size for double size affine sprites
+    int adjusted_x;
+    int adjusted_y;
+    int cycles; // Time the OBJ renderer spends on it on every line it's on
+    obj_affine_t affine;
+} obj_t;
+
+static obj_t objs[128];
+// One bit per sprite on each line, so a line only looks at its own sprites, in OAM order
+static uint64_t line_objs[GBA_SCREEN_Y][2];
+
+// How many cycles the OBJ renderer has per line. Sprites later in OAM get cut off when it runs out.
+#define OBJ_LINE_CYCLES 1210
+#define OBJ_LINE_CYCLES_HBLANK_FREE 954
+
+static void decode_oam(gba_ppu_t* ppu) {
+    memset(line_objs, 0, sizeof(line_objs));
     for (int sprite = 0; sprite < 128; sprite++) {
-        attr0.raw = gba_read_half(0x07000000 + (sprite * 8) + 0);
-        attr1.raw = gba_read_half(0x07000000 + (sprite * 8) + 2);
-        attr2.raw = gba_read_half(0x07000000 + (sprite * 8) + 4);
+        obj_t* obj = &objs[sprite];
+        obj->attr0.raw = ppu->oam_entries[sprite].attr0;
+        obj->attr1.raw = ppu->oam_entries[sprite].attr1;
+        obj->attr2.raw = ppu->oam_entries[sprite].attr2;
 
-        int height = sprite_heights[attr0.shape][attr1.size];
-        int width = sprite_widths[attr0.shape][attr1.size];
-        int tiles_wide = width / 8;
+        if (obj->attr0.shape == 3) { // Prohibited, there's no size for it
+            continue;
+        }
+        if (obj->attr0.affine_object_mode == 0b10) { // Disabled
+            continue;
+        }
 
-        int hheight = height / 2;
-        int hwidth = width / 2;
+        obj->height = sprite_heights[obj->attr0.shape][obj->attr1.size];
+        obj->width = sprite_widths[obj->attr0.shape][obj->attr1.size];
 
-        bool is_double_affine = attr0.affine_object_mode == 0b11;
-        bool is_affine = attr0.affine_object_mode == 0b01 || is_double_affine;
+        obj->is_double_affine = obj->attr0.affine_object_mode == 0b11;
+        obj->is_affine = obj->attr0.affine_object_mode == 0b01 || obj->is_double_affine;
 
-        int adjusted_x = attr1.x;
-        int adjusted_y = attr0.y;
+        obj->adjusted_x = obj->attr1.x;
+        obj->adjusted_y = obj->attr0.y;
 
-        if (is_double_affine) {
-            adjusted_x += hwidth;
-            adjusted_y += hheight;
+        if (obj->is_double_affine) {
+            obj->adjusted_x += obj->width / 2;
+            obj->adjusted_y += obj->height / 2;
         }
 
-        if (adjusted_x >= 240) {
-            adjusted_x -= 512;
+        if (obj->adjusted_x >= 240) {
+            obj->adjusted_x -= 512;
         }
-        if (adjusted_y >= 160) {
-            adjusted_y -= 256;
+        if (obj->adjusted_y >= 160) {
+            obj->adjusted_y -= 256;
         }
 
-        int sprite_y = ppu->y - adjusted_y;
-        if (!is_affine && attr1.vflip) {
-            sprite_y = height - sprite_y - 1;
+        int screen_min_y = obj->adjusted_y;
+        int screen_max_y = obj->adjusted_y + obj->height;
+
+        if (obj->is_affine) {
+            oam_entry_t* params = &ppu->oam_entries[obj->attr1.affine_index * 4];
+            obj->affine.pa = params[0].affine_param;
+            obj->affine.pb = params[1].affine_param;
+            obj->affine.pc = params[2].affine_param;
+            obj->affine.pd = params[3].affine_param;
+            int box_width = obj->width;
+            if (obj->is_double_affine) { // double rendering area
+                screen_min_y -= obj->height / 2;
+                screen_max_y += obj->height / 2;
+                box_width *= 2;
+            }
+            obj->cycles = 10 + 2 * box_width;
+        } else {
+            obj->cycles = obj->width;
         }
 
-        int screen_min_y = adjusted_y;
-        int screen_max_y = adjusted_y + height;
+        if (screen_min_y < 0) {
+            screen_min_y = 0;
+        }
+        if (screen_max_y > GBA_SCREEN_Y) {
+            screen_max_y = GBA_SCREEN_Y;
+        }
+        for (int y = screen_min_y; y < screen_max_y; y++) {
+            line_objs[y][sprite >> 6] |= 1ull << (sprite & 63);
+        }
+    }
+    oam_dirty = false;
+}
 
-        int screen_min_x = adjusted_x;
-        int screen_max_x = adjusted_x + width;
+void render_obj(gba_ppu_t* ppu) {
+    for (int x = 0; x < GBA_SCREEN_X; x++) {
+        obj_priorities[x] = 0;
+        objbuf[x].raw = 0;
+    }
 
+    if (oam_dirty) {
+        decode_oam(ppu);
+    }
 
-        obj_affine_t affine;
-        if (is_affine) {
-            affine.pa = gba_read_half(0x07000000 + attr1.affine_index * 32 + 6);
-            affine.pb = gba_read_half(0x07000000 + attr1.affine_index * 32 + 14);
-            affine.pc = gba_read_half(0x07000000 + attr1.affine_index * 32 + 22);
-            affine.pd = gba_read_half(0x07000000 + attr1.affine_index * 32 + 30);
-            if (is_double_affine) { // double rendering area
-                screen_min_y -= hheight;
-                screen_max_y += hheight;
+    int cycles = ppu->DISPCNT.hblank_interval_free ? OBJ_LINE_CYCLES_HBLANK_FREE : OBJ_LINE_CYCLES;
+    for (int i = 0; i < 2; i++) {
+        for (uint64_t sprites = line_objs[ppu->y][i]; sprites && cycles > 0; sprites &= sprites - 1) {
+            obj_t* obj = &objs[i * 64 + __builtin_ctzll(sprites)];
+            obj_attr0_t attr0 = obj->attr0;
+            obj_attr1_t attr1 = obj->attr1;
+            obj_attr2_t attr2 = obj->attr2;
+            obj_affine_t affine = obj->affine;
+            bool is_affine = obj->is_affine;
+            bool is_double_affine = obj->is_double_affine;
+            int adjusted_x = obj->adjusted_x;
+
+            int height = obj->height;
+            int width = obj->width;
+            int tiles_wide = width / 8;
+
+            int hheight = height / 2;
+            int hwidth = width / 2;
+
+            int sprite_y = ppu->y - obj->adjusted_y;
+            if (!is_affine && attr1.vflip) {
+                sprite_y = height - sprite_y - 1;
+            }
 
-                screen_min_x -= hwidth;
-                screen_max_x += hwidth;
+            int sprite_x_start = is_double_affine ? -hwidth : 0;
+            int sprite_x_end   = is_double_affine ? width + hwidth : width;
+            // Running out of time partway through a sprite cuts off the rest of it
+            if (obj->cycles > cycles) {
+                sprite_x_end = sprite_x_start + (is_affine ? (cycles - 10) / 2 : cycles);
+            }
+            cycles -= obj->cycles;
 
-                screen_min_x -= (width / 2);
-                if (screen_min_x < 0) {
-                    screen_min_x = 0;
-                }
-                screen_max_x += (width / 2);
-                if (screen_max_x < GBA_SCREEN_X) {
-                    screen_max_x = GBA_SCREEN_X;
-                }
+            // Never draw outside of the line
+            if (sprite_x_start < -adjusted_x) {
+                sprite_x_start = -adjusted_x;
+            }
+            if (sprite_x_end > GBA_SCREEN_X - adjusted_x) {
+                sprite_x_end = GBA_SCREEN_X - adjusted_x;
             }
 
-        } else {
-            // Set to identity matrix
-            affine.pa = 0xFF;
-            affine.pb = 0x00;
-            affine.pc = 0x00;
-            affine.pd = 0xFF;
-        }
+            // Unless the sprite is affine, the next 8 pixels all come out of the same row
+            word last_row_key = 0xFFFFFFFF;
+            const byte* row = NULL;
+            for (int sprite_x = sprite_x_start; sprite_x < sprite_x_end; sprite_x++) {
+                int adjusted_sprite_x = sprite_x;
+                int adjusted_sprite_y = sprite_y;
 
-        if (ppu->y >= screen_min_y && ppu->y < screen_max_y) { // If the sprite is visible, we should draw it.
-            if (attr0.affine_object_mode != 0b10) { // Not disabled
-                int sprite_x_start = is_double_affine ? -hwidth : 0;
-                int sprite_x_end   = is_double_affine ? width + hwidth : width;
-                for (int sprite_x = sprite_x_start; sprite_x < sprite_x_end; sprite_x++) {
-                    int adjusted_sprite_x = sprite_x;
-                    int adjusted_sprite_y = sprite_y;
-
-                    if (is_affine) {
-                        adjusted_sprite_x = affine.pa * (sprite_x - hwidth) + affine.pb * (sprite_y - hheight);
-                        adjusted_sprite_x >>= 8;
-                        adjusted_sprite_x += hwidth;
-
-                        if (adjusted_sprite_x > width || adjusted_sprite_x < 0) {
-                            continue;
-                        }
+                if (is_affine) {
+                    adjusted_sprite_x = affine.pa * (sprite_x - hwidth) + affine.pb * (sprite_y - hheight);
+                    adjusted_sprite_x >>= 8;
+                    adjusted_sprite_x += hwidth;
 
-                        adjusted_sprite_y = affine.pc * (sprite_x - hwidth) + affine.pd * (sprite_y - hheight);
-                        adjusted_sprite_y >>= 8;
-                        adjusted_sprite_y += hheight;
+                    if (adjusted_sprite_x > width || adjusted_sprite_x < 0) {
+                        continue;
+                    }
 
-                        if (adjusted_sprite_y > height || adjusted_sprite_y < 0) {
-                            continue;
-                        }
+                    adjusted_sprite_y = affine.pc * (sprite_x - hwidth) + affine.pd * (sprite_y - hheight);
+                    adjusted_sprite_y >>= 8;
+                    adjusted_sprite_y += hheight;
 
-                    } else if (attr1.hflip) {
-                        adjusted_sprite_x = width - sprite_x - 1;
+                    if (adjusted_sprite_y > height || adjusted_sprite_y < 0) {
+                        continue;
                     }
 
-                    int y_tid_offset;
-                    int sprite_tile_y = adjusted_sprite_y / 8;
-                    if (ppu->DISPCNT.obj_character_vram_mapping) { // 1D
-                        // Tiles are twice as wide in 256 color mode
-                        y_tid_offset = tiles_wide * (sprite_tile_y << attr0.is_256color);
-                    } else { // 2D
-                        y_tid_offset = 32 * sprite_tile_y;
+                } else if (attr1.hflip) {
+                    adjusted_sprite_x = width - sprite_x - 1;
+                }
+
+                int y_tid_offset;
+                int sprite_tile_y = adjusted_sprite_y / 8;
+                if (ppu->DISPCNT.obj_character_vram_mapping) { // 1D
+                    // Tiles are twice as wide in 256 color mode
+                    y_tid_offset = tiles_wide * (sprite_tile_y << attr0.is_256color);
+                } else { // 2D
+                    y_tid_offset = 32 * sprite_tile_y;
+                }
+                // After adding this offset, we won't need to worry about 1D vs 2D,
+                // because in either case they'll be right next to each other in memory.
+                int tid = attr2.tid + y_tid_offset;
+
+                // Don't use the adjusted X or Y here. There'd be no point in transforming the sprite, otherwise.
+                int screen_x = sprite_x + adjusted_x;
+                // Only draw if we've never drawn anything there before. Lower indices have higher priority
+                // and that's the order we're drawing them here.
+                if (objbuf[screen_x].a == 0 || attr2.priority < obj_priorities[screen_x]) {
+                    // Tiles are twice as wide in 256 color mode
+                    int x_tid_offset = (adjusted_sprite_x / 8) << attr0.is_256color;
+                    int tid_offset_by_x = tid + x_tid_offset;
+                    word tile_address = OBJ_TILE_BASE + tid_offset_by_x * OBJ_TILE_SIZE;
+
+                    int in_tile_x = adjusted_sprite_x % 8;
+                    int in_tile_y = adjusted_sprite_y % 8;
+
+                    word row_key = (tile_address << 3) | in_tile_y;
+                    if (row_key != last_row_key) {
+                        last_row_key = row_key;
+                        row = tile_row(ppu, tile_address, attr0.is_256color, in_tile_y);
                     }
-                    // After adding this offset, we won't need to worry about 1D vs 2D,
-                    // because in either case they'll be right next to each other in memory.
-                    int tid = attr2.tid + y_tid_offset;
-
-                    // Don't use the adjusted X or Y here. There'd be no point in transforming the sprite, otherwise.
-                    int screen_x = sprite_x + adjusted_x;
-                    // Only draw if we've never drawn anything there before. Lower indices have higher priority
-                    // and that's the order we're drawing them here.
-                    if (screen_x >= screen_min_x && screen_x < screen_max_x  && (objbuf[screen_x].transparent || attr2.priority < obj_priorities[screen_x])) {
-                        // Tiles are twice as wide in 256 color mode
-                        int x_tid_offset = (adjusted_sprite_x / 8) << attr0.is_256color;
-                        int tid_offset_by_x = tid + x_tid_offset;
-                        word tile_address = 0x06010000 + tid_offset_by_x * OBJ_TILE_SIZE;
-
-                        int in_tile_x = adjusted_sprite_x % 8;
-                        int in_tile_y = adjusted_sprite_y % 8;
-
-                        int in_tile_offset = in_tile_x + in_tile_y * 8;
-                        tile_address += in_tile_offset >> (!attr0.is_256color);
-
-                        byte tile = gba_read_byte(tile_address);
-                        if (!attr0.is_256color) {
-                            tile >>= (in_tile_offset % 2) * 4;
-                            tile &= 0xF;
-                        }
+                    byte tile = row[in_tile_x];
+
+                    if (tile != 0) {
 
-                        if (tile != 0) {
-
-                            word palette_address = 0x05000200; // OBJ palette base
-                            if (attr0.is_256color) {
-                                palette_address += 2 * tile;
-                            } else {
-                                palette_address += (0x20 * attr2.pb + 2 * tile);
-                            }
-                            obj_priorities[screen_x] = attr2.priority;
-                            objbuf[screen_x].raw = gba_read_half(palette_address);
-                            objbuf[screen_x].transparent = false;
+                        int palette_index = PALETTE_BANK_OBJ;
+                        if (attr0.is_256color) {
+                            palette_index += tile;
+                        } else {
+                            palette_index += 16 * attr2.pb + tile;
                         }
+                        obj_priorities[screen_x] = attr2.priority;
+                        objbuf[screen_x] = palette_colors[palette_index];
                     }
                 }
             }
@@ -323,42 +449,18 @@ typedef union reg_se {
     };
 } reg_se_t;
 
-INLINE void render_tile(int tid, int pb, gba_color_t (*line)[GBA_SCREEN_X], int screen_x, bool is_256color, word character_base_addr, int tile_x, int tile_y) {
-    int in_tile_offset_divisor = is_256color ? 1 : 2;
-    int tile_size = is_256color ? 0x40 : 0x20;
-    int in_tile_offset = tile_x + tile_y * 8;
-    word tile_address = character_base_addr + tid * tile_size;
-    tile_address += in_tile_offset / in_tile_offset_divisor;
-
-    byte tile = gba_read_byte(tile_address);
-
-    if (!is_256color) {
-        tile >>= (in_tile_offset % 2) * 4;
-        tile &= 0xF;
-    }
-
-    word palette_address = 0x05000000;
+// Draws one pixel of a tile, tile being its palette index out of tile_row()
+INLINE void render_tile_pixel(color_t (*line)[GBA_SCREEN_X], int screen_x, byte tile, int pb, bool is_256color) {
+    int palette_index = PALETTE_BANK_BACKGROUND;
     if (is_256color) {
-        palette_address += 2 * tile;
+        palette_index += tile;
     } else {
-        palette_address += (0x20 * pb + 2 * tile);
-    }
-    (*line)[screen_x].raw = gba_read_half(palette_address);
-    (*line)[screen_x].transparent = tile == 0; // This color should only be drawn if we need transparency
-}
-
-INLINE void render_screenentry(gba_color_t (*line)[GBA_SCREEN_X], int screen_x, reg_se_t se, bool is_256color, word character_base_addr, int tilemap_x, int tilemap_y) {
-    // Find the tile
-    int tile_x = tilemap_x % 8;
-    if (se.hflip) {
-        tile_x = 7 - tile_x;
+        palette_index += 16 * pb + tile;
     }
-    int tile_y = tilemap_y % 8;
-    if (se.vflip) {
-        tile_y = 7 - tile_y;
+    (*line)[screen_x] = palette_colors[palette_index];
+    if (tile == 0) {
+        (*line)[screen_x].a = 0; // This color should only be drawn if we need transparency
     }
-
-    render_tile(se.tid, se.pb, line, screen_x, is_256color, character_base_addr, tile_x, tile_y);
 }
 
 INLINE bool should_render_bg_pixel(gba_ppu_t* ppu, int x, int y, bool win0in, bool win1in, bool winout, bool objout) {
@@ -387,122 +489,161 @@ INLINE bool should_render_bg_pixel(gba_ppu_t* ppu, int x, int y, bool win0in, bo
 
 #define SCREENBLOCK_SIZE 0x800
 #define CHARBLOCK_SIZE  0x4000
-INLINE void render_bg_regular(gba_ppu_t* ppu, gba_color_t (*line)[GBA_SCREEN_X], BGCNT_t* bgcnt, int hofs, int vofs, bool win0in, bool win1in, bool winout, bool objout) {
-    // Tileset (like pattern tables in the NES)
-    word character_base_addr = 0x06000000 + bgcnt->character_base_block * CHARBLOCK_SIZE;
-    // Tile map (like nametables in the NES)
-    word screen_base_addr = 0x06000000 + bgcnt->screen_base_block * SCREENBLOCK_SIZE;
-
-
-    reg_se_t se;
-    for (int x = 0; x < GBA_SCREEN_X; x++) {
-        if (should_render_bg_pixel(ppu, x, ppu->y, win0in, win1in, winout, objout)) {
-            int screenblock_number;
-            switch (bgcnt->screen_size) {
-                case 0:
-                    // 0
-                    screenblock_number = 0;
-                    break;
-                case 1:
-                    // 0 1
-                    screenblock_number = ((x + hofs) % 512) > 255 ? 1 : 0;
-                    break;
-                case 2:
-                    // 0
-                    // 1
-                    screenblock_number = ((ppu->y + vofs) % 512) > 255 ? 1 : 0;
-                    break;
-                case 3:
-                    // 0 1
-                    // 2 3
-                    screenblock_number = ((x + hofs) % 512) > 255 ? 1 : 0;
-                    screenblock_number += ((ppu->y + vofs) % 512) > 255 ? 2 : 0;
-                    break;
-                default:
-                    logfatal("Unimplemented screen size: %d", bgcnt->screen_size);
 
+// Clears the pixels of a BG line that the windows hide
+INLINE void mask_bg_windows(gba_ppu_t* ppu, color_t (*line)[GBA_SCREEN_X], bool win0in, bool win1in, bool winout, bool objout) {
+    if (ppu->DISPCNT.window0_display || ppu->DISPCNT.window1_display) {
+        for (int x = 0; x < GBA_SCREEN_X; x++) {
+            if (!should_render_bg_pixel(ppu, x, ppu->y, win0in, win1in, winout, objout)) {
+                (*line)[x].raw = 0;
             }
-            int tilemap_x = (x + hofs) % 256;
-            int tilemap_y = (ppu->y + vofs) % 256;
-
-            int se_number = (tilemap_x / 8) + (tilemap_y / 8) * 32;
-            se.raw = gba_read_half(screen_base_addr + screenblock_number * SCREENBLOCK_SIZE + se_number * 2);
-            render_screenentry(line, x, se, bgcnt->is_256color, character_base_addr, tilemap_x, tilemap_y);
-        } else {
-            (*line)[x].r = 0;
-            (*line)[x].g = 0;
-            (*line)[x].b = 0;
-            (*line)[x].transparent = true;
         }
     }
 }
 
-#define REF_TO_DOUBLE(x) ((x->sign ? -1 : 1) * x->integer)
-#define ROTSCALE_TO_DOUBLE(x) ((x->sign ? -1 : 1) * x->integer)
+#if defined(__AVX2__) || defined(__SSE2__)
+// Just the A of a color, which is what says whether it's transparent
+static const color_t alpha_only = {{.a = 0xFF}};
+#endif
+
+// Draws the 8 pixels of a tile row, one palette index per byte of pixels (the first pixel in the lowest byte.)
+// Index 0 is transparent, but still gets the color of the first entry of its bank, like render_tile_pixel().
+INLINE void render_span(color_t* out, uint64_t pixels, int palette_base) {
+    const color_t* palette = &palette_colors[palette_base];
+#if defined(__AVX2__)
+    __m256i indices = _mm256_cvtepu8_epi32(_mm_cvtsi64_si128(pixels));
+    __m256i colors = _mm256_i32gather_epi32((const int*)palette, indices, sizeof(color_t));
+    __m256i transparent = _mm256_cmpeq_epi32(indices, _mm256_setzero_si256());
+    colors = _mm256_andnot_si256(_mm256_and_si256(transparent, _mm256_set1_epi32(alpha_only.raw)), colors);
+    _mm256_storeu_si256((__m256i*)out, colors);
+#elif defined(__SSE2__)
+    word colors[8];
+    for (int i = 0; i < 8; i++) {
+        colors[i] = palette[(pixels >> (i * 8)) & 0xFF].raw;
+    }
+    // 0xFF for every transparent pixel, widened to a word each
+    __m128i transparent = _mm_cmpeq_epi8(_mm_cvtsi64_si128(pixels), _mm_setzero_si128());
+    transparent = _mm_unpacklo_epi8(transparent, transparent);
+    __m128i alpha = _mm_set1_epi32(alpha_only.raw);
+    __m128i low = _mm_andnot_si128(_mm_and_si128(_mm_unpacklo_epi16(transparent, transparent), alpha), _mm_loadu_si128((const __m128i*)&colors[0]));
+    __m128i high = _mm_andnot_si128(_mm_and_si128(_mm_unpackhi_epi16(transparent, transparent), alpha), _mm_loadu_si128((const __m128i*)&colors[4]));
+    _mm_storeu_si128((__m128i*)&out[0], low);
+    _mm_storeu_si128((__m128i*)&out[4], high);
+#else
+    for (int i = 0; i < 8; i++) {
+        byte index = (pixels >> (i * 8)) & 0xFF;
+        out[i] = palette[index];
+        if (index == 0) {
+            out[i].a = 0;
+        }
+    }
+#endif
+}
 
-void render_bg_affine(gba_ppu_t* ppu, gba_color_t (*line)[GBA_SCREEN_X], BGCNT_t* bgcnt,
-                      bool win0in, bool win1in, bool winout, bool objout,
-                      bg_referencepoint_t* x, bg_referencepoint_t* y,
-                      bg_rotation_scaling_t* pa, bg_rotation_scaling_t* pb, bg_rotation_scaling_t* pc, bg_rotation_scaling_t* pd) {
-    // Tileset (like pattern tables in the NES)
-    word character_base_addr = 0x06000000 + bgcnt->character_base_block * CHARBLOCK_SIZE;
+INLINE void render_bg_regular(gba_ppu_t* ppu, color_t (*line)[GBA_SCREEN_X], BGCNT_t* bgcnt, int hofs, int vofs, bool win0in, bool win1in, bool winout, bool objout) {
+    // Tileset (like pattern tables in the NES), as an offset into VRAM
+    word character_base_addr = bgcnt->character_base_block * CHARBLOCK_SIZE;
     // Tile map (like nametables in the NES)
-    word screen_base_addr = 0x06000000 + bgcnt->screen_base_block * SCREENBLOCK_SIZE;
-
-    int bg_width;
-    int bg_height;
-    switch (bgcnt->screen_size) {
-        case 0:
-            bg_width = 128;
-            bg_height = 128;
-            break;
-        case 1:
-            bg_width = 256;
-            bg_height = 256;
-            break;
-        case 2:
-            bg_width = 512;
-            bg_height = 512;
-            break;
-        case 3:
-            bg_width = 1024;
-            bg_height = 1024;
-            break;
-        default:
-            logfatal("Unimplemented screen size: %d", bgcnt->screen_size);
+    word screen_base_addr = bgcnt->screen_base_block * SCREENBLOCK_SIZE;
+
+    int tile_size = bgcnt->is_256color ? 0x40 : 0x20;
+
+    // Screenblocks are laid out
+    // 0    0 1    0    0 1
+    //             1    2 3
+    // for screen sizes 0 to 3. Everything that depends on the line is the same for the whole line.
+    bool wide = bgcnt->screen_size & 1;
+    bool tall = bgcnt->screen_size & 2;
+    int map_y = (ppu->y + vofs) % 512;
+    int tilemap_y = map_y % 256;
+    word line_se_address = screen_base_addr + (tilemap_y / 8) * 32 * 2;
+    if (tall && map_y > 255) {
+        line_se_address += (wide ? 2 : 1) * SCREENBLOCK_SIZE;
     }
 
-    for (int screen_x = 0; screen_x < GBA_SCREEN_X; screen_x++) {
-        double adjusted_y;
-        double adjusted_x;
+    // Whole tiles are drawn 8 pixels at a time, the partial ones at either end of the line go through a buffer
+    for (int x = 0; x < GBA_SCREEN_X;) {
+        int map_x = (x + hofs) % 512;
+        int first = map_x % 8;
+        int count = 8 - first;
+        if (count > GBA_SCREEN_X - x) {
+            count = GBA_SCREEN_X - x;
+        }
 
-        double ref_x = REF_TO_DOUBLE(x);
-        double ref_y = REF_TO_DOUBLE(y);
+        word se_address = line_se_address + ((map_x % 256) / 8) * 2;
+        if (wide && map_x > 255) {
+            se_address += SCREENBLOCK_SIZE;
+        }
+        reg_se_t se;
+        se.raw = vram_half(ppu, se_address);
+        int tile_y = se.vflip ? 7 - tilemap_y % 8 : tilemap_y % 8;
+        uint64_t pixels;
+        memcpy(&pixels, tile_row(ppu, character_base_addr + se.tid * tile_size, bgcnt->is_256color, tile_y), sizeof(pixels));
+        if (se.hflip) {
+            pixels = __builtin_bswap64(pixels);
+        }
 
-        double d_pa = ROTSCALE_TO_DOUBLE(pa);
-        double d_pb = ROTSCALE_TO_DOUBLE(pb);
-        double d_pc = ROTSCALE_TO_DOUBLE(pc);
-        double d_pd = ROTSCALE_TO_DOUBLE(pd);
+        int palette_base = bgcnt->is_256color ? PALETTE_BANK_BACKGROUND : PALETTE_BANK_BACKGROUND + 16 * se.pb;
+        if (count == 8) {
+            render_span(&(*line)[x], pixels, palette_base);
+        } else {
+            color_t span[8];
+            render_span(span, pixels, palette_base);
+            memcpy(&(*line)[x], &span[first], count * sizeof(color_t));
+        }
+        x += count;
+    }
 
-        adjusted_x = (screen_x - ref_x) * d_pa + (ppu->y - ref_y) * d_pb;
-        adjusted_x += ref_x;
-        adjusted_y = (screen_x - ref_x) * d_pc + (ppu->y - ref_y) * d_pd;
-        adjusted_y += ref_y;
+    mask_bg_windows(ppu, line, win0in, win1in, winout, objout);
+}
 
-        int render_x = (int)adjusted_x;
-        int render_y = (int)adjusted_y;
+// 20.8 fixed point in 28 bits, sign extended
+INLINE int32_t reference_point(bg_referencepoint_t* reg) {
+    return (int32_t)(reg->raw << 4) >> 4;
+}
 
-        if (render_y < bg_height && render_x < bg_width && should_render_bg_pixel(ppu, screen_x, ppu->y, win0in, win1in, winout, objout)) {
-            int se_number = (render_x / 8) + (render_y / 8) * (bg_width / 8);
-            byte tid = gba_read_byte(screen_base_addr + se_number);
-            render_tile(tid, 0, line, screen_x, true, character_base_addr, render_x % 8, render_y % 8);
-        } else {
-            (*line)[screen_x].r = 0;
-            (*line)[screen_x].g = 0;
-            (*line)[screen_x].b = 0;
-            (*line)[screen_x].transparent = true;
-        }
+void ppu_reference_point_written(gba_ppu_t* ppu, int bg, bool y) {
+    if (y) {
+        ppu->affine_y[bg - 2] = reference_point(bg == 2 ? &ppu->BG2Y : &ppu->BG3Y);
+    } else {
+        ppu->affine_x[bg - 2] = reference_point(bg == 2 ? &ppu->BG2X : &ppu->BG3X);
+    }
+}
+
+// x and y are the internal reference point of the line. Every pixel steps them by PA and PC (8.8 fixed point.)
+void render_bg_affine(gba_ppu_t* ppu, color_t (*line)[GBA_SCREEN_X], BGCNT_t* bgcnt,
+                      bool win0in, bool win1in, bool winout, bool objout,
+                      int32_t x, int32_t y, bg_rotation_scaling_t* pa, bg_rotation_scaling_t* pc) {
+    // Tileset (like pattern tables in the NES), as an offset into VRAM
+    word character_base_addr = bgcnt->character_base_block * CHARBLOCK_SIZE;
+    // Tile map (like nametables in the NES). One byte per tile, 16 to 128 tiles square.
+    word screen_base_addr = bgcnt->screen_base_block * SCREENBLOCK_SIZE;
+
+    int size_shift = 7 + bgcnt->screen_size;
+    int32_t size_mask = (1 << size_shift) - 1;
+    // Pixels outside of the BG are only kept if it wraps around
+    word outside_keep = bgcnt->display_area_overflow ? 0xFFFFFFFF : 0;
+    int16_t dx = pa->raw;
+    int16_t dy = pc->raw;
+
+    for (int screen_x = 0; screen_x < GBA_SCREEN_X; screen_x++) {
+        int32_t render_x = x >> 8;
+        int32_t render_y = y >> 8;
+        x += dx;
+        y += dy;
+
+        word keep = ((render_x | render_y) & ~size_mask) ? outside_keep : 0xFFFFFFFF;
+        render_x &= size_mask;
+        render_y &= size_mask;
+
+        int se_number = (render_x >> 3) + ((render_y >> 3) << (size_shift - 3));
+        byte tid = vram_byte(ppu, screen_base_addr + se_number);
+        byte tile = tile_row(ppu, character_base_addr + tid * 0x40, true, render_y & 7)[render_x & 7];
+        render_tile_pixel(line, screen_x, tile, 0, true);
+        (*line)[screen_x].raw &= keep;
     }
+
+    mask_bg_windows(ppu, line, win0in, win1in, winout, objout);
 }
 
 int background_priorities[4];
@@ -531,44 +672,44 @@ void refresh_background_priorities(gba_ppu_t* ppu) {
 }
 
 INLINE void merge_bgs(gba_ppu_t* ppu) {
+    // Mode 1 has no BG3 and mode 2 has no BG0 or BG1, whatever DISPCNT says
     bool bg_enabled[] = {
-            ppu->DISPCNT.screen_display_bg0,
-            ppu->DISPCNT.screen_display_bg1,
+            ppu->DISPCNT.screen_display_bg0 && ppu->DISPCNT.mode != 2,
+            ppu->DISPCNT.screen_display_bg1 && ppu->DISPCNT.mode != 2,
             ppu->DISPCNT.screen_display_bg2,
-            ppu->DISPCNT.screen_display_bg3};
+            ppu->DISPCNT.screen_display_bg3 && ppu->DISPCNT.mode != 1};
 
     for (int x = 0; x < GBA_SCREEN_X; x++) {
+        // Whatever is already there stays if nothing gets drawn
+        color_t out = ppu->screen[ppu->y][x];
         bool non_transparent_drawn = false;
         for (int i = 3; i >= 0; i--) { // Draw them in reverse priority order, so the highest priority BG is drawn last.
             // If the OBJ pixel here has the same priority as the BG, draw it instead.
             // "Sprites cover backgrounds of the same priority"
-            if (obj_priorities[x] == i && !objbuf[x].transparent) {
-                ppu->screen[ppu->y][x].a = 0xFF;
-                ppu->screen[ppu->y][x].r = FIVEBIT_TO_EIGHTBIT_COLOR(objbuf[x].r);
-                ppu->screen[ppu->y][x].g = FIVEBIT_TO_EIGHTBIT_COLOR(objbuf[x].g);
-                ppu->screen[ppu->y][x].b = FIVEBIT_TO_EIGHTBIT_COLOR(objbuf[x].b);
+            if (obj_priorities[x] == i && objbuf[x].a) {
+                out = objbuf[x];
                 non_transparent_drawn = true;
             } else {
                 int bg = background_priorities[i];
-                gba_color_t pixel = bgbuf[bg][x];
+                color_t pixel = bgbuf[bg][x];
+                bool transparent = pixel.a == 0;
                 bool should_draw = bg_enabled[bg];
-                if (pixel.transparent) {
+                if (transparent) {
                     // If the pixel is transparent, only draw it if we haven't drawn a non-transparent
                     should_draw &= !non_transparent_drawn;
                 }
 
                 if (should_draw) {
-                    ppu->screen[ppu->y][x].a = 0xFF;
-                    ppu->screen[ppu->y][x].r = FIVEBIT_TO_EIGHTBIT_COLOR(pixel.r);
-                    ppu->screen[ppu->y][x].g = FIVEBIT_TO_EIGHTBIT_COLOR(pixel.g);
-                    ppu->screen[ppu->y][x].b = FIVEBIT_TO_EIGHTBIT_COLOR(pixel.b);
+                    out = pixel;
+                    out.a = 0xFF;
 
-                    if (!pixel.transparent) {
+                    if (!transparent) {
                         non_transparent_drawn = true;
                     }
                 }
             }
         }
+        ppu->screen[ppu->y][x] = out;
     }
 }
 
@@ -615,7 +756,7 @@ INLINE void render_line_mode1(gba_ppu_t* ppu) {
     if (ppu->DISPCNT.screen_display_bg2) {
         render_bg_affine(ppu, &bgbuf[2], &ppu->BG2CNT,
                          ppu->WININ.win0_bg2_enable, ppu->WININ.win1_bg2_enable, ppu->WINOUT.outside_bg2_enable, ppu->WINOUT.obj_bg2_enable,
-                         &ppu->BG2X, &ppu->BG2Y, &ppu->BG2PA, &ppu->BG2PB, &ppu->BG2PC, &ppu->BG2PD);
+                         ppu->affine_x[0], ppu->affine_y[0], &ppu->BG2PA, &ppu->BG2PC);
     }
 
     refresh_background_priorities(ppu);
@@ -629,13 +770,13 @@ INLINE void render_line_mode2(gba_ppu_t* ppu) {
     if (ppu->DISPCNT.screen_display_bg2) {
         render_bg_affine(ppu, &bgbuf[2], &ppu->BG2CNT,
                          ppu->WININ.win0_bg2_enable, ppu->WININ.win1_bg2_enable, ppu->WINOUT.outside_bg2_enable, ppu->WINOUT.obj_bg2_enable,
-                         &ppu->BG2X, &ppu->BG2Y, &ppu->BG2PA, &ppu->BG2PB, &ppu->BG2PC, &ppu->BG2PD);
+                         ppu->affine_x[0], ppu->affine_y[0], &ppu->BG2PA, &ppu->BG2PC);
     }
 
     if (ppu->DISPCNT.screen_display_bg3) {
         render_bg_affine(ppu, &bgbuf[3], &ppu->BG3CNT,
                          ppu->WININ.win0_bg3_enable, ppu->WININ.win1_bg3_enable, ppu->WINOUT.outside_bg3_enable, ppu->WINOUT.obj_bg3_enable,
-                         &ppu->BG3X, &ppu->BG3Y, &ppu->BG3PA, &ppu->BG3PB, &ppu->BG3PC, &ppu->BG3PD);
+                         ppu->affine_x[1], ppu->affine_y[1], &ppu->BG3PA, &ppu->BG3PC);
     }
 
     refresh_background_priorities(ppu);
@@ -644,6 +785,7 @@ INLINE void render_line_mode2(gba_ppu_t* ppu) {
 }
 
 INLINE void render_line(gba_ppu_t* ppu) {
+    refresh_palette_colors(ppu);
     // Draw a pixel
     switch (ppu->DISPCNT.mode) {
         case 0:
@@ -666,50 +808,56 @@ INLINE void render_line(gba_ppu_t* ppu) {
     }
 }
 
-void ppu_step(gba_ppu_t* ppu) {
-    // Update coords and set V/HBLANK flags
-    ppu->x++;
-    if (!ppu->DISPSTAT.hblank && is_hblank(ppu)) {
-        if (!is_vblank(ppu)) {
-            dma_start_trigger(HBlank);
-        }
-        if (ppu->DISPSTAT.hblank_irq_enable) {
-            request_interrupt(IRQ_HBLANK);
-        }
-        ppu->DISPSTAT.hblank = true;
-        if (ppu->y < GBA_SCREEN_Y && !ppu->DISPCNT.forced_blank) { // i.e. not VBlank
-            render_line(ppu);
-        }
+void ppu_hblank(gba_ppu_t* ppu) {
+    if (!is_vblank(ppu)) {
+        dma_start_trigger(HBlank);
+    }
+    if (ppu->DISPSTAT.hblank_irq_enable) {
+        request_interrupt(IRQ_HBLANK);
+    }
+    ppu->DISPSTAT.hblank = true;
+    if (ppu->y < GBA_SCREEN_Y && !ppu->DISPCNT.forced_blank) { // i.e. not VBlank
+        render_line(ppu);
     }
-    if (ppu->x >= GBA_SCREEN_X + GBA_SCREEN_HBLANK) {
-        ppu->x = 0;
-        dbg_tick(SCANLINE);
-        ppu->DISPSTAT.hblank = false;
-        ppu->y++;
+    if (ppu->y < GBA_SCREEN_Y) {
+        // The next line of an affine BG starts PB/PD further along
+        ppu->affine_x[0] += (int16_t)ppu->BG2PB.raw;
+        ppu->affine_y[0] += (int16_t)ppu->BG2PD.raw;
+        ppu->affine_x[1] += (int16_t)ppu->BG3PB.raw;
+        ppu->affine_y[1] += (int16_t)ppu->BG3PD.raw;
+    }
+}
 
-        if (ppu->y > GBA_SCREEN_Y + GBA_SCREEN_VBLANK) {
-            ppu->y = 0;
-            dbg_tick(FRAME);
-            ppu->DISPSTAT.vblank = false;
-        }
+void ppu_hdraw(gba_ppu_t* ppu) {
+    dbg_tick(SCANLINE);
+    ppu->DISPSTAT.hblank = false;
+    ppu->y++;
 
-        if (!ppu->DISPSTAT.vblank && is_vblank(ppu)) {
-            dma_start_trigger(VBlank);
-            if (ppu->DISPSTAT.vblank_irq_enable) {
-                request_interrupt(IRQ_VBLANK);
-            }
-            ppu->DISPSTAT.vblank = true;
-            render_screen(&ppu->screen);
-        }
+    if (ppu->y > GBA_SCREEN_Y + GBA_SCREEN_VBLANK) {
+        ppu->y = 0;
+        dbg_tick(FRAME);
+        ppu->DISPSTAT.vblank = false;
+    }
 
-        if (ppu->y == ppu->DISPSTAT.vcount_setting) {
-            ppu->DISPSTAT.vcount = true;
-            if (ppu->DISPSTAT.vcount_irq_enable) {
-                request_interrupt(IRQ_VCOUNT);
-            }
-        } else {
-            ppu->DISPSTAT.vcount = false;
+    if (!ppu->DISPSTAT.vblank && is_vblank(ppu)) {
+        dma_start_trigger(VBlank);
+        if (ppu->DISPSTAT.vblank_irq_enable) {
+            request_interrupt(IRQ_VBLANK);
         }
+        ppu->DISPSTAT.vblank = true;
+        for (int bg = 2; bg <= 3; bg++) {
+            ppu_reference_point_written(ppu, bg, false);
+            ppu_reference_point_written(ppu, bg, true);
+        }
+        render_screen(&ppu->screen);
+    }
 
+    if (ppu->y == ppu->DISPSTAT.vcount_setting) {
+        ppu->DISPSTAT.vcount = true;
+        if (ppu->DISPSTAT.vcount_irq_enable) {
+            request_interrupt(IRQ_VCOUNT);
+        }
+    } else {
+        ppu->DISPSTAT.vcount = false;
     }
 }
@@ -9,6 +9,10 @@
 #define GBA_SCREEN_Y 160
 #define GBA_SCREEN_VBLANK 68
 
+#define CYCLES_PER_DOT 4
+#define HBLANK_START_CYCLES ((GBA_SCREEN_X + 1) * CYCLES_PER_DOT)
+#define LINE_CYCLES ((GBA_SCREEN_X + GBA_SCREEN_HBLANK) * CYCLES_PER_DOT)
+
 #define PRAM_SIZE  0x400
 #define VRAM_SIZE  0x18000
 #define OAM_SIZE   0x400
@@ -43,7 +47,7 @@ typedef union BGCNT {
         bool mosaic:1;
         unsigned is_256color:1;
         unsigned screen_base_block:5;
-        unsigned:1;
+        bool display_area_overflow:1; // Affine BGs only. Wrap around instead of being transparent outside.
         unsigned screen_size:2;
     };
     half raw;
@@ -76,11 +80,15 @@ typedef union bg_referencepoint {
     word raw;
 } bg_referencepoint_t;
 
-typedef struct color {
-    byte a;
-    byte r;
-    byte g;
-    byte b;
+// A pixel as it goes to SDL (ARGB32, so A is the first byte in memory)
+typedef union color {
+    struct {
+        byte a;
+        byte r;
+        byte g;
+        byte b;
+    };
+    word raw;
 } color_t;
 
 typedef union gba_color {
@@ -221,16 +229,32 @@ typedef union addr_28b {
     word raw;
 } addr_28b_t;
 
+// One of the 128 sprites in OAM. The affine parameters are spread across the fourth halfword of four sprites in a row.
+typedef struct oam_entry {
+    half attr0;
+    half attr1;
+    half attr2;
+    int16_t affine_param;
+} oam_entry_t;
+
 typedef struct gba_ppu {
     // State
-    half x;
     half y;
     color_t screen[GBA_SCREEN_Y][GBA_SCREEN_X];
 
-    // Memory
-    byte pram[PRAM_SIZE];
-    byte vram[VRAM_SIZE];
-    byte oam[OAM_SIZE];
+    // Memory. The bus sees these as bytes, the renderer reads them through the typed views.
+    union {
+        byte pram[PRAM_SIZE];
+        half palette[PRAM_SIZE / 2]; // 256 BG colors, then 256 OBJ colors
+    };
+    union {
+        byte vram[VRAM_SIZE];
+        half vram_halves[VRAM_SIZE / 2];
+    };
+    union {
+        byte oam[OAM_SIZE];
+        oam_entry_t oam_entries[OAM_SIZE / sizeof(oam_entry_t)];
+    };
 
 
     // Registers
@@ -276,6 +300,11 @@ typedef struct gba_ppu {
     bg_referencepoint_t BG3X;
     bg_referencepoint_t BG3Y;
 
+    // The reference points BG2 and BG3 are actually drawn from, as signed 20.8 fixed point. Reloaded from BGxX/BGxY
+    // when those are written and at the start of VBlank, and moved along by PB/PD after every line.
+    int32_t affine_x[2];
+    int32_t affine_y[2];
+
     DISPSTAT_t DISPSTAT;
 } gba_ppu_t;
 
@@ -319,7 +348,43 @@ extern int sprite_heights[3][4];
 extern int sprite_widths[3][4];
 
 
+// One bit per 32 byte tile of VRAM. Writes set it, and the renderer decodes the tile again the next time it's used.
+#define VRAM_TILES (VRAM_SIZE / 0x20)
+extern uint64_t vram_dirty_tiles[VRAM_TILES / 64];
+
+// index is an offset into vram[], after mirroring
+INLINE void vram_written(word index) {
+    word tile = index >> 5;
+    vram_dirty_tiles[tile >> 6] |= 1ull << (tile & 63);
+}
+
+void vram_range_written(word index, word length);
+
+// One bit per palette entry, set when PRAM is written so the renderer converts the color again
+extern uint64_t pram_dirty_colors[PRAM_SIZE / 2 / 64];
+
+// index is an offset into pram[]. Marks both colors of the word, because word writes only get here once.
+INLINE void pram_written(word index) {
+    word color = (index >> 1) & ~1;
+    pram_dirty_colors[color >> 6] |= 3ull << (color & 63);
+}
+
+void pram_range_written(word index, word length);
+
+// Set when OAM is written, so the renderer decodes the sprites again
+extern bool oam_dirty;
+
+INLINE void oam_written() {
+    oam_dirty = true;
+}
+
+// bg is 2 or 3
+void ppu_reference_point_written(gba_ppu_t* ppu, int bg, bool y);
+
 gba_ppu_t* init_ppu();
-void ppu_step(gba_ppu_t* ppu);
+// The PPU only does anything at these two points in every line. The scheduler calls them HBLANK_START_CYCLES and
+// LINE_CYCLES after the start of the line.
+void ppu_hblank(gba_ppu_t* ppu);
+void ppu_hdraw(gba_ppu_t* ppu);
 
 #endif //GBA_PPU_H
@@ -108,7 +108,7 @@ int main(int argc, char** argv) {
     set_register(cpu, REG_LR, 0x08000000);
 
     set_pc(cpu, 0x08000000);
-    cpu->cpsr.raw = 0x0000001F;
+    set_psr(cpu, 0x0000001F);
 
     cpu_log_t* lines = malloc(sizeof(cpu_log_t) * log_lines);
 
@@ -141,11 +141,11 @@ int main(int argc, char** argv) {
         // Register values in the log are BEFORE EXECUTING the instruction on that line
         logdebug("Checking registers (mode %d) against step %d (line %d in log)", cpu->cpsr.mode, step, step + 1)
 
-        if (lines[step].cpsr.raw != cpu->cpsr.raw) {
+        if (lines[step].cpsr.raw != get_psr(cpu)->raw) {
             printf("Expected cpsr: ");
             printcpsr(lines[step].cpsr);
             printf(" Actual cpsr: ");
-            printcpsr(cpu->cpsr);
+            printcpsr((*get_psr(cpu)));
             printf("\n");
         }
 
@@ -165,11 +165,7 @@ int main(int argc, char** argv) {
         ASSERT_EQUAL(adjusted_pc, "r13 (SP)",  lines[step].r[13],    get_register(cpu, 13))
         ASSERT_EQUAL(adjusted_pc, "r14 (LR)",  lines[step].r[14],    get_register(cpu, 14))
         ASSERT_EQUAL(adjusted_pc, "r15 (PC)",  lines[step].r[15],    get_register(cpu, 15))
-        ASSERT_EQUAL(adjusted_pc, "CPSR",      lines[step].cpsr.raw, cpu->cpsr.raw)
-
-        while(gba_dma() > 0) {
-            loginfo("DMA in progress, please hold...")
-        }
+        ASSERT_EQUAL(adjusted_pc, "CPSR",      lines[step].cpsr.raw, get_psr(cpu)->raw)
 
         do {
             gba_system_step();
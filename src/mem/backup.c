@@ -0,0 +1,456 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "backup.h"
+#include "../common/log.h"
+#include "../gba_system.h"
+
+#define GAME_CODE_OFFSET 0xAC
+// Everything before this is part of the header
+#define HEADER_END 0xE4
+
+typedef struct known_game {
+    char code[5];
+    backup_type_t backup_type;
+} known_game_t;
+
+// Only games whose backup type is certain. Anything else is found by the search below.
+static const known_game_t known_games[] = {
+        {"AXVE", FLASH128K}, // Pokemon Ruby
+        {"AXPE", FLASH128K}, // Pokemon Sapphire
+        {"BPEE", FLASH128K}, // Pokemon Emerald
+        {"BPRE", FLASH128K}, // Pokemon FireRed
+        {"BPGE", FLASH128K}, // Pokemon LeafGreen
+};
+
+typedef struct backup_id {
+    const char* id;
+    backup_type_t backup_type;
+} backup_id_t;
+
+// In the order they're checked at each address. They all start with one of the three words in find_candidate().
+static const backup_id_t backup_ids[] = {
+        {"SRAM", SRAM},
+        {"EEPROM", EEPROM},
+        {"FLASH_", FLASH64K},
+        {"FLASH512_", FLASH64K},
+        {"FLASH1M_", FLASH128K},
+};
+
+INLINE word read_word(const byte* p) {
+    word value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+// First word aligned address in [addr, end) that starts with "SRAM", "EEPR" or "FLAS", end if there isn't one.
+static size_t find_candidate(const byte* rom, size_t addr, size_t end) {
+    const word sram = read_word((const byte*)"SRAM");
+    const word eepr = read_word((const byte*)"EEPR");
+    const word flas = read_word((const byte*)"FLAS");
+#ifdef __SSE2__
+    const __m128i sram_x4 = _mm_set1_epi32(sram);
+    const __m128i eepr_x4 = _mm_set1_epi32(eepr);
+    const __m128i flas_x4 = _mm_set1_epi32(flas);
+    for (; addr + 16 <= end; addr += 16) {
+        __m128i words = _mm_loadu_si128((const __m128i*)&rom[addr]);
+        __m128i matches = _mm_or_si128(_mm_cmpeq_epi32(words, sram_x4),
+                          _mm_or_si128(_mm_cmpeq_epi32(words, eepr_x4), _mm_cmpeq_epi32(words, flas_x4)));
+        int mask = _mm_movemask_epi8(matches);
+        if (mask) {
+            return addr + __builtin_ctz(mask);
+        }
+    }
+#endif
+    for (; addr < end; addr += 4) {
+        word value = read_word(&rom[addr]);
+        if (value == sram || value == eepr || value == flas) {
+            return addr;
+        }
+    }
+    return end;
+}
+
+backup_type_t find_backup_type(const byte* rom, size_t rom_size) {
+    if (rom_size >= GAME_CODE_OFFSET + 4) {
+        for (int i = 0; i < sizeof(known_games) / sizeof(known_games[0]); i++) {
+            if (memcmp(known_games[i].code, &rom[GAME_CODE_OFFSET], 4) == 0) {
+                logwarn("Backup type of %.4s is known", known_games[i].code)
+                return known_games[i].backup_type;
+            }
+        }
+    }
+
+    // The ID strings are word aligned. rom is padded, so checking the longer ones near the end is safe.
+    size_t end = rom_size > HEADER_END + 4 ? rom_size - 4 : HEADER_END;
+    for (size_t addr = find_candidate(rom, HEADER_END, end); addr < end; addr = find_candidate(rom, addr + 4, end)) {
+        for (int i = 0; i < sizeof(backup_ids) / sizeof(backup_ids[0]); i++) {
+            if (memcmp(backup_ids[i].id, &rom[addr], strlen(backup_ids[i].id)) == 0) {
+                return backup_ids[i].backup_type;
+            }
+        }
+    }
+    return UNKNOWN;
+}
+
+#define FLASH_BANK_SIZE 0x10000
+#define EEPROM_SMALL_SIZE 0x200
+#define EEPROM_LARGE_SIZE 0x2000
+// How often the save is synced to disk, if it's been written to
+#define SAVE_SYNC_INTERVAL_MS 1000
+
+backup_type_t backup_type = UNKNOWN;
+
+static char* save_path = NULL;
+static byte* save = NULL;
+static size_t save_size = 0;
+static atomic_bool save_dirty = false;
+// Held by the sync thread while it syncs, and by the emulator while it changes the mapping. Reads and writes of the
+// save itself don't need it, only the emulator thread ever changes the mapping.
+static pthread_mutex_t save_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t sync_thread_once = PTHREAD_ONCE_INIT;
+
+typedef enum flash_state {
+    FLASH_READY,
+    FLASH_GOT_AA, // 0xAA was written to 0x5555
+    FLASH_GOT_55  // Then 0x55 to 0x2AAA, the next write to 0x5555 is a command
+} flash_state_t;
+
+static struct {
+    flash_state_t state;
+    bool id_mode;   // Reading 0 and 1 gives the manufacturer and device
+    bool erasing;   // The next command is an erase
+    bool writing;   // The next write goes to the chip
+    bool switching; // The next write to 0 picks the bank
+    int bank;
+} flash;
+
+typedef enum eeprom_state {
+    EEPROM_COMMAND,
+    EEPROM_ADDRESS,
+    EEPROM_DATA,
+    EEPROM_STOP
+} eeprom_state_t;
+
+static struct {
+    eeprom_state_t state;
+    int address_bits; // 6 for the 512 byte one, 14 for the 8K one. 0 until it's known.
+    bool reading;
+    int count;
+    uint64_t buffer;
+    word address;
+    int read_bits_left; // 4 junk bits and then the 64 bit block that was asked for
+    uint64_t read_data;
+} eeprom;
+
+INLINE void mark_dirty() {
+    atomic_store_explicit(&save_dirty, true, memory_order_relaxed);
+}
+
+// Callers hold save_lock
+static void sync_save_locked() {
+    if (save && atomic_exchange(&save_dirty, false)) {
+        if (msync(save, save_size, MS_SYNC) != 0) {
+            logwarn("Failed to sync the save file %s: %s", save_path, strerror(errno))
+        }
+    }
+}
+
+static void sync_save() {
+    pthread_mutex_lock(&save_lock);
+    sync_save_locked();
+    pthread_mutex_unlock(&save_lock);
+}
+
+static void* sync_thread(void* arg) {
+    struct timespec interval = {SAVE_SYNC_INTERVAL_MS / 1000, (SAVE_SYNC_INTERVAL_MS % 1000) * 1000000};
+    while (nanosleep(&interval, NULL) == 0 || errno == EINTR) {
+        sync_save();
+    }
+    return NULL;
+}
+
+// One thread syncs whatever save is mapped at the time, however many times the system is started
+static void start_sync_thread() {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, sync_thread, NULL) != 0) {
+        logfatal("Failed to start the save sync thread")
+    }
+    pthread_detach(thread);
+    atexit(sync_save);
+}
+
+// Syncs and unmaps the save of the last ROM, if there was one
+static void unmap_save() {
+    pthread_mutex_lock(&save_lock);
+    sync_save_locked();
+    if (save) {
+        munmap(save, save_size);
+    }
+    save = NULL;
+    save_size = 0;
+    free(save_path);
+    save_path = NULL;
+    pthread_mutex_unlock(&save_lock);
+}
+
+// Mapped shared, so every write is in the page cache straight away and survives the emulator crashing. Only the
+// kernel going down before the next sync can lose anything. Pages are only read in when they're touched.
+static void map_save(size_t size) {
+    int fd = open(save_path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        logfatal("Failed to open save file %s: %s", save_path, strerror(errno))
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        logfatal("Failed to stat save file %s: %s", save_path, strerror(errno))
+    }
+    size_t old_size = st.st_size < size ? st.st_size : size;
+    if (old_size < size && ftruncate(fd, size) != 0) {
+        logfatal("Failed to resize save file %s: %s", save_path, strerror(errno))
+    }
+
+    byte* mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED) {
+        logfatal("Failed to map save file %s: %s", save_path, strerror(errno))
+    }
+    close(fd);
+
+    // ftruncate() extends with zeroes, new or short files get the rest filled like an erased chip
+    if (old_size < size) {
+        memset(mapping + old_size, 0xFF, size - old_size);
+    }
+
+    pthread_mutex_lock(&save_lock);
+    save = mapping;
+    save_size = size;
+    if (old_size < size) {
+        mark_dirty();
+    }
+    pthread_mutex_unlock(&save_lock);
+
+    pthread_once(&sync_thread_once, start_sync_thread);
+    logwarn("Mapped %zu byte save file %s", size, save_path)
+}
+
+static void set_eeprom_size(size_t size) {
+    eeprom.address_bits = size == EEPROM_SMALL_SIZE ? 6 : 14;
+    map_save(size);
+}
+
+void init_backup(const char* romfile) {
+    unmap_save();
+    backup_type = find_backup_type(mem->rom, mem->rom_size);
+    if (backup_type == UNKNOWN) {
+        return;
+    }
+
+    // The ROM's name with .sav instead of its extension
+    const char* slash = strrchr(romfile, '/');
+    const char* dot = strrchr(romfile, '.');
+    size_t length = dot && (!slash || dot > slash) ? dot - romfile : strlen(romfile);
+    save_path = malloc(length + sizeof(".sav"));
+    memcpy(save_path, romfile, length);
+    strcpy(save_path + length, ".sav");
+
+    memset(&flash, 0, sizeof(flash));
+    memset(&eeprom, 0, sizeof(eeprom));
+    switch (backup_type) {
+        case UNKNOWN:
+            break;
+        case SRAM:
+            logwarn("Determined backup type: SRAM")
+            map_save(SRAM_SIZE);
+            break;
+        case FLASH64K:
+            logwarn("Determined backup type: FLASH64K")
+            map_save(FLASH_BANK_SIZE);
+            break;
+        case FLASH128K:
+            logwarn("Determined backup type: FLASH128K")
+            map_save(2 * FLASH_BANK_SIZE);
+            break;
+        case EEPROM: {
+            logwarn("Determined backup type: EEPROM")
+            // An existing save says how big it is, otherwise wait for the game to show it
+            struct stat st;
+            if (stat(save_path, &st) == 0 && (st.st_size == EEPROM_SMALL_SIZE || st.st_size == EEPROM_LARGE_SIZE)) {
+                set_eeprom_size(st.st_size);
+            }
+            break;
+        }
+    }
+}
+
+static byte flash_read(word address) {
+    if (flash.id_mode && address < 2) {
+        // Panasonic for 64K, Sanyo for 128K
+        static const byte id_64k[] = {0x32, 0x1B};
+        static const byte id_128k[] = {0x62, 0x13};
+        return backup_type == FLASH128K ? id_128k[address] : id_64k[address];
+    }
+    return save[flash.bank * FLASH_BANK_SIZE + address];
+}
+
+static void flash_write(word address, byte value) {
+    if (flash.writing) {
+        flash.writing = false;
+        save[flash.bank * FLASH_BANK_SIZE + address] = value;
+        mark_dirty();
+        return;
+    }
+    if (flash.switching && address == 0) {
+        flash.switching = false;
+        flash.bank = value & 1;
+        return;
+    }
+
+    switch (flash.state) {
+        case FLASH_READY:
+            if (address == 0x5555 && value == 0xAA) {
+                flash.state = FLASH_GOT_AA;
+            } else if (value == 0xF0) {
+                flash.id_mode = false; // Some games leave ID mode without the usual sequence
+            }
+            break;
+        case FLASH_GOT_AA:
+            flash.state = address == 0x2AAA && value == 0x55 ? FLASH_GOT_55 : FLASH_READY;
+            break;
+        case FLASH_GOT_55:
+            flash.state = FLASH_READY;
+            if (flash.erasing) {
+                flash.erasing = false;
+                if (address == 0x5555 && value == 0x10) {
+                    memset(save, 0xFF, save_size);
+                    mark_dirty();
+                } else if (value == 0x30) {
+                    memset(&save[flash.bank * FLASH_BANK_SIZE + (address & 0xF000)], 0xFF, 0x1000);
+                    mark_dirty();
+                }
+            } else if (address == 0x5555) {
+                switch (value) {
+                    case 0x90: flash.id_mode = true; break;
+                    case 0xF0: flash.id_mode = false; break;
+                    case 0x80: flash.erasing = true; break;
+                    case 0xA0: flash.writing = true; break;
+                    case 0xB0: flash.switching = backup_type == FLASH128K; break;
+                    default: logwarn("Unknown FLASH command 0x%02X", value)
+                }
+            }
+            break;
+    }
+}
+
+byte backup_read_byte(word address) {
+    switch (backup_type) {
+        case SRAM:
+            return save[address & (SRAM_SIZE - 1)];
+        case FLASH64K:
+        case FLASH128K:
+            return flash_read(address & (FLASH_BANK_SIZE - 1));
+        case UNKNOWN:
+            logwarn("Tried to access backup when backup type unknown!")
+            return 0;
+        default:
+            logfatal("Backup type %d can't be read a byte at a time!", backup_type)
+    }
+}
+
+void backup_write_byte(word address, byte value) {
+    switch (backup_type) {
+        case SRAM:
+            save[address & (SRAM_SIZE - 1)] = value;
+            mark_dirty();
+            break;
+        case FLASH64K:
+        case FLASH128K:
+            flash_write(address & (FLASH_BANK_SIZE - 1), value);
+            break;
+        case UNKNOWN:
+            logfatal("Tried to access backup when backup type unknown!")
+        default:
+            logfatal("Backup type %d can't be written a byte at a time!", backup_type)
+    }
+}
+
+void eeprom_dma(word count) {
+    if (eeprom.address_bits == 0) {
+        // Requests are 2 command bits, the address, 64 data bits for a write, and a stop bit
+        if (count == 2 + 6 + 1 || count == 2 + 6 + 64 + 1) {
+            set_eeprom_size(EEPROM_SMALL_SIZE);
+        } else if (count == 2 + 14 + 1 || count == 2 + 14 + 64 + 1) {
+            set_eeprom_size(EEPROM_LARGE_SIZE);
+        }
+    }
+}
+
+half eeprom_read() {
+    if (eeprom.read_bits_left > 0) {
+        int bit = --eeprom.read_bits_left;
+        return bit < 64 ? (eeprom.read_data >> bit) & 1 : 0;
+    }
+    return 1; // Ready
+}
+
+void eeprom_write(half value) {
+    eeprom.buffer = (eeprom.buffer << 1) | (value & 1);
+    eeprom.count++;
+    switch (eeprom.state) {
+        case EEPROM_COMMAND:
+            if (eeprom.count == 2) {
+                if (eeprom.buffer & 0b10) {
+                    if (eeprom.address_bits == 0) {
+                        logwarn("EEPROM size unknown, assuming 8K")
+                        set_eeprom_size(EEPROM_LARGE_SIZE);
+                    }
+                    eeprom.reading = eeprom.buffer & 1;
+                    eeprom.state = EEPROM_ADDRESS;
+                }
+                eeprom.count = 0;
+                eeprom.buffer = 0;
+            }
+            break;
+        case EEPROM_ADDRESS:
+            if (eeprom.count == eeprom.address_bits) {
+                eeprom.address = (eeprom.buffer * 8) & (save_size - 1);
+                eeprom.state = eeprom.reading ? EEPROM_STOP : EEPROM_DATA;
+                eeprom.count = 0;
+                eeprom.buffer = 0;
+            }
+            break;
+        case EEPROM_DATA:
+            if (eeprom.count == 64) {
+                for (int i = 0; i < 8; i++) {
+                    save[eeprom.address + i] = eeprom.buffer >> (56 - i * 8);
+                }
+                mark_dirty();
+                eeprom.state = EEPROM_STOP;
+                eeprom.count = 0;
+                eeprom.buffer = 0;
+            }
+            break;
+        case EEPROM_STOP:
+            if (eeprom.reading) {
+                eeprom.read_data = 0;
+                for (int i = 0; i < 8; i++) {
+                    eeprom.read_data = (eeprom.read_data << 8) | save[eeprom.address + i];
+                }
+                eeprom.read_bits_left = 64 + 4;
+            }
+            eeprom.state = EEPROM_COMMAND;
+            eeprom.count = 0;
+            eeprom.buffer = 0;
+            break;
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef GBA_BACKUP_H
+#define GBA_BACKUP_H
+
+#include <stddef.h>
+
+#include "../common/util.h"
+
+typedef enum backup_type {
+    UNKNOWN,
+    SRAM,
+    EEPROM,
+    FLASH64K,
+    FLASH128K
+} backup_type_t;
+
+extern backup_type_t backup_type;
+
+// Known games by the code in their header, or failing that the ID string the save library leaves in the ROM.
+backup_type_t find_backup_type(const byte* rom, size_t rom_size);
+
+// Works out the backup type and maps the save file next to the ROM (the ROM's name, ending in .sav) as the backup.
+// Writes only mark the save dirty, a background thread syncs it to disk every so often.
+void init_backup(const char* romfile);
+
+// SRAM and FLASH, 0x0E000000 and up
+byte backup_read_byte(word address);
+void backup_write_byte(word address, byte value);
+
+// The EEPROM is read and written a bit at a time, in bit 0 of each halfword
+half eeprom_read();
+void eeprom_write(half value);
+// The only way to tell how big the EEPROM is: how many bits the game sends it in one go with DMA
+void eeprom_dma(word count);
+
+#endif //GBA_BACKUP_H
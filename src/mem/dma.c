@@ -1,9 +1,17 @@
+#include <string.h>
+
 #include "dma.h"
 #include "../common/log.h"
 #include "../gba_system.h"
 #include "ioreg_names.h"
+#include "../scheduler.h"
+#include "backup.h"
+
+#define DMA_START_DELAY 2
+#define SOUND_DMA_WORDS 4
 
-static dma_start_time_t dma_trigger = Immediately;
+static byte armed;  // Enabled, waiting for their start condition
+static byte active; // Started, with units left to transfer. EVENT_DMA is scheduled whenever this isn't 0.
 
 static const char* dma_triggers[] = {
         "Immediate",
@@ -12,141 +20,311 @@ static const char* dma_triggers[] = {
         "Refresh"
 };
 
+INLINE DMACNTH_t* control(int n) {
+    switch (n) {
+        case 0: return &bus->DMA0CNT_H;
+        case 1: return &bus->DMA1CNT_H;
+        case 2: return &bus->DMA2CNT_H;
+        default: return &bus->DMA3CNT_H;
+    }
+}
+
+INLINE DMAINT_t* internal(int n) {
+    switch (n) {
+        case 0: return &bus->DMA0INT;
+        case 1: return &bus->DMA1INT;
+        case 2: return &bus->DMA2INT;
+        default: return &bus->DMA3INT;
+    }
+}
+
+INLINE word source_register(int n) {
+    switch (n) {
+        case 0: return bus->DMA0SAD.addr;
+        case 1: return bus->DMA1SAD.addr;
+        case 2: return bus->DMA2SAD.addr;
+        default: return bus->DMA3SAD.addr;
+    }
+}
+
+INLINE word dest_register(int n) {
+    switch (n) {
+        case 0: return bus->DMA0DAD.addr;
+        case 1: return bus->DMA1DAD.addr;
+        case 2: return bus->DMA2DAD.addr;
+        default: return bus->DMA3DAD.addr;
+    }
+}
+
+// A word count of 0 means the most the channel can do
+INLINE word word_count(int n) {
+    switch (n) {
+        case 0: return bus->DMA0CNT_L.wc ? bus->DMA0CNT_L.wc : 0x4000;
+        case 1: return bus->DMA1CNT_L.wc ? bus->DMA1CNT_L.wc : 0x4000;
+        case 2: return bus->DMA2CNT_L.wc ? bus->DMA2CNT_L.wc : 0x4000;
+        default: return bus->DMA3CNT_L.wc ? bus->DMA3CNT_L.wc : 0x10000;
+    }
+}
+
+INLINE bool is_sound_dma(int n) {
+    return (n == 1 || n == 2) && control(n)->dma_start_time == Special;
+}
+
+// DMA3's special start time is video capture, which isn't implemented. It's run straight away instead.
+INLINE bool starts_immediately(int n) {
+    dma_start_time_t start_time = control(n)->dma_start_time;
+    return start_time == Immediately || (n == 3 && start_time == Special);
+}
+
+// Cycles for a sequential access to address, with the game pak waitstates from WAITCNT.
+// The first access of a transfer is really a slower non-sequential one, that's ignored.
+static int access_cycles(word address, bool is_word) {
+    static const int ws_n[] = {4, 3, 2, 8};
+    WAITCNT_t waitcnt = bus->WAITCNT;
+    int ws_s;
+    switch (address >> 24) {
+        case 0x2: // EWRAM, 2 waitstates on a 16 bit bus
+            return is_word ? 6 : 3;
+        case 0x5: // Palette RAM and VRAM, 16 bit bus
+        case 0x6:
+            return is_word ? 2 : 1;
+        case 0x8:
+        case 0x9:
+            ws_s = waitcnt.ws0_s ? 1 : 2;
+            break;
+        case 0xA:
+        case 0xB:
+            ws_s = waitcnt.ws1_s ? 1 : 4;
+            break;
+        case 0xC:
+        case 0xD:
+            ws_s = waitcnt.ws2_s ? 1 : 8;
+            break;
+        case 0xE:
+        case 0xF:
+            return 1 + ws_n[waitcnt.sram_wait];
+        default:
+            return 1;
+    }
+    // The game pak bus is 16 bits too
+    return is_word ? 2 * (1 + ws_s) : 1 + ws_s;
+}
+
+static void start_channel(int n) {
+    DMACNTH_t* cnth = control(n);
+    DMAINT_t* dmaint = internal(n);
+    dmaint->remaining = is_sound_dma(n) ? SOUND_DMA_WORDS : word_count(n);
+
+    logwarn("DMA%d triggered: at %s - 0x%08X => 0x%08X * %d width: %s src: %d, dest: %d",
+            n, dma_triggers[cnth->dma_start_time], dmaint->current_source_address, dmaint->current_dest_address,
+            dmaint->remaining, cnth->dma_transfer_type ? "32b" : "16b", cnth->source_addr_control, cnth->dest_addr_control)
+
+    if (n == 3 && backup_type == EEPROM && (dmaint->current_dest_address >> 24) == 0xD) {
+        eeprom_dma(dmaint->remaining);
+    }
+
+    armed &= ~(1u << n);
+    if (active == 0) {
+        schedule_event(EVENT_DMA, current_cycle + DMA_START_DELAY);
+    }
+    active |= 1u << n;
+}
+
 void dma_start_trigger(dma_start_time_t trigger) {
-    dma_trigger = trigger;
-}
-
-int dma(int n, DMACNTH_t* cnth, DMAINT_t* dmaint, word sad, word dad, word wc, word max_wc) {
-    int dma_cycles = 0;
-    bool is_sound_dma = false;
-    if (cnth->dma_enable) {
-        unimplemented(cnth->game_pak_drq_dma3_only, "Game pak DRQ")
-        if (cnth->dma_start_time != Immediately && cnth->dma_start_time != dma_trigger) {
-            if (cnth->dma_start_time == Special) {
-                if (n == 0) {
-                    logfatal("Special start time for DMA0 is invalid!")
-                }
-                else if (n == 1 || n == 2) {
-                    int fifo_index = 0;
-                    is_sound_dma = true;
-
-                    if ((dad & 0xFFF) == IO_FIFO_A) {
-                        fifo_index = 0;
-                    } else if ((dad & 0xFFF) == IO_FIFO_B) {
-                        fifo_index = 1;
-                    } else {
-                        logfatal("Sound DMA to non-FIFO register")
-                    }
-
-                    int fifo_size = apu->fifo[fifo_index].write_index - apu->fifo[fifo_index].read_index;
-
-                    // If the FIFO is more than half full, don't bother running the DMA yet
-                    if (fifo_size > (SOUND_FIFO_SIZE / 2)) {
-                        return 0;
-                    }
+    for (int n = 0; n < 4; n++) {
+        if ((armed & (1u << n)) && control(n)->dma_start_time == trigger) {
+            if (trigger == Special) {
+                int fifo_index = (internal(n)->current_dest_address & 0xFFF) == IO_FIFO_A ? 0 : 1;
+                int fifo_size = apu->fifo[fifo_index].write_index - apu->fifo[fifo_index].read_index;
+                // Only when the FIFO this channel feeds is at most half full
+                if (fifo_size > (SOUND_FIFO_SIZE / 2)) {
+                    continue;
                 }
-            } else {
-                return 0;
             }
+            start_channel(n);
         }
+    }
+}
 
-        // When newly enabled, reload everything
-        if (!dmaint->previously_enabled) {
-            dmaint->previously_enabled = true;
-            dmaint->current_source_address = sad;
-            dmaint->current_dest_address = dad;
-        } else if (cnth->dest_addr_control == 3) {
-            dmaint->previously_enabled = true;
-            dmaint->current_dest_address = dad;
+void dma_control_written(int n) {
+    DMACNTH_t* cnth = control(n);
+    DMAINT_t* dmaint = internal(n);
+    if (!cnth->dma_enable) {
+        dmaint->previously_enabled = false;
+        armed &= ~(1u << n);
+        active &= ~(1u << n);
+        return;
+    }
+    if (dmaint->previously_enabled) {
+        return; // Already armed or running
+    }
+
+    unimplemented(cnth->game_pak_drq_dma3_only, "Game pak DRQ")
+    if (cnth->dma_start_time == Special) {
+        if (n == 0) {
+            logfatal("Special start time for DMA0 is invalid!")
+        } else if (is_sound_dma(n) && (dest_register(n) & 0xFFF) != IO_FIFO_A && (dest_register(n) & 0xFFF) != IO_FIFO_B) {
+            logfatal("Sound DMA to non-FIFO register")
         }
+    }
+    logwarn("DMA%dCNT_H set to 0x%08X", n, cnth->raw)
 
-        dmaint->remaining = wc;
-        if (dmaint->remaining == 0) {
-            dmaint->remaining = max_wc;
+    // The addresses are only read when the channel is enabled
+    dmaint->previously_enabled = true;
+    dmaint->current_source_address = source_register(n);
+    dmaint->current_dest_address = dest_register(n);
+    if (starts_immediately(n)) {
+        start_channel(n);
+    } else {
+        armed |= 1u << n;
+    }
+}
+
+INLINE int address_step(unsigned addr_control) {
+    switch (addr_control) {
+        case 0: return 1;
+        case 1: return -1;
+        case 2: return 0;
+        default: return 1; // Increment, and for the destination reload after the transfer
+    }
+}
+
+// Copies count units at once when both sides are plain memory, returns false if they have to be done one at a time.
+// Only the address steps where a straight copy gives the same result are handled: both incrementing, both
+// decrementing, or a fixed source filling an incrementing destination.
+static bool dma_bulk(int n, DMACNTH_t* cnth, DMAINT_t* dmaint, word count) {
+    word unit = cnth->dma_transfer_type ? sizeof(word) : sizeof(half);
+    word length = count * unit;
+    word source = dmaint->current_source_address;
+    word dest = dmaint->current_dest_address;
+    int source_step = address_step(cnth->source_addr_control);
+    int dest_step = address_step(cnth->dest_addr_control);
+
+    if (((source | dest) & (unit - 1)) != 0 || cnth->source_addr_control == 3 || dest_step == 0
+        || (source_step != 0 && source_step != dest_step)) {
+        return false;
+    }
+
+    // Lowest address on each side
+    word source_start = source_step < 0 ? source - (count - 1) * unit : source;
+    word dest_start = dest_step < 0 ? dest - (count - 1) * unit : dest;
+    word source_length = source_step == 0 ? unit : length;
+
+    byte* from = gba_read_span(source_start, source_length);
+    if (!from) {
+        return false;
+    }
+    byte* to = gba_write_span(dest_start, length);
+    if (!to) {
+        return false;
+    }
+
+    bool overlap = from < to + length && to < from + source_length;
+    if (source_step == 0) {
+        if (overlap) {
+            return false; // The source would change partway through
+        }
+        for (word offset = 0; offset < length; offset += unit) {
+            memcpy(to + offset, from, unit);
+        }
+    } else {
+        // Copying forwards into a later address (or backwards into an earlier one) repeats what was just written
+        if (overlap && (source_step > 0 ? to > from : to < from)) {
+            return false;
         }
+        memmove(to, from, length);
+    }
 
-        logwarn("DMA%d triggered: at %s - 0x%08X => 0x%08X * %d width: %s src: %d, dest: %d",
-                n, dma_triggers[cnth->dma_start_time], sad, dad, dmaint->remaining, cnth->dma_transfer_type ? "32b" : "16b",
-                cnth->source_addr_control, cnth->dest_addr_control)
-        logwarn("DMA%dCNT_H set to 0x%08X", n, cnth->raw);
-
-        while (dmaint->remaining > 0) {
-            if (cnth->dma_transfer_type == 0) {// 16 bits
-                word source_address = dmaint->current_source_address;
-                half value = gba_read_half(source_address);
-                dma_cycles++; // TODO real mem access time
-                switch (cnth->source_addr_control) {
-                    case 0: dmaint->current_source_address += sizeof(half); break;
-                    case 1: dmaint->current_source_address -= sizeof(half); break;
-                    case 2: break; // No change
-                    default: logfatal("Unimplemented source address control type: %d", cnth->source_addr_control)
-                }
+    dmaint->current_source_address += source_step * (int)length;
+    dmaint->current_dest_address += dest_step * (int)length;
+    dmaint->remaining -= count;
+    logwarn("DMA%d: copied 0x%X bytes from 0x%08X to 0x%08X", n, length, source_start, dest_start)
+    return true;
+}
 
-                word dest_address = dmaint->current_dest_address;
-                gba_write_half(dest_address, value);
-                dma_cycles++;
-                if (!is_sound_dma) {
-                    switch (cnth->dest_addr_control) {
-                        case 0: dmaint->current_dest_address += sizeof(half); break;
-                        case 1: dmaint->current_dest_address -= sizeof(half); break;
-                        case 2: break; // No change
-                        case 3: dmaint->current_dest_address += sizeof(half); break; // Reset after transfer on repeat
-                        default: logfatal("Unimplemented dest address control type: %d", cnth->dest_addr_control)
-                    }
-                }
-                logwarn("DMA%d: transferred 0x%04X from 0x%08X to 0x%08X", n, value, source_address, dest_address)
-            } else { // 32 bits
-                word source_address = dmaint->current_source_address;
-                word value = gba_read_word(source_address);
-                dma_cycles++; // TODO real mem access time
-                switch (cnth->source_addr_control) {
-                    case 0: dmaint->current_source_address += sizeof(word); break;
-                    case 1: dmaint->current_source_address -= sizeof(word); break;
-                    case 2: break; // No change
-                    case 3: dmaint->current_source_address += sizeof(word); break; // Reset after transfer on repeat
-                    default: logfatal("Unimplemented source address control type: %d", cnth->source_addr_control)
-                }
+// Transfers up to count units of channel n
+static void transfer(int n, word count) {
+    DMACNTH_t* cnth = control(n);
+    DMAINT_t* dmaint = internal(n);
+    bool sound = is_sound_dma(n);
 
-                word dest_address = dmaint->current_dest_address;
-                gba_write_word(dest_address, value);
-                dma_cycles++; // TODO real mem access time
-                if (!is_sound_dma) { // Only inc when not a sound DMA
-                    switch (cnth->dest_addr_control) {
-                        case 0: dmaint->current_dest_address += sizeof(word); break;
-                        case 1: dmaint->current_dest_address -= sizeof(word); break;
-                        case 2: break; // No change
-                        case 3: dmaint->current_dest_address += sizeof(word); break; // Reset after transfer on repeat
-                        default: logfatal("Unimplemented dest address control type: %d", cnth->dest_addr_control)
-                    }
-                }
+    if (!sound && dma_bulk(n, cnth, dmaint, count)) {
+        return;
+    }
 
-                logwarn("DMA%d: transferred 0x%08X from 0x%08X to 0x%08X", n, value, source_address, dest_address)
-            }
-            dmaint->remaining--;
+    // Sound DMAs always move words into the FIFO, without touching the destination address
+    bool is_word = sound || cnth->dma_transfer_type;
+    word unit = is_word ? sizeof(word) : sizeof(half);
+    int source_step = address_step(cnth->source_addr_control) * (int)unit;
+    int dest_step = sound ? 0 : address_step(cnth->dest_addr_control) * (int)unit;
+    unimplemented(!is_word && cnth->source_addr_control == 3, "16 bit DMA with source address control 3")
+
+    for (word i = 0; i < count; i++) {
+        word source_address = dmaint->current_source_address;
+        word dest_address = dmaint->current_dest_address;
+        if (is_word) {
+            word value = gba_read_word(source_address);
+            gba_write_word(dest_address, value);
+            logwarn("DMA%d: transferred 0x%08X from 0x%08X to 0x%08X", n, value, source_address, dest_address)
+        } else {
+            half value = gba_read_half(source_address);
+            gba_write_half(dest_address, value);
+            logwarn("DMA%d: transferred 0x%04X from 0x%08X to 0x%08X", n, value, source_address, dest_address)
         }
-        logwarn("DMA%d finished", n)
-        if (cnth->irq_on_end_of_wc) {
-            switch (n) {
-                case 0:
-                    request_interrupt(IRQ_DMA0);
-                    break;
-                case 1:
-                    request_interrupt(IRQ_DMA1);
-                    break;
-                case 2:
-                    request_interrupt(IRQ_DMA2);
-                    break;
-                case 3:
-                    request_interrupt(IRQ_DMA3);
-                    break;
-            }
+        dmaint->current_source_address += source_step;
+        dmaint->current_dest_address += dest_step;
+    }
+    dmaint->remaining -= count;
+}
+
+static void finish_channel(int n) {
+    DMACNTH_t* cnth = control(n);
+    DMAINT_t* dmaint = internal(n);
+    logwarn("DMA%d finished", n)
+    active &= ~(1u << n);
+    if (cnth->irq_on_end_of_wc) {
+        request_interrupt(IRQ_DMA0 + n);
+    }
+    // Repeating only means something for channels that wait to be started
+    if (cnth->dma_repeat && !starts_immediately(n)) {
+        if (cnth->dest_addr_control == 3) {
+            dmaint->current_dest_address = dest_register(n);
         }
-        cnth->dma_enable = cnth->dma_repeat;
-        dmaint->previously_enabled = cnth->dma_enable;
+        armed |= 1u << n;
+    } else {
+        cnth->dma_enable = false;
+        dmaint->previously_enabled = false;
     }
-    return dma_cycles;
 }
 
-void dma_done_hook() {
-    dma_trigger = Immediately;
-}
\ No newline at end of file
+void dma_event(uint64_t time) {
+    if (active == 0) {
+        return; // Everything was disabled before it got going
+    }
+
+    // Lower channels go first. The CPU doesn't get the bus back until they're all done, but something the next event
+    // does (an HBlank, say) could start a higher priority channel, so only run up to it.
+    int n = __builtin_ctz(active);
+    DMAINT_t* dmaint = internal(n);
+    bool is_word = is_sound_dma(n) || control(n)->dma_transfer_type;
+    int unit_cycles = access_cycles(dmaint->current_source_address, is_word)
+                    + access_cycles(dmaint->current_dest_address, is_word);
+
+    uint64_t until = next_event_time();
+    uint64_t fits = until > current_cycle ? (until - current_cycle) / unit_cycles : 0;
+    word count = fits < dmaint->remaining ? fits : dmaint->remaining;
+    if (count == 0) {
+        count = 1;
+    }
+
+    transfer(n, count);
+    current_cycle += (uint64_t)count * unit_cycles;
+
+    // Only finish it if the transfer didn't disable the channel itself
+    if ((active & (1u << n)) && dmaint->remaining == 0) {
+        finish_channel(n);
+    }
+    if (active) {
+        schedule_event(EVENT_DMA, current_cycle);
+    }
+}
@@ -3,8 +3,11 @@
 #include "gbabus.h"
 #include "../audio/audio.h"
 
+// Starts every armed channel waiting for this. Special is a sound FIFO asking for more data.
 void dma_start_trigger(dma_start_time_t trigger);
-int dma(int n, DMACNTH_t* cnth, DMAINT_t* dmaint, word sad, word dad, word wc, word max_wc);
-void dma_done_hook();
+// DMAxCNT_H was written to
+void dma_control_written(int n);
+// Transfers as much of the highest priority active channel as fits before the next event
+void dma_event(uint64_t time);
 
 #endif //GBA_DMA_H
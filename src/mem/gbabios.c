@@ -589,6 +589,10 @@ byte bios[GBA_BIOS_SIZE] = {
         0x39, 0xBF, 0xA1, 0xF1, 0x64, 0x6B, 0x41, 0x52, 0x4D, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
 };
 
+byte* gbabios_memory() {
+    return alternate_bios ? alternate_bios : bios;
+}
+
 byte gbabios_read_byte(word address) {
     if (alternate_bios) {
         return alternate_bios[address];
@@ -6,6 +6,8 @@
 #define GBA_BIOS_SIZE 0x4000
 
 byte gbabios_read_byte(word address);
+// The BIOS that's loaded, GBA_BIOS_SIZE bytes
+byte* gbabios_memory();
 void load_alternate_bios(const char* filename);
 
 #endif //GBA_BIOS_H
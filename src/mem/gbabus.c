@@ -6,22 +6,436 @@
 #include "gbamem.h"
 #include "../common/log.h"
 #include "gbabios.h"
+#include "gbarom.h"
 #include "dma.h"
+#include "timer.h"
+#include "backup.h"
 #include "../gba_system.h"
+#include "../arm7tdmi/block_cache.h"
+#include "../scheduler.h"
 
 static gbabus_t bus_state;
 
 word open_bus(word addr);
 
-typedef enum backup_type {
-    UNKNOWN,
-    SRAM,
-    EEPROM,
-    FLASH64K,
-    FLASH128K
-} backup_type_t;
+// Everything below 0x10000000 is split into pages. Pages that are plain memory point straight at it, the rest go
+// through the slow handlers below (IO, backup, open bus, the end of the ROM.)
+#define MEM_PAGE_SHIFT 14
+#define MEM_PAGE_SIZE (1 << MEM_PAGE_SHIFT)
+#define MEM_PAGES (0x10000000 >> MEM_PAGE_SHIFT)
+
+typedef struct mem_page {
+    byte* base; // NULL if this page needs the slow handlers
+    word mask; // Smaller than the page for memory that's mirrored inside of it (PRAM, OAM)
+    int code_page; // The first code page (see block_cache.h) in this page, or -1 if no code is cached from it
+    // Writes have to mark the tiles, colors or sprites they touch (see ppu.h)
+    bool vram;
+    bool pram;
+    bool oam;
+} mem_page_t;
+
+static mem_page_t read_pages[MEM_PAGES];
+static mem_page_t write_pages[MEM_PAGES];
+
+// Maps [start, end) to memory that repeats every region_size bytes (a power of two). Only the first valid_size bytes
+// of each repetition are mapped, the rest is left to the slow handlers.
+static void map_region(mem_page_t* pages, word start, word end, byte* region, word region_size, word valid_size, int code_page_base) {
+    word mask = (region_size < MEM_PAGE_SIZE ? region_size : MEM_PAGE_SIZE) - 1;
+    for (word address = start; address < end; address += MEM_PAGE_SIZE) {
+        word offset = address & (region_size - 1) & ~mask;
+        if (offset + mask >= valid_size) {
+            continue;
+        }
+        mem_page_t* page = &pages[address >> MEM_PAGE_SHIFT];
+        page->base = region + offset;
+        page->mask = mask;
+        page->code_page = code_page_base < 0 ? -1 : code_page_base + (offset >> CODE_PAGE_SHIFT);
+        page->vram = region == ppu->vram || region == ppu->vram + 0x10000;
+        page->pram = region == ppu->pram;
+        page->oam = region == ppu->oam;
+    }
+}
+
+static void init_memory_map() {
+    memset(read_pages, 0, sizeof(read_pages));
+    memset(write_pages, 0, sizeof(write_pages));
+
+    map_region(read_pages, 0x00000000, GBA_BIOS_SIZE, gbabios_memory(), GBA_BIOS_SIZE, GBA_BIOS_SIZE, -1);
+
+    for (int i = 0; i < 2; i++) {
+        mem_page_t* pages = i == 0 ? read_pages : write_pages;
+        map_region(pages, 0x02000000, 0x03000000, mem->ewram, EWRAM_SIZE, EWRAM_SIZE, IWRAM_CODE_PAGES);
+        map_region(pages, 0x03000000, 0x04000000, mem->iwram, IWRAM_SIZE, IWRAM_SIZE, 0);
+        map_region(pages, 0x05000000, 0x06000000, ppu->pram, PRAM_SIZE, PRAM_SIZE, -1);
+        // VRAM is 96KB in a 128KB window, the last 32KB mirror the 32KB before them
+        map_region(pages, 0x06000000, 0x07000000, ppu->vram, 0x20000, VRAM_SIZE, -1);
+        for (word address = 0x06018000; address < 0x07000000; address += 0x20000) {
+            map_region(pages, address, address + 0x8000, ppu->vram + 0x10000, 0x8000, 0x8000, -1);
+        }
+        map_region(pages, 0x07000000, 0x08000000, ppu->oam, OAM_SIZE, OAM_SIZE, -1);
+    }
+
+    // The ROM is mirrored in each of the three 32MB wait state regions. The top of the last one is EEPROM on some carts.
+    word rom_end = backup_type == EEPROM ? 0x0D000000 : 0x0E000000;
+    map_region(read_pages, 0x08000000, rom_end, mem->rom, 0x2000000, mem->rom_mask + 1, -1);
+}
+
+INLINE mem_page_t* page_for(mem_page_t* pages, word addr) {
+    word index = addr >> MEM_PAGE_SHIFT;
+    if (index < MEM_PAGES && pages[index].base) {
+        return &pages[index];
+    }
+    return NULL;
+}
+
+INLINE byte* read_ptr(word addr) {
+    mem_page_t* page = page_for(read_pages, addr);
+    return page ? page->base + (addr & page->mask) : NULL;
+}
+
+INLINE byte* write_ptr(word addr) {
+    mem_page_t* page = page_for(write_pages, addr);
+    if (!page) {
+        return NULL;
+    }
+    word index = addr & page->mask;
+    if (page->code_page >= 0) {
+        int code_page = page->code_page + (index >> CODE_PAGE_SHIFT);
+        if (code_pages[code_page]) {
+            invalidate_code_page(cpu, code_page);
+        }
+    } else if (page->vram) {
+        vram_written(page->base + index - ppu->vram);
+    } else if (page->pram) {
+        pram_written(index);
+    } else if (page->oam) {
+        oam_written();
+    }
+    return page->base + index;
+}
+
+// Every byte of IO space (up to IMEM_CTRL) gets a copy of the descriptor of the register it's part of, so any access
+// at any width is one lookup.
+#define IOREG_SPACE sizeof(io_register_sizes)
+
+typedef word (*ioreg_read_t)(word offset);
+typedef void (*ioreg_write_t)(word offset, word value, word mask);
+typedef void (*ioreg_after_write_t)(word offset);
+
+typedef struct ioreg {
+    word offset; // Of the first byte of the register
+    byte size; // 0 if unused
+    bool readable;
+    bool writable;
+    void* read_ptr; // NULL if accesses are ignored
+    void* write_ptr;
+    word write_mask; // Bits that can't be written are left alone
+    ioreg_read_t read; // Called instead of reading from read_ptr
+    ioreg_write_t write; // Called instead of writing to write_ptr
+    ioreg_after_write_t after_write; // Called after every write
+} ioreg_t;
+
+static ioreg_t ioregs[IOREG_SPACE];
+static const ioreg_t unused_ioreg;
+
+static void write_IF(word offset, word value, word mask) {
+    bus_state.IF.raw &= ~value; // Writing a 1 acknowledges the interrupt
+}
+
+static void write_FIFO(word offset, word value, word mask) {
+    unimplemented(mask != 0xFFFFFFFF, "Write to FIFO not all at once")
+    write_fifo(apu, offset == IO_FIFO_A ? 0 : 1, value);
+}
+
+static void write_HALTCNT(word offset, word value, word mask) {
+    if ((value & 1) == 0) {
+        logwarn("HALTING CPU!")
+        cpu->halt = true;
+    } else {
+        logfatal("Wrote to HALTCNT with bit 0 being 1")
+    }
+}
+
+// Writing a reference point also resets the internal one the PPU is drawing from
+static void BGXY_written(word offset) {
+    ppu_reference_point_written(ppu, offset < IO_BG3X ? 2 : 3, offset == IO_BG2Y || offset == IO_BG3Y);
+}
+
+// Sound being turned on starts the sample event, which stops by itself once it's turned off
+static void SOUNDCNT_X_written(word offset) {
+    if (apu->SOUNDCNT_X.master_enable && !apu->sampling) {
+        apu->sampling = true;
+        schedule_event(EVENT_AUDIO_SAMPLE, current_cycle + AUDIO_SAMPLE_CYCLES);
+    }
+}
 
-backup_type_t backup_type = UNKNOWN;
+static void DMACNT_H_written(word offset) {
+    dma_control_written((offset - IO_DMA0CNT_H) / (IO_DMA1CNT_H - IO_DMA0CNT_H));
+}
+
+INLINE int timer_for(word offset) {
+    return (offset - IO_TM0CNT_L) / (IO_TM1CNT_L - IO_TM0CNT_L);
+}
+
+static word read_TMCNT_L(word offset) {
+    return timer_counter(timer_for(offset));
+}
+
+static void write_TMCNT_L(word offset, word value, word mask) {
+    timer_write_reload(timer_for(offset), value, mask);
+}
+
+static void write_TMCNT_H(word offset, word value, word mask) {
+    timer_write_control(timer_for(offset), value, mask);
+}
+
+INLINE void map_ioreg(word offset, void* ptr) {
+    ioregs[offset].read_ptr = ptr;
+    ioregs[offset].write_ptr = ptr;
+}
+
+static void init_ioregs() {
+    for (word offset = 0; offset < IOREG_SPACE; offset++) {
+        ioreg_t* reg = &ioregs[offset];
+        reg->offset = offset;
+        reg->size = io_register_sizes[offset];
+        reg->readable = io_register_access[offset] == R || io_register_access[offset] == RW;
+        reg->writable = io_register_access[offset] == W || io_register_access[offset] == RW;
+        reg->read_ptr = NULL;
+        reg->write_ptr = NULL;
+        reg->write_mask = 0xFFFFFFFF;
+        reg->read = NULL;
+        reg->write = NULL;
+        reg->after_write = NULL;
+    }
+
+    map_ioreg(IO_DISPCNT, &ppu->DISPCNT.raw);
+    map_ioreg(IO_DISPSTAT, &ppu->DISPSTAT.raw);
+    ioregs[IO_DISPSTAT].write_mask = 0b1111111111111000; // Last 3 bits are read-only
+    ioregs[IO_VCOUNT].read_ptr = &ppu->y;
+    map_ioreg(IO_BG0CNT, &ppu->BG0CNT.raw);
+    map_ioreg(IO_BG1CNT, &ppu->BG1CNT.raw);
+    map_ioreg(IO_BG2CNT, &ppu->BG2CNT.raw);
+    map_ioreg(IO_BG3CNT, &ppu->BG3CNT.raw);
+    map_ioreg(IO_BG0HOFS, &ppu->BG0HOFS.raw);
+    map_ioreg(IO_BG1HOFS, &ppu->BG1HOFS.raw);
+    map_ioreg(IO_BG2HOFS, &ppu->BG2HOFS.raw);
+    map_ioreg(IO_BG3HOFS, &ppu->BG3HOFS.raw);
+    map_ioreg(IO_BG0VOFS, &ppu->BG0VOFS.raw);
+    map_ioreg(IO_BG1VOFS, &ppu->BG1VOFS.raw);
+    map_ioreg(IO_BG2VOFS, &ppu->BG2VOFS.raw);
+    map_ioreg(IO_BG3VOFS, &ppu->BG3VOFS.raw);
+    map_ioreg(IO_BG2PA, &ppu->BG2PA.raw);
+    map_ioreg(IO_BG2PB, &ppu->BG2PB.raw);
+    map_ioreg(IO_BG2PC, &ppu->BG2PC.raw);
+    map_ioreg(IO_BG2PD, &ppu->BG2PD.raw);
+    map_ioreg(IO_BG2X, &ppu->BG2X.raw);
+    map_ioreg(IO_BG2Y, &ppu->BG2Y.raw);
+    map_ioreg(IO_BG3PA, &ppu->BG3PA.raw);
+    map_ioreg(IO_BG3PB, &ppu->BG3PB.raw);
+    map_ioreg(IO_BG3PC, &ppu->BG3PC.raw);
+    map_ioreg(IO_BG3PD, &ppu->BG3PD.raw);
+    map_ioreg(IO_BG3X, &ppu->BG3X.raw);
+    map_ioreg(IO_BG3Y, &ppu->BG3Y.raw);
+    ioregs[IO_BG2X].after_write = BGXY_written;
+    ioregs[IO_BG2Y].after_write = BGXY_written;
+    ioregs[IO_BG3X].after_write = BGXY_written;
+    ioregs[IO_BG3Y].after_write = BGXY_written;
+    map_ioreg(IO_WIN0H, &ppu->WIN0H.raw);
+    map_ioreg(IO_WIN1H, &ppu->WIN1H.raw);
+    map_ioreg(IO_WIN0V, &ppu->WIN0V.raw);
+    map_ioreg(IO_WIN1V, &ppu->WIN1V.raw);
+    map_ioreg(IO_WININ, &ppu->WININ.raw);
+    map_ioreg(IO_WINOUT, &ppu->WINOUT.raw);
+    map_ioreg(IO_MOSAIC, &ppu->MOSAIC.raw);
+    map_ioreg(IO_BLDCNT, &ppu->BLDCNT.raw);
+    map_ioreg(IO_BLDALPHA, &ppu->BLDALPHA.raw);
+    map_ioreg(IO_BLDY, &ppu->BLDY.raw);
+
+    ioregs[IO_FIFO_A].write = write_FIFO;
+    ioregs[IO_FIFO_B].write = write_FIFO;
+    map_ioreg(IO_SOUNDCNT_H, &apu->SOUNDCNT_H.raw);
+    map_ioreg(IO_SOUNDCNT_X, &apu->SOUNDCNT_X.raw);
+    ioregs[IO_SOUNDCNT_X].write_mask = 0x80;
+    ioregs[IO_SOUNDCNT_X].after_write = SOUNDCNT_X_written;
+    map_ioreg(IO_SOUNDBIAS, &bus_state.SOUNDBIAS.raw);
+
+    map_ioreg(IO_DMA0SAD, &bus_state.DMA0SAD.raw);
+    map_ioreg(IO_DMA0DAD, &bus_state.DMA0DAD.raw);
+    map_ioreg(IO_DMA0CNT_L, &bus_state.DMA0CNT_L.raw);
+    map_ioreg(IO_DMA0CNT_H, &bus_state.DMA0CNT_H.raw);
+    map_ioreg(IO_DMA1SAD, &bus_state.DMA1SAD.raw);
+    map_ioreg(IO_DMA1DAD, &bus_state.DMA1DAD.raw);
+    map_ioreg(IO_DMA1CNT_L, &bus_state.DMA1CNT_L.raw);
+    map_ioreg(IO_DMA1CNT_H, &bus_state.DMA1CNT_H.raw);
+    map_ioreg(IO_DMA2SAD, &bus_state.DMA2SAD.raw);
+    map_ioreg(IO_DMA2DAD, &bus_state.DMA2DAD.raw);
+    map_ioreg(IO_DMA2CNT_L, &bus_state.DMA2CNT_L.raw);
+    map_ioreg(IO_DMA2CNT_H, &bus_state.DMA2CNT_H.raw);
+    map_ioreg(IO_DMA3SAD, &bus_state.DMA3SAD.raw);
+    map_ioreg(IO_DMA3DAD, &bus_state.DMA3DAD.raw);
+    map_ioreg(IO_DMA3CNT_L, &bus_state.DMA3CNT_L.raw);
+    map_ioreg(IO_DMA3CNT_H, &bus_state.DMA3CNT_H.raw);
+    ioregs[IO_DMA0CNT_H].after_write = DMACNT_H_written;
+    ioregs[IO_DMA1CNT_H].after_write = DMACNT_H_written;
+    ioregs[IO_DMA2CNT_H].after_write = DMACNT_H_written;
+    ioregs[IO_DMA3CNT_H].after_write = DMACNT_H_written;
+
+    for (int i = 0; i < 4; i++) {
+        // Reads give the current value of the counter, writes set the reload value
+        word offset = IO_TM0CNT_L + i * (IO_TM1CNT_L - IO_TM0CNT_L);
+        ioregs[offset].read = read_TMCNT_L;
+        ioregs[offset].write = write_TMCNT_L;
+        ioregs[offset + (IO_TM0CNT_H - IO_TM0CNT_L)].read_ptr = &bus_state.TMCNT_H[i].raw;
+        ioregs[offset + (IO_TM0CNT_H - IO_TM0CNT_L)].write = write_TMCNT_H;
+    }
+
+    map_ioreg(IO_KEYINPUT, &bus_state.KEYINPUT.raw);
+    map_ioreg(IO_KEYCNT, &bus_state.KEYCNT.raw);
+    map_ioreg(IO_RCNT, &bus_state.RCNT.raw);
+    map_ioreg(IO_JOYCNT, &bus_state.JOYCNT.raw);
+
+    map_ioreg(IO_IE, &bus_state.interrupt_enable.raw);
+    map_ioreg(IO_IF, &bus_state.IF.raw);
+    ioregs[IO_IF].write = write_IF;
+    map_ioreg(IO_WAITCNT, &bus_state.WAITCNT.raw);
+    map_ioreg(IO_IME, &bus_state.interrupt_master_enable.raw);
+    ioregs[IO_IME].write_mask = 0b1;
+    ioregs[IO_HALTCNT].write = write_HALTCNT;
+
+    // Everything else (sound, serial, green swap, POSTFLG, IMEM_CTRL) is accepted but ignored.
+
+    for (word offset = 0; offset < IOREG_SPACE; offset++) {
+        byte size = ioregs[offset].size;
+        if (size > 1 && offset % size != 0) {
+            ioregs[offset] = ioregs[offset - offset % size];
+        }
+    }
+}
+
+INLINE const ioreg_t* ioreg_for(word addr) {
+    word index = ioreg_index(addr);
+    return index < IOREG_SPACE ? &ioregs[index] : &unused_ioreg;
+}
+
+INLINE word access_mask(int size) {
+    return size == sizeof(word) ? 0xFFFFFFFF : (1u << (size * 8)) - 1;
+}
+
+static word read_io(word addr, int size) {
+    const ioreg_t* reg = ioreg_for(addr);
+    if (reg->size == 0) {
+        logwarn("Returning open bus (UNUSED IOREG 0x%08X)", addr)
+        return open_bus(addr) & access_mask(size);
+    }
+    if (size > reg->size) {
+        // Made up of smaller registers. If none of them can be read, it's open bus.
+        if (size == sizeof(word) && !reg->readable && !ioreg_for(addr + 2)->readable) {
+            return open_bus(addr);
+        }
+        int half_size = size / 2;
+        return read_io(addr, half_size) | (read_io(addr + half_size, half_size) << (half_size * 8));
+    }
+    if (!reg->readable) {
+        logwarn("Returning 0 (UNREADABLE BUT VALID IOREG 0x%08X)", addr)
+        return 0;
+    }
+
+    word value;
+    if (reg->read) {
+        value = reg->read(reg->offset);
+    } else if (reg->read_ptr) {
+        switch (reg->size) {
+            case sizeof(byte): value = *(byte*)reg->read_ptr; break;
+            case sizeof(half): value = *(half*)reg->read_ptr; break;
+            default: value = *(word*)reg->read_ptr; break;
+        }
+    } else {
+        logwarn("Ignoring read from ioreg 0x%03X and returning 0.", reg->offset)
+        return 0;
+    }
+    return (value >> ((addr & (reg->size - 1)) * 8)) & access_mask(size);
+}
+
+static void write_io(word addr, word value, int size) {
+    const ioreg_t* reg = ioreg_for(addr);
+    if (reg->size == 0) {
+        logwarn("Ignoring write to unused ioreg 0x%08X", addr)
+        return;
+    }
+    if (size > reg->size) {
+        int half_size = size / 2;
+        write_io(addr, value, half_size);
+        write_io(addr + half_size, value >> (half_size * 8), half_size);
+        return;
+    }
+    if (!reg->writable) {
+        logwarn("Ignoring write to unwriteable ioreg 0x%08X", addr)
+        return;
+    }
+
+    int shift = (addr & (reg->size - 1)) * 8;
+    word mask = (access_mask(size) << shift) & reg->write_mask;
+    value = (value << shift) & mask;
+    if (reg->write) {
+        reg->write(reg->offset, value, mask);
+    } else if (reg->write_ptr) {
+        switch (reg->size) {
+            case sizeof(byte): *(byte*)reg->write_ptr = (*(byte*)reg->write_ptr & ~mask) | value; break;
+            case sizeof(half): *(half*)reg->write_ptr = (*(half*)reg->write_ptr & ~mask) | value; break;
+            default: *(word*)reg->write_ptr = (*(word*)reg->write_ptr & ~mask) | value; break;
+        }
+    } else {
+        logwarn("Ignoring write to ioreg 0x%03X", reg->offset)
+    }
+    if (reg->after_write) {
+        reg->after_write(reg->offset);
+    }
+}
+
+// The host memory behind [address, address + length), if it's all plain memory in one piece
+static byte* span_ptr(mem_page_t* pages, word address, word length) {
+    word end = address + length - 1;
+    mem_page_t* page = page_for(pages, address);
+    if (!page || end < address) {
+        return NULL;
+    }
+    byte* start = page->base + (address & page->mask);
+    if ((address & page->mask) + length - 1 <= page->mask) {
+        return start; // Fits in one page, or one mirror inside of it
+    }
+    if (page->mask != MEM_PAGE_SIZE - 1) {
+        return NULL;
+    }
+    for (word next = (address | page->mask) + 1; next <= end; next += MEM_PAGE_SIZE) {
+        page = page_for(pages, next);
+        if (!page || page->mask != MEM_PAGE_SIZE - 1 || page->base != start + (next - address)) {
+            return NULL;
+        }
+    }
+    return start;
+}
+
+byte* gba_read_span(word address, word length) {
+    return span_ptr(read_pages, address, length);
+}
+
+byte* gba_write_span(word address, word length) {
+    byte* start = span_ptr(write_pages, address, length);
+    if (start) {
+        for (word code_page = address & ~((1u << CODE_PAGE_SHIFT) - 1); code_page < address + length; code_page += 1u << CODE_PAGE_SHIFT) {
+            write_ptr(code_page); // Invalidates anything cached from it
+        }
+        if (start >= ppu->vram && start < ppu->vram + VRAM_SIZE) {
+            vram_range_written(start - ppu->vram, length);
+        } else if (start >= ppu->pram && start < ppu->pram + PRAM_SIZE) {
+            pram_range_written(start - ppu->pram, length);
+        } else if (start >= ppu->oam && start < ppu->oam + OAM_SIZE) {
+            oam_written();
+        }
+    }
+    return start;
+}
 
 gbabus_t* init_gbabus() {
     bus_state.interrupt_master_enable.raw = 0;
@@ -34,37 +448,8 @@ gbabus_t* init_gbabus() {
     bus_state.DMA2INT.previously_enabled = false;
     bus_state.DMA3INT.previously_enabled = false;
 
-    // Loop through every single word aligned address in the ROM and try to find what backup type it is (you read that right)
-    // Start at 0xE4 since everything before that is part of the header
-    for (int addr = 0xE4; addr < (mem->rom_size - 4); addr += 4) {
-        if (memcmp("SRAM", &mem->rom[addr], 4) == 0) {
-            backup_type = SRAM;
-            logwarn("Determined backup type: SRAM")
-            mem->backup = malloc(SRAM_SIZE);
-            memset(mem->backup, 0, SRAM_SIZE);
-            break;
-        }
-        if (memcmp("EEPROM", &mem->rom[addr], 6) == 0) {
-            backup_type = EEPROM;
-            //logfatal("Determined backup type: EEPROM")
-            break;
-        }
-        if (memcmp("FLASH_", &mem->rom[addr], 6) == 0) {
-            backup_type = FLASH64K;
-            logfatal("Determined backup type: FLASH64K")
-            break;
-        }
-        if (memcmp("FLASH512_", &mem->rom[addr], 9) == 0) {
-            backup_type = FLASH64K;
-            logfatal("Determined backup type: FLASH64K")
-            break;
-        }
-        if (memcmp("FLASH1M_", &mem->rom[addr], 8) == 0) {
-            backup_type = FLASH128K;
-            logfatal("Determined backup type: FLASH128K")
-            break;
-        }
-    }
+    init_ioregs();
+    init_memory_map();
 
     return &bus_state;
 }
@@ -172,334 +557,6 @@ void request_interrupt(gba_interrupt_t interrupt) {
     }
 }
 
-void write_half_ioreg_masked(word addr, half value, half mask);
-void write_word_ioreg_masked(word addr, word value, word mask);
-
-void write_byte_ioreg(word addr, byte value) {
-    if (!is_ioreg_writable(addr)) {
-        logwarn("Ignoring write to unwriteable byte ioreg 0x%08X", addr)
-        return;
-    }
-    byte size = get_ioreg_size_for_addr(addr);
-    if (size == sizeof(half)) {
-        word offset = (addr % sizeof(half));
-        half shifted_value = value;
-        shifted_value <<= (offset * 8);
-        write_half_ioreg_masked(addr - offset, shifted_value, 0xFF << (offset * 8));
-    } else if (size == sizeof(word)) {
-        word offset = (addr % sizeof(word));
-        word shifted_value = value;
-        shifted_value <<= (offset * 8);
-        write_word_ioreg_masked(addr - offset, shifted_value, 0xFF << (offset * 8));
-    } else {
-        // Don't really need to do the get addr/write masked thing that the bigger ioregs do
-        // Or do I?
-        word regnum = addr & 0xFFF;
-        switch (regnum) {
-            case IO_HALTCNT: {
-                if ((value & 1) == 0) {
-                    logwarn("HALTING CPU!")
-                    cpu->halt = true;
-                } else {
-                    logfatal("Wrote to HALTCNT with bit 0 being 1")
-                }
-                break;
-            }
-            case IO_POSTFLG:
-                logwarn("Ignoring write to POSTFLG register")
-                break;
-            default:
-                logfatal("Write to unknown (but valid) byte ioreg addr 0x%08X == 0x%02X", addr, value)
-        }
-    }
-}
-
-byte read_byte_ioreg(word addr) {
-    switch (addr & 0xFFF) {
-        case IO_POSTFLG:
-            logwarn("Ignoring read from POSTFLG reg. Returning 0")
-            return 0;
-        default:
-            logfatal("Reading byte ioreg at 0x%08X", addr)
-    }
-}
-
-half* get_half_ioreg_ptr(word addr, bool write) {
-    word regnum = addr & 0xFFF;
-    switch (regnum) {
-        case IO_DISPCNT: return &ppu->DISPCNT.raw;
-        case IO_DISPSTAT: return &ppu->DISPSTAT.raw;
-        case IO_BG0CNT: return &ppu->BG0CNT.raw;
-        case IO_BG1CNT: return &ppu->BG1CNT.raw;
-        case IO_BG2CNT: return &ppu->BG2CNT.raw;
-        case IO_BG3CNT: return &ppu->BG3CNT.raw;
-        case IO_BG0HOFS: return &ppu->BG0HOFS.raw;
-        case IO_BG1HOFS: return &ppu->BG1HOFS.raw;
-        case IO_BG2HOFS: return &ppu->BG2HOFS.raw;
-        case IO_BG3HOFS: return &ppu->BG3HOFS.raw;
-        case IO_BG0VOFS: return &ppu->BG0VOFS.raw;
-        case IO_BG1VOFS: return &ppu->BG1VOFS.raw;
-        case IO_BG2VOFS: return &ppu->BG2VOFS.raw;
-        case IO_BG3VOFS: return &ppu->BG3VOFS.raw;
-        case IO_BG2PA: return &ppu->BG2PA.raw;
-        case IO_BG2PB: return &ppu->BG2PB.raw;
-        case IO_BG2PC: return &ppu->BG2PC.raw;
-        case IO_BG2PD: return &ppu->BG2PD.raw;
-        case IO_BG3PA: return &ppu->BG3PA.raw;
-        case IO_BG3PB: return &ppu->BG3PB.raw;
-        case IO_BG3PC: return &ppu->BG3PC.raw;
-        case IO_BG3PD: return &ppu->BG3PD.raw;
-        case IO_WIN0H: return &ppu->WIN0H.raw;
-        case IO_WIN1H: return &ppu->WIN1H.raw;
-        case IO_WIN0V: return &ppu->WIN0V.raw;
-        case IO_WIN1V: return &ppu->WIN1V.raw;
-        case IO_WININ: return &ppu->WININ.raw;
-        case IO_WINOUT: return &ppu->WINOUT.raw;
-        case IO_MOSAIC: return &ppu->MOSAIC.raw;
-        case IO_BLDCNT: return &ppu->BLDCNT.raw;
-        case IO_BLDALPHA: return &ppu->BLDALPHA.raw;
-        case IO_BLDY: return &ppu->BLDY.raw;
-        case IO_IE: return &bus_state.interrupt_enable.raw;
-        case IO_DMA0CNT_L: return &bus_state.DMA0CNT_L.raw;
-        case IO_DMA0CNT_H: return &bus_state.DMA0CNT_H.raw;
-        case IO_DMA1CNT_L: return &bus_state.DMA1CNT_L.raw;
-        case IO_DMA1CNT_H: return &bus_state.DMA1CNT_H.raw;
-        case IO_DMA2CNT_L: return &bus_state.DMA2CNT_L.raw;
-        case IO_DMA2CNT_H: return &bus_state.DMA2CNT_H.raw;
-        case IO_DMA3CNT_L: return &bus_state.DMA3CNT_L.raw;
-        case IO_DMA3CNT_H: return &bus_state.DMA3CNT_H.raw;
-        case IO_KEYINPUT: return &bus_state.KEYINPUT.raw;
-        case IO_RCNT: return &bus_state.RCNT.raw;
-        case IO_JOYCNT: return &bus_state.JOYCNT.raw;
-        case IO_IME: return &bus_state.interrupt_master_enable.raw;
-        case IO_SOUNDBIAS: return &bus_state.SOUNDBIAS.raw;
-        case IO_TM0CNT_L: {
-            if (write) {
-                return &bus_state.TMCNT_L[0].raw;
-            } else {
-                return &bus_state.TMINT[0].value;
-            }
-        }
-        case IO_TM0CNT_H: return &bus_state.TMCNT_H[0].raw;
-        case IO_TM1CNT_L: {
-            if (write) {
-                return &bus_state.TMCNT_L[1].raw;
-            } else {
-                return &bus_state.TMINT[1].value;
-            }
-        }
-        case IO_TM1CNT_H: return &bus_state.TMCNT_H[1].raw;
-        case IO_TM2CNT_L: {
-            if (write) {
-                return &bus_state.TMCNT_L[2].raw;
-            } else {
-                return &bus_state.TMINT[2].value;
-            }
-        }
-        case IO_TM2CNT_H: return &bus_state.TMCNT_H[2].raw;
-        case IO_TM3CNT_L: {
-            if (write) {
-                return &bus_state.TMCNT_L[3].raw;
-            } else {
-                return &bus_state.TMINT[3].value;
-            }
-        }
-        case IO_TM3CNT_H: return &bus_state.TMCNT_H[3].raw;
-        case IO_KEYCNT: return &bus_state.KEYCNT.raw;
-        case IO_IF: return &bus_state.IF.raw;
-        case IO_WAITCNT:
-            return &bus_state.WAITCNT.raw;
-        case IO_UNDOCUMENTED_GREEN_SWAP:
-            logwarn("Ignoring access to Green Swap register")
-            return NULL;
-        case IO_VCOUNT: return &ppu->y;
-        case IO_SOUND1CNT_L:
-        case IO_SOUND1CNT_H:
-        case IO_SOUND1CNT_X:
-        case IO_SOUND2CNT_L:
-        case IO_SOUND2CNT_H:
-        case IO_SOUND3CNT_L:
-        case IO_SOUND3CNT_H:
-        case IO_SOUND3CNT_X:
-        case IO_SOUND4CNT_L:
-        case IO_SOUND4CNT_H:
-        case IO_SOUNDCNT_L:
-        case IO_SOUNDCNT_H:
-        case IO_SOUNDCNT_X:
-        case WAVE_RAM0_L:
-        case WAVE_RAM0_H:
-        case WAVE_RAM1_L:
-        case WAVE_RAM1_H:
-        case WAVE_RAM2_L:
-        case WAVE_RAM2_H:
-        case WAVE_RAM3_L:
-        case WAVE_RAM3_H:
-            logwarn("Ignoring access to sound register: 0x%03X", regnum)
-            return NULL;
-
-        case IO_SIOCNT:
-        case IO_SIOMULTI0:
-        case IO_SIOMULTI1:
-        case IO_SIOMULTI2:
-        case IO_SIOMULTI3:
-        case IO_SIOMLT_SEND:
-        case IO_JOY_RECV:
-        case IO_JOY_TRANS:
-        case IO_JOYSTAT:
-            logwarn("Ignoring access to SIO register: 0x%03X", regnum)
-            return NULL;
-
-        default:
-            logfatal("Access to unknown (but valid) half ioreg addr 0x%08X", addr)
-    }
-}
-
-void write_half_ioreg_masked(word addr, half value, half mask) {
-    half* ioreg = get_half_ioreg_ptr(addr, true);
-    if (ioreg) {
-        switch (addr & 0xFFF) {
-            case IO_DISPSTAT:
-                mask &= 0b1111111111111000; // Last 3 bits are read-only
-                break;
-            case IO_IME:
-                mask = 0b1;
-                break;
-            case IO_IF: {
-                bus_state.IF.raw &= ~value;
-                return;
-            }
-            default:
-                break; // No special case
-        }
-        *ioreg &= (~mask);
-        *ioreg |= (value & mask);
-        switch (addr & 0xFFF) {
-            case IO_DMA0CNT_H:
-                if (!bus_state.DMA0CNT_H.dma_enable) {
-                    bus_state.DMA0INT.previously_enabled = false;
-                }
-                break;
-            case IO_DMA1CNT_H:
-                if (!bus_state.DMA1CNT_H.dma_enable) {
-                    bus_state.DMA1INT.previously_enabled = false;
-                }
-                break;
-            case IO_DMA2CNT_H:
-                if (!bus_state.DMA2CNT_H.dma_enable) {
-                    bus_state.DMA2INT.previously_enabled = false;
-                }
-                break;
-            case IO_DMA3CNT_H:
-                if (!bus_state.DMA3CNT_H.dma_enable) {
-                    bus_state.DMA3INT.previously_enabled = false;
-                }
-                break;
-        }
-    } else {
-        logwarn("Ignoring write to half ioreg 0x%08X", addr)
-    }
-}
-
-void write_half_ioreg(word addr, half value) {
-    if (!is_ioreg_writable(addr)) {
-        logwarn("Ignoring write to unwriteable half ioreg 0x%08X", addr)
-        return;
-    }
-    // Write to the whole thing
-    write_half_ioreg_masked(addr, value, 0xFFFF);
-}
-
-word* get_word_ioreg_ptr(word addr) {
-    unimplemented(get_ioreg_size_for_addr(addr) != sizeof(word), "Trying to get the address of a wrong-sized word ioreg")
-    switch (addr & 0xFFF) {
-        case IO_BG2X:     return &ppu->BG2X.raw;
-        case IO_BG2Y:     return &ppu->BG2Y.raw;
-        case IO_BG3X:     return &ppu->BG3X.raw;
-        case IO_BG3Y:     return &ppu->BG3Y.raw;
-        case IO_DMA0SAD:  return &bus_state.DMA0SAD.raw;
-        case IO_DMA0DAD:  return &bus_state.DMA0DAD.raw;
-        case IO_DMA1SAD:  return &bus_state.DMA1SAD.raw;
-        case IO_DMA1DAD:  return &bus_state.DMA1DAD.raw;
-        case IO_DMA2SAD:  return &bus_state.DMA2SAD.raw;
-        case IO_DMA2DAD:  return &bus_state.DMA2DAD.raw;
-        case IO_DMA3SAD:  return &bus_state.DMA3SAD.raw;
-        case IO_DMA3DAD:  return &bus_state.DMA3DAD.raw;
-        case IO_FIFO_A:
-        case IO_FIFO_B:
-        case IO_JOY_RECV:
-        case IO_JOY_TRANS:
-        case IO_IMEM_CTRL:
-            return NULL;
-        default: logfatal("Tried to get the address of an unknown (but valid) word ioreg addr: 0x%08X", addr)
-    }
-}
-
-void write_word_ioreg_masked(word addr, word value, word mask) {
-    switch (addr & 0xFFF) {
-        case IO_FIFO_A:
-            unimplemented(mask != 0xFFFFFFFF, "Write to FIFO not all at once")
-            write_fifo(apu, 0, value);
-            break;
-        case IO_FIFO_B:
-            unimplemented(mask != 0xFFFFFFFF, "Write to FIFO not all at once")
-            write_fifo(apu, 1, value);
-            break;
-        default:
-            if (!is_ioreg_writable(addr)) {
-                logwarn("Ignoring write to unwriteable word ioreg 0x%08X", addr)
-                return;
-            }
-            word* ioreg = get_word_ioreg_ptr(addr);
-            if (ioreg) {
-                *ioreg &= (~mask);
-                *ioreg |= (value & mask);
-            } else {
-                logwarn("Ignoring write to word ioreg 0x%08X with mask 0x%08X", addr, mask)
-            }
-    }
-}
-
-void write_word_ioreg(word addr, word value) {
-    // 0x04XX0800 is the only address that's mirrored.
-    if ((addr & 0xFF00FFFFu) == 0x04000800u) {
-        addr = 0x04000800;
-    }
-
-    if (!is_ioreg_writable(addr)) {
-        logwarn("Ignoring write to unwriteable word ioreg 0x%08X", addr)
-    }
-
-    write_word_ioreg_masked(addr, value, 0xFFFFFFFF);
-}
-
-word read_word_ioreg(word addr) {
-    if (!is_ioreg_readable(addr)) {
-        logwarn("Returning 0 (UNREADABLE BUT VALID WORD IOREG 0x%08X)", addr)
-        return 0;
-    }
-    word* ioreg = get_word_ioreg_ptr(addr);
-    if (ioreg) {
-        return *ioreg;
-    } else {
-        logwarn("Ignoring read from word ioreg at 0x%08X and returning 0.", addr)
-        return 0;
-    }
-}
-
-half read_half_ioreg(word addr) {
-    if (!is_ioreg_readable(addr)) {
-        logwarn("Returning 0 (UNREADABLE BUT VALID HALF IOREG 0x%08X)", addr)
-        return 0;
-    }
-    half* ioreg = get_half_ioreg_ptr(addr, false);
-    if (ioreg) {
-        return *ioreg;
-    } else {
-        logwarn("Ignoring read from half ioreg at 0x%08X and returning 0.", addr)
-        return 0;
-    }
-}
-
 bool is_open_bus(word address) {
     switch (address >> 24) {
         case 0x0:
@@ -513,20 +570,17 @@ bool is_open_bus(word address) {
         case 0x6:
         case 0x7:
         case 0x8:
-            return false;
         case 0x9:
         case 0xA:
         case 0xB:
         case 0xC:
-            return (address & 0x1FFFFFF) >= mem->rom_size;
         case 0xD:
-            unimplemented(backup_type == EEPROM, "This region is different when the backup type is EEPROM")
-            return (address & 0x1FFFFFF) >= mem->rom_size;
+            return false; // EEPROM, or the ROM. All of it, gbarom_read_byte() takes care of what's past its end.
         case 0xE:
-            if (backup_type == FLASH64K || backup_type == FLASH128K) {
-                return (address & 0x1FFFFFF) >= mem->rom_size;
-            } else if (backup_type == EEPROM || backup_type == SRAM) {
+            if (backup_type == FLASH64K || backup_type == FLASH128K || backup_type == SRAM) {
                 return false;
+            } else if (backup_type == EEPROM) {
+                return true;
             } else {
                 logfatal("Unknown backup type %d", backup_type)
             }
@@ -567,7 +621,7 @@ word open_bus(word addr) {
     return result;
 }
 
-byte gba_read_byte(word addr) {
+static byte read_byte_slow(word addr) {
     addr &= ~(sizeof(byte) - 1);
     if (addr < GBA_BIOS_SIZE) { // BIOS
         return gbabios_read_byte(addr);
@@ -579,32 +633,8 @@ byte gba_read_byte(word addr) {
     } else if (addr < 0x04000000) { // IWRAM
         word index = (addr - 0x03000000) % 0x8000;
         return mem->iwram[index];
-    } else if (addr < 0x04000400) {
-        byte size = get_ioreg_size_for_addr(addr);
-        if (size == 0) {
-            logwarn("Returning open bus (UNUSED BYTE IOREG 0x%08X)", addr)
-            return open_bus(addr);
-        } else if (size == sizeof(half)) {
-            int ofs = addr % 2;
-            half* ioreg = get_half_ioreg_ptr(addr - ofs, false);
-            if (ioreg) {
-                return (*ioreg >> ofs) & 0xFF;
-            } else {
-                logwarn("Ignoring read from half ioreg 0x%08X", addr - ofs)
-                return 0;
-            }
-        }
-        else if (size > sizeof(byte)) {
-            logfatal("Reading from too-large ioreg (%d) as byte at 0x%08X", size, addr)
-        }
-        if (!is_ioreg_readable(addr)) {
-            logwarn("Returning 0 (UNREADABLE BUT VALID BYTE IOREG 0x%08X)", addr)
-            return 0;
-        }
-        return read_byte_ioreg(addr);
     } else if (addr < 0x05000000) {
-        logwarn("Tried to read from 0x%08X", addr)
-        return open_bus(addr);
+        return read_io(addr, sizeof(byte));
     } else if (addr < 0x06000000) { // Palette RAM
         word index = (addr - 0x5000000) % 0x400;
         return ppu->pram[index];
@@ -616,62 +646,34 @@ byte gba_read_byte(word addr) {
         word index = addr - 0x07000000;
         index %= OAM_SIZE;
         return ppu->oam[index];
-    } else if (addr < 0x08000000 + mem->rom_size) {
-        return mem->rom[addr - 0x08000000];
-    } else if (addr < 0x10000000) {
-        // Backup space
-        switch (backup_type) {
-            case SRAM:
-                return mem->backup[addr & 0x7FFF];
-            case UNKNOWN:
-                logwarn("Tried to access backup when backup type unknown!")
-                return 0;
-            case EEPROM:
-                logfatal("Backup type EEPROM unimplemented!")
-            case FLASH64K:
-                logfatal("Backup type FLASH64K unimplemented!")
-            case FLASH128K: {
-                if (addr == 0x0E000000) {
-                    return 0x62; // Stubbing flash
-                } else if (addr == 0x0E000001) {
-                    return 0x13; // Stubbing flash
-                }
-                logfatal("Backup type FLASH128K unimplemented!")
-            }
-            default:
-                logfatal("Unknown backup type index %d!", backup_type)
-        }
+    } else if (addr < 0x0E000000) {
+        return gbarom_read_byte(addr);
+    } else if ((addr >> 24) >= 0xE && addr < 0x10000000) {
+        return backup_read_byte(addr);
     }
 
     return open_bus(addr);
 }
 
-half gba_read_half(word address) {
+static half read_half_slow(word address) {
     address &= ~(sizeof(half) - 1);
     if (is_ioreg(address)) {
-        byte ioreg_size = get_ioreg_size_for_addr(address);
-        unimplemented(ioreg_size > sizeof(half), "Reading from a too-large ioreg from gba_read_half")
-        if (ioreg_size == sizeof(half)) {
-            return read_half_ioreg(address);
-        } else if (!is_ioreg_readable(address & ~(sizeof(word) - 1))) {
-            return open_bus(address);
-        } else if (ioreg_size == 0) {
-            // Unused io register
-            logwarn("Read from unused half size ioregister!")
-            return 0;
-        }
+        return read_io(address, sizeof(half));
+    }
+    if (backup_type == EEPROM && (address >> 24) == 0xD) {
+        return eeprom_read();
     }
 
     if (is_open_bus(address)) {
         return open_bus(address);
     }
-    byte lower = gba_read_byte(address);
-    byte upper = gba_read_byte(address + 1);
+    byte lower = read_byte_slow(address);
+    byte upper = read_byte_slow(address + 1);
 
     return (upper << 8u) | lower;
 }
 
-void gba_write_byte(word addr, byte value) {
+static void write_byte_slow(word addr, byte value) {
     addr &= ~(sizeof(byte) - 1);
     if (addr < GBA_BIOS_SIZE) {
         logwarn("Tried to write to the BIOS!")
@@ -680,137 +682,144 @@ void gba_write_byte(word addr, byte value) {
     } else if (addr < 0x03000000) { // EWRAM
         word index = (addr - 0x02000000) % 0x40000;
         mem->ewram[index] = value;
+        ewram_code_write(cpu, index);
     } else if (addr < 0x04000000) { // IWRAM
         word index = (addr - 0x03000000) % 0x8000;
         mem->iwram[index] = value;
-    } else if (addr < 0x04000400) {
-        write_byte_ioreg(addr, value);
+        iwram_code_write(cpu, index);
     } else if (addr < 0x05000000) {
-        logwarn("Tried to write to 0x%08X", addr)
+        cpu->exit_block = true;
+        write_io(addr, value, sizeof(byte));
     } else if (addr < 0x06000000) { // Palette RAM
         word index = (addr - 0x5000000) % 0x400;
         ppu->pram[index] = value;
+        pram_written(index);
     } else if (addr < 0x07000000) {
         word index = addr & 0x1FFFF;
         if (index > 0x17FFF) {
             index -= 0x8000;
         }
         ppu->vram[index] = value;
+        vram_written(index);
     } else if (addr < 0x08000000) {
         word index = addr - 0x07000000;
         index %= OAM_SIZE;
         ppu->oam[index] = value;
-    } else if (addr < 0x08000000 + mem->rom_size) {
+        oam_written();
+    } else if (addr < 0x0E000000) {
         logwarn("Ignoring write to valid cartridge address 0x%08X!", addr)
     } else if ((addr >> 24) >= 0xE && addr < 0x10000000) {
-        // Backup space
-        switch (backup_type) {
-            case SRAM:
-                mem->backup[addr & 0x7FFF] = value;
-                break;
-            case UNKNOWN:
-                logfatal("Tried to access backup when backup type unknown!")
-            case EEPROM:
-                logfatal("Backup type EEPROM unimplemented!")
-            case FLASH64K:
-                logfatal("Backup type FLASH64K unimplemented!")
-            case FLASH128K:
-                logfatal("Backup type FLASH128K unimplemented!")
-            default:
-                logfatal("Unknown backup type index %d!", backup_type)
-        }
+        backup_write_byte(addr, value);
     }
 }
 
-void gba_write_half(word address, half value) {
+static void write_half_slow(word address, half value) {
     address &= ~(sizeof(half) - 1);
     if (is_ioreg(address)) {
-        byte ioreg_size = get_ioreg_size_for_addr(address);
-        if (ioreg_size == sizeof(word)) {
-            word offset = (address % sizeof(word));
-            word shifted_value = value;
-            shifted_value <<= (offset * 8);
-            write_word_ioreg_masked(address - offset, shifted_value, 0xFFFF << (offset * 8));
-        } else if (ioreg_size == sizeof(half)) {
-            write_half_ioreg(address, value);
-            return;
-        } else if (ioreg_size == 0) {
-            // Unused io register
-            logwarn("Unused half size ioregister 0x%08X", address)
-            return;
-        }
+        cpu->exit_block = true;
+        write_io(address, value, sizeof(half));
+        return;
+    }
+    if (backup_type == EEPROM && (address >> 24) == 0xD) {
+        eeprom_write(value);
+        return;
     }
 
     byte lower = value & 0xFFu;
     byte upper = (value & 0xFF00u) >> 8u;
-    gba_write_byte(address, lower);
-    gba_write_byte(address + 1, upper);
+    write_byte_slow(address, lower);
+    write_byte_slow(address + 1, upper);
 }
 
-word gba_read_word(word address) {
+static word read_word_slow(word address) {
     address &= ~(sizeof(word) - 1);
 
     if (is_ioreg(address)) {
-        byte ioreg_size = get_ioreg_size_for_addr(address);
-        if(ioreg_size == sizeof(word)) {
-            return read_word_ioreg(address);
-        } else if (ioreg_size == 0) {
-            return open_bus(address);
-        } else if (!is_ioreg_readable(address)
-                   && !is_ioreg_readable(address + 1)
-                   && !is_ioreg_readable(address + 2)
-                   && !is_ioreg_readable(address + 3)) {
-            return open_bus(address);
-        }
-        // Otherwise, it'll be smaller than a word, and we'll read each part from the respective registers.
+        return read_io(address, sizeof(word));
     }
     if (is_open_bus(address)) {
         return open_bus(address);
     }
-    word lower = gba_read_half(address);
-    word upper = gba_read_half(address + 2);
+    word lower = read_half_slow(address);
+    word upper = read_half_slow(address + 2);
 
     return (upper << 16u) | lower;
 }
 
-void gba_write_word(word address, word value) {
+static void write_word_slow(word address, word value) {
     address &= ~(sizeof(word) - 1);
     if (is_ioreg(address)) {
-        byte ioreg_size = get_ioreg_size_for_addr(address);
-        if(ioreg_size == sizeof(word)) {
-            write_word_ioreg(address, value);
-        } else if (ioreg_size == 0) {
-            logwarn("Unused word size ioregister!")
-            // Unused io register
-            return;
-        }
-        // Otherwise, it'll be smaller than a word, and we'll write each part to the respective registers.
+        cpu->exit_block = true;
+        write_io(address, value, sizeof(word));
+        return;
     }
 
     half lower = (value & 0xFFFFu);
     half upper = (value & 0xFFFF0000u) >> 16u;
 
-    gba_write_half(address, lower);
-    gba_write_half(address + 2, upper);
+    write_half_slow(address, lower);
+    write_half_slow(address + 2, upper);
 }
 
-int gba_dma() {
-    // Run one cycle of the highest priority DMA.
-    int dma_cycles = dma(0, &bus_state.DMA0CNT_H, &bus_state.DMA0INT, bus_state.DMA0SAD.addr, bus_state.DMA0DAD.addr, bus_state.DMA0CNT_L.wc, 0x4000);
+byte gba_read_byte(word addr) {
+    byte* ptr = read_ptr(addr);
+    return ptr ? *ptr : read_byte_slow(addr);
+}
 
-    if (dma_cycles == 0) {
-        dma_cycles = dma(1, &bus_state.DMA1CNT_H, &bus_state.DMA1INT, bus_state.DMA1SAD.addr, bus_state.DMA1DAD.addr, bus_state.DMA1CNT_L.wc, 0x4000);
+half gba_read_half(word address) {
+    address &= ~(sizeof(half) - 1);
+    byte* ptr = read_ptr(address);
+    if (ptr) {
+        half value;
+        memcpy(&value, ptr, sizeof(value));
+        return value;
     }
+    return read_half_slow(address);
+}
 
-    if (dma_cycles == 0) {
-        dma_cycles = dma(2, &bus_state.DMA2CNT_H, &bus_state.DMA2INT, bus_state.DMA2SAD.addr, bus_state.DMA2DAD.addr, bus_state.DMA2CNT_L.wc, 0x4000);
+word gba_read_word(word address) {
+    address &= ~(sizeof(word) - 1);
+    byte* ptr = read_ptr(address);
+    if (ptr) {
+        word value;
+        memcpy(&value, ptr, sizeof(value));
+        return value;
     }
+    return read_word_slow(address);
+}
 
-    if (dma_cycles == 0) {
-        dma_cycles = dma(3, &bus_state.DMA3CNT_H, &bus_state.DMA3INT, bus_state.DMA3SAD.addr, bus_state.DMA3DAD.addr, bus_state.DMA3CNT_L.wc, 0x10000);
+void gba_write_byte(word addr, byte value) {
+    // Byte writes to video memory are rare, they all go through the slow path and get marked there
+    mem_page_t* page = page_for(write_pages, addr);
+    if (page && (page->vram || page->pram || page->oam)) {
+        write_byte_slow(addr, value);
+        return;
+    }
+    byte* ptr = write_ptr(addr);
+    if (ptr) {
+        *ptr = value;
+    } else {
+        write_byte_slow(addr, value);
     }
+}
 
-    dma_done_hook();
+void gba_write_half(word address, half value) {
+    address &= ~(sizeof(half) - 1);
+    byte* ptr = write_ptr(address);
+    if (ptr) {
+        memcpy(ptr, &value, sizeof(value));
+    } else {
+        write_half_slow(address, value);
+    }
+}
 
-    return dma_cycles;
+void gba_write_word(word address, word value) {
+    address &= ~(sizeof(word) - 1);
+    byte* ptr = write_ptr(address);
+    if (ptr) {
+        memcpy(ptr, &value, sizeof(value));
+    } else {
+        write_word_slow(address, value);
+    }
 }
+
@@ -134,9 +134,8 @@ typedef union TMCNT_L {
 }TMCNT_L_t;
 
 typedef struct TMINT {
-    half value;
-    half ticks;
-    bool previously_enabled;
+    half value; // Counter value at start. Cascaded and stopped timers keep their current value here.
+    uint64_t start;
 } TMINT_t;
 
 typedef union TMCNT_H {
@@ -153,6 +152,19 @@ typedef union TMCNT_H {
 
 typedef union WAITCNT {
     half raw;
+    struct {
+        unsigned sram_wait:2;
+        unsigned ws0_n:2;
+        unsigned ws0_s:1;
+        unsigned ws1_n:2;
+        unsigned ws1_s:1;
+        unsigned ws2_n:2;
+        unsigned ws2_s:1;
+        unsigned phi_terminal_output:2;
+        unsigned:1;
+        bool prefetch:1;
+        bool cgb:1;
+    };
 } WAITCNT_t;
 
 typedef union IF {
@@ -229,7 +241,10 @@ void gba_write_byte(word addr, byte value);
 void gba_write_half(word address, half value);
 word gba_read_word(word address);
 void gba_write_word(word address, word value);
-int gba_dma();
+// Where [address, address + length) is in host memory, or NULL if it isn't all plain memory laid out in one piece.
+// gba_write_span() invalidates any code cached from the range.
+byte* gba_read_span(word address, word length);
+byte* gba_write_span(word address, word length);
 
 void request_interrupt(gba_interrupt_t interrupt);
 #endif
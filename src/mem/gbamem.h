@@ -15,9 +15,9 @@
 typedef struct gbamem {
     byte* rom;
     size_t rom_size;
+    word rom_mask; // rom is padded out to rom_mask + 1 bytes, a power of two
     byte ewram[EWRAM_SIZE];
     byte iwram[IWRAM_SIZE];
-    byte* backup;
 } gbamem_t;
 
 gbamem_t* init_mem();
@@ -1,17 +1,93 @@
-#include <stdlib.h>
-#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include "gbarom.h"
 #include "../gba_system.h"
+#include "../common/log.h"
+
+// Smaller ROMs are padded out to this, so the bus can map them a whole page at a time like everything else
+#define ROM_MIN_SIZE 0x10000
+
+// The ROM and its padding, anonymous memory with the file mapped over the start of it
+static byte* rom_mapping = NULL;
+static size_t rom_mapping_size = 0;
+
+// Reading past the end of the ROM gives back what's left on the game pak bus: each halfword's address / 2
+INLINE byte past_end_byte(word address) {
+    return (address >> 1) >> ((address & 1) * 8);
+}
+
+static void fill_past_end(byte* rom, size_t start, size_t end) {
+    for (size_t address = start; address < end; address++) {
+        rom[address] = past_end_byte(address);
+    }
+}
+
+byte gbarom_read_byte(word address) {
+    address &= ROM_MAX_SIZE - 1;
+    return address <= mem->rom_mask ? mem->rom[address] : past_end_byte(address);
+}
+
+// Unmaps the ROM loaded last, if there was one
+static void unmap_rom() {
+    if (rom_mapping) {
+        munmap(rom_mapping, rom_mapping_size);
+    }
+    rom_mapping = NULL;
+    rom_mapping_size = 0;
+}
 
 void load_gbarom(const char* filename) {
-    FILE *fp = fopen(filename, "rb");
+    unmap_rom();
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        logfatal("Failed to open ROM %s: %s", filename, strerror(errno))
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        logfatal("Failed to stat ROM %s: %s", filename, strerror(errno))
+    }
+    size_t size = st.st_size;
+    if (size == 0 || size > ROM_MAX_SIZE) {
+        logfatal("ROM %s is %zu bytes, it has to be between 1 and %d", filename, size, ROM_MAX_SIZE)
+    }
+
+    size_t padded_size = ROM_MIN_SIZE;
+    while (padded_size < size) {
+        padded_size <<= 1;
+    }
+
+    // Reserve the padded size, then map the file over the start of it. The file is mapped read only and private,
+    // so it's never copied: every process running the same ROM shares the page cache's pages.
+    byte* rom = mmap(NULL, padded_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (rom == MAP_FAILED) {
+        logfatal("Failed to reserve %zu bytes for the ROM: %s", padded_size, strerror(errno))
+    }
+    if (mmap(rom, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        logfatal("Failed to map ROM %s: %s", filename, strerror(errno))
+    }
+    close(fd);
 
-    fseek(fp, 0, SEEK_END);
-    size_t size = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
-    byte *buf = malloc(size);
-    fread(buf, size, 1, fp);
+    if (padded_size > size) {
+        // The part of the last page of the file past its end has to be written to as well. That one page gets copied.
+        size_t host_page_size = sysconf(_SC_PAGESIZE);
+        size_t last_page = size & ~(host_page_size - 1);
+        if (mprotect(rom + last_page, padded_size - last_page, PROT_READ | PROT_WRITE) != 0) {
+            logfatal("Failed to pad the ROM: %s", strerror(errno))
+        }
+        fill_past_end(rom, size, padded_size);
+        mprotect(rom + last_page, padded_size - last_page, PROT_READ);
+    }
 
-    mem->rom = buf;
+    rom_mapping = rom;
+    rom_mapping_size = padded_size;
+    mem->rom = rom;
     mem->rom_size = size;
+    mem->rom_mask = padded_size - 1;
 }
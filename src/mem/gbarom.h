@@ -5,6 +5,12 @@
 #include "../common/util.h"
 #include "gbamem.h"
 
+// The size of each of the three ROM windows on the bus
+#define ROM_MAX_SIZE 0x2000000
+
+// Maps the ROM, and unmaps the one loaded before it
 void load_gbarom(const char* filename);
+// Anywhere in a ROM window. Only the padded ROM is mapped, everything after it is worked out the same way.
+byte gbarom_read_byte(word address);
 
 #endif
@@ -419,38 +419,4 @@ ioreg_access_t io_register_access[] = {
         // 4,4,4,4, // 0x4xx0800      R/W  ?         Mirrors of 0x4000800 (repeated each 64K)
 };
 
-byte get_ioreg_size_for_addr(word address) {
-    word mirrored = mirror_ioreg(address);
-    if (mirrored >= 0x4000804) {
-        return 0;
-    }
-    else {
-        return io_register_sizes[ioreg_index(mirrored)];
-    }
-}
-
-bool is_ioreg_readable(word address) {
-    word mirrored = mirror_ioreg(address);
-    if (mirrored >= 0x4000804) {
-        return false;
-    }
-    else {
-        ioreg_access_t access = io_register_access[ioreg_index(mirrored)];
-        return access == R || access == RW;
-    }
-}
-
-
-bool is_ioreg_writable(word address) {
-    word mirrored = mirror_ioreg(address);
-    if (mirrored >= 0x4000804) {
-        return false;
-    }
-    else {
-        ioreg_access_t access = io_register_access[ioreg_index(mirrored)];
-        return access == W || access == RW;
-    }
-}
-
-
 #endif //GBA_IOREG_UTIL_H
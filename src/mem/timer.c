@@ -0,0 +1,120 @@
+#include "timer.h"
+#include "../gba_system.h"
+#include "../scheduler.h"
+#include "dma.h"
+
+// Timers count once every 1 << shift cycles
+static const int timer_shift[4] = {0, 6, 8, 10};
+
+// Cascaded timers only count when the one before them overflows. Timer 0 can't be cascaded.
+INLINE bool counts_by_itself(int n) {
+    return bus->TMCNT_H[n].start && (n == 0 || !bus->TMCNT_H[n].cascade);
+}
+
+INLINE bool cascades_into_next(int n) {
+    return n < 3 && bus->TMCNT_H[n + 1].start && bus->TMCNT_H[n + 1].cascade;
+}
+
+// Does anything see this timer overflow? Timers 0 and 1 drive DMA sound.
+INLINE bool overflow_visible(int n) {
+    return bus->TMCNT_H[n].timer_irq_enable || n <= 1 || cascades_into_next(n);
+}
+
+INLINE uint64_t overflow_time(int n) {
+    TMINT_t* timer = &bus->TMINT[n];
+    return timer->start + ((uint64_t)(0x10000 - timer->value) << timer_shift[bus->TMCNT_H[n].frequency]);
+}
+
+half timer_counter(int n) {
+    TMINT_t* timer = &bus->TMINT[n];
+    if (!counts_by_itself(n)) {
+        return timer->value;
+    }
+    uint64_t count = timer->value + ((current_cycle - timer->start) >> timer_shift[bus->TMCNT_H[n].frequency]);
+    if (count <= 0xFFFF) {
+        return count;
+    }
+    // Overflowed since then without anyone looking, starting again from the reload value every time
+    word reload = bus->TMCNT_L[n].timer_reload;
+    return reload + (count - 0x10000) % (0x10000 - reload);
+}
+
+// Makes the timer's value and start time current, keeping the prescaler where it was
+static void catch_up(int n) {
+    if (counts_by_itself(n)) {
+        TMINT_t* timer = &bus->TMINT[n];
+        int shift = timer_shift[bus->TMCNT_H[n].frequency];
+        uint64_t ticks = (current_cycle - timer->start) >> shift;
+        timer->value = timer_counter(n);
+        timer->start += ticks << shift;
+    }
+}
+
+static void schedule_next_overflow() {
+    uint64_t next = UINT64_MAX;
+    for (int n = 0; n < 4; n++) {
+        if (counts_by_itself(n) && overflow_visible(n)) {
+            uint64_t time = overflow_time(n);
+            if (time < next) {
+                next = time;
+            }
+        }
+    }
+    if (next == UINT64_MAX) {
+        cancel_event(EVENT_TIMER_OVERFLOW);
+    } else {
+        schedule_event(EVENT_TIMER_OVERFLOW, next);
+    }
+}
+
+static void timer_overflowed(int n) {
+    if (bus->TMCNT_H[n].timer_irq_enable) {
+        request_interrupt(IRQ_TIMER0 + n);
+    }
+    if (n <= 1) {
+        sound_timer_overflow(apu, n);
+        dma_start_trigger(Special);
+    }
+    if (cascades_into_next(n)) {
+        TMINT_t* next = &bus->TMINT[n + 1];
+        if (next->value == 0xFFFF) {
+            next->value = bus->TMCNT_L[n + 1].timer_reload;
+            timer_overflowed(n + 1);
+        } else {
+            next->value++;
+        }
+    }
+}
+
+void timer_overflow_event(uint64_t time) {
+    for (int n = 0; n < 4; n++) {
+        if (counts_by_itself(n) && overflow_visible(n) && overflow_time(n) <= time) {
+            TMINT_t* timer = &bus->TMINT[n];
+            timer->start = overflow_time(n);
+            timer->value = bus->TMCNT_L[n].timer_reload;
+            timer_overflowed(n);
+        }
+    }
+    schedule_next_overflow();
+}
+
+void timer_write_reload(int n, half value, half mask) {
+    catch_up(n); // The reload value is used for overflows that haven't been seen yet
+    bus->TMCNT_L[n].raw = (bus->TMCNT_L[n].raw & ~mask) | value;
+}
+
+void timer_write_control(int n, half value, half mask) {
+    // Changing this timer can change which of the others' overflows are seen, catch them all up first
+    for (int i = 0; i < 4; i++) {
+        catch_up(i);
+    }
+    TMCNT_H_t old = bus->TMCNT_H[n];
+    bus->TMCNT_H[n].raw = (bus->TMCNT_H[n].raw & ~mask) | value;
+    if (!old.start && bus->TMCNT_H[n].start) {
+        bus->TMINT[n].value = bus->TMCNT_L[n].timer_reload;
+        bus->TMINT[n].start = current_cycle;
+    } else if (old.frequency != bus->TMCNT_H[n].frequency || old.cascade != bus->TMCNT_H[n].cascade) {
+        bus->TMINT[n].start = current_cycle; // The prescaler starts over
+    }
+    schedule_next_overflow();
+}
@@ -0,0 +1,15 @@
+#ifndef GBA_TIMER_H
+#define GBA_TIMER_H
+
+#include "gbabus.h"
+
+// Timers aren't stepped. Each one remembers when it last had a known value and works out where it is now from that,
+// so they cost nothing until something reads them or an overflow has to be seen (an IRQ, DMA sound or a cascade.)
+half timer_counter(int n);
+void timer_write_reload(int n, half value, half mask);
+void timer_write_control(int n, half value, half mask);
+
+// Handler for EVENT_TIMER_OVERFLOW
+void timer_overflow_event(uint64_t time);
+
+#endif //GBA_TIMER_H
@@ -0,0 +1,101 @@
+#include "scheduler.h"
+#include "common/log.h"
+
+typedef struct scheduled_event {
+    uint64_t time;
+    event_t event;
+} scheduled_event_t;
+
+uint64_t current_cycle = 0;
+
+static event_handler_t event_handlers[NUM_EVENTS];
+
+// Min-heap on time. heap_index[] is where each event is in it, or -1 if it isn't scheduled.
+static scheduled_event_t heap[NUM_EVENTS];
+static int heap_size = 0;
+static int heap_index[NUM_EVENTS];
+
+INLINE void heap_set(int index, scheduled_event_t event) {
+    heap[index] = event;
+    heap_index[event.event] = index;
+}
+
+static void sift_up(int index) {
+    scheduled_event_t event = heap[index];
+    while (index > 0) {
+        int parent = (index - 1) / 2;
+        if (heap[parent].time <= event.time) {
+            break;
+        }
+        heap_set(index, heap[parent]);
+        index = parent;
+    }
+    heap_set(index, event);
+}
+
+static void sift_down(int index) {
+    scheduled_event_t event = heap[index];
+    while (true) {
+        int child = index * 2 + 1;
+        if (child >= heap_size) {
+            break;
+        }
+        if (child + 1 < heap_size && heap[child + 1].time < heap[child].time) {
+            child++;
+        }
+        if (event.time <= heap[child].time) {
+            break;
+        }
+        heap_set(index, heap[child]);
+        index = child;
+    }
+    heap_set(index, event);
+}
+
+static void heap_remove(int index) {
+    heap_index[heap[index].event] = -1;
+    heap_size--;
+    if (index != heap_size) {
+        event_t moved = heap[heap_size].event;
+        heap_set(index, heap[heap_size]);
+        sift_up(index);
+        sift_down(heap_index[moved]);
+    }
+}
+
+void init_scheduler(const event_handler_t handlers[NUM_EVENTS]) {
+    current_cycle = 0;
+    heap_size = 0;
+    for (int i = 0; i < NUM_EVENTS; i++) {
+        event_handlers[i] = handlers[i];
+        heap_index[i] = -1;
+    }
+}
+
+void schedule_event(event_t event, uint64_t time) {
+    int index = heap_index[event];
+    if (index < 0) {
+        index = heap_size++;
+    }
+    heap_set(index, (scheduled_event_t){time, event});
+    sift_up(index);
+    sift_down(heap_index[event]);
+}
+
+void cancel_event(event_t event) {
+    if (heap_index[event] >= 0) {
+        heap_remove(heap_index[event]);
+    }
+}
+
+uint64_t next_event_time() {
+    return heap_size > 0 ? heap[0].time : UINT64_MAX;
+}
+
+void run_events() {
+    while (heap_size > 0 && heap[0].time <= current_cycle) {
+        scheduled_event_t next = heap[0];
+        heap_remove(0);
+        event_handlers[next.event](next.time);
+    }
+}
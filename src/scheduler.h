@@ -0,0 +1,35 @@
+#ifndef GBA_SCHEDULER_H
+#define GBA_SCHEDULER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "common/util.h"
+
+// Everything outside of the CPU that happens at a known time. Nothing the CPU can see changes between two of these,
+// so it can run uninterrupted until the next one.
+typedef enum event {
+    EVENT_HBLANK,
+    EVENT_HDRAW, // Start of a new line, which is also when VBlank starts and VCOUNT is compared
+    EVENT_TIMER_OVERFLOW,
+    EVENT_DMA, // The active DMA channels get the bus
+    EVENT_AUDIO_SAMPLE, // Only while sound is on
+    NUM_EVENTS
+} event_t;
+
+// Called with the time the event was scheduled for, which can be a bit before current_cycle.
+typedef void (*event_handler_t)(uint64_t time);
+
+// Cycles since the system was turned on
+extern uint64_t current_cycle;
+
+void init_scheduler(const event_handler_t handlers[NUM_EVENTS]);
+// An event is only ever scheduled once. Scheduling it again moves it.
+void schedule_event(event_t event, uint64_t time);
+void cancel_event(event_t event);
+// Earliest time anything is scheduled for, UINT64_MAX if nothing is
+uint64_t next_event_time();
+// Runs every event scheduled for current_cycle or before, in order
+void run_events();
+
+#endif //GBA_SCHEDULER_H
@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../src/common/log.h"
+#include "../src/arm7tdmi/arm7tdmi.h"
+#include "../src/gba_system.h"
+
+// Decode cost microbenchmark: times the old if-chain decoders against the handler table lookups,
+// over every word (ARM) and halfword (THUMB) of a real ROM so the instruction mix is realistic.
+
+#define PASSES 200
+
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char** argv) {
+    const char* rom = argc > 1 ? argv[1] : "thumb.gba";
+    log_set_verbosity(0);
+    init_gbasystem(rom, NULL);
+
+    size_t count = mem->rom_size / 4;
+    arminstr_t* instrs = malloc(count * sizeof(arminstr_t));
+    for (size_t i = 0; i < count; i++) {
+        instrs[i].raw = gba_read_word(0x08000000 + i * 4);
+    }
+
+    size_t thumb_count = mem->rom_size / 2;
+    thumbinstr_t* thumb_instrs = malloc(thumb_count * sizeof(thumbinstr_t));
+    for (size_t i = 0; i < thumb_count; i++) {
+        thumb_instrs[i].raw = gba_read_half(0x08000000 + i * 2);
+    }
+
+    volatile word sink = 0;
+
+    double start = now();
+    for (int pass = 0; pass < PASSES; pass++) {
+        for (size_t i = 0; i < count; i++) {
+            sink += get_arm_instr_type(&instrs[i]);
+        }
+    }
+    double chain = now() - start;
+
+    start = now();
+    for (int pass = 0; pass < PASSES; pass++) {
+        for (size_t i = 0; i < count; i++) {
+            sink += (uintptr_t)get_arm_handler(&instrs[i]);
+        }
+    }
+    double table = now() - start;
+
+    start = now();
+    for (int pass = 0; pass < PASSES; pass++) {
+        for (size_t i = 0; i < thumb_count; i++) {
+            sink += get_thumb_instr_type(&thumb_instrs[i]);
+        }
+    }
+    double thumb_chain = now() - start;
+
+    start = now();
+    for (int pass = 0; pass < PASSES; pass++) {
+        for (size_t i = 0; i < thumb_count; i++) {
+            sink += (uintptr_t)get_thumb_handler(&thumb_instrs[i]);
+        }
+    }
+    double thumb_table = now() - start;
+
+    double decoded = (double)count * PASSES;
+    printf("ARM:   %zu instructions x %d passes\n", count, PASSES);
+    printf("  if-chain: %6.2f ns/instr\n", chain * 1e9 / decoded);
+    printf("  table:    %6.2f ns/instr\n", table * 1e9 / decoded);
+
+    decoded = (double)thumb_count * PASSES;
+    printf("THUMB: %zu instructions x %d passes\n", thumb_count, PASSES);
+    printf("  if-chain: %6.2f ns/instr\n", thumb_chain * 1e9 / decoded);
+    printf("  table:    %6.2f ns/instr\n", thumb_table * 1e9 / decoded);
+
+    free(instrs);
+    free(thumb_instrs);
+    return 0;
+}
@@ -0,0 +1,205 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/common/log.h"
+#include "../src/gba_system.h"
+#include "test_common.h"
+
+#define NUM_FRAMES 16
+
+// An affine BG the way the hardware runs it: writing BGxX/BGxY sets the internal reference point to the 20.8 value
+// sign extended from 28 bits, every line moves it on by PB/PD, and the start of VBlank loads it from the registers.
+typedef struct reference_bg {
+    half control;
+    int16_t pa;
+    int16_t pb;
+    int16_t pc;
+    int16_t pd;
+    word x_register;
+    word y_register;
+    int32_t x;
+    int32_t y;
+} reference_bg_t;
+
+// BG2 and BG3
+static reference_bg_t reference[2];
+
+static int32_t sign_extend_reference_point(word value) {
+    value &= 0x0FFFFFFF;
+    return value & 0x08000000 ? (int32_t)(value | 0xF0000000) : (int32_t)value;
+}
+
+static word bg_register(int bg, word offset) {
+    return IO(offset + (bg - 2) * (IO_BG3PA - IO_BG2PA));
+}
+
+// Writes BGxX (or BGxY) as a word, or as two halfwords, which each reload the reference point
+static void write_reference_point(int bg, bool y, word value, bool halves) {
+    reference_bg_t* ref = &reference[bg - 2];
+    word* reg = y ? &ref->y_register : &ref->x_register;
+    int32_t* point = y ? &ref->y : &ref->x;
+    word address = bg_register(bg, y ? IO_BG2Y : IO_BG2X);
+
+    if (halves) {
+        gba_write_half(address, value & 0xFFFF);
+        *reg = (*reg & 0xFFFF0000) | (value & 0xFFFF);
+        *point = sign_extend_reference_point(*reg);
+        int32_t actual = y ? ppu->affine_y[bg - 2] : ppu->affine_x[bg - 2];
+        CHECK(actual == *point, "BG%d%c is %d after writing its low half, not %d", bg, y ? 'Y' : 'X', actual, *point)
+        gba_write_half(address + 2, value >> 16);
+    } else {
+        gba_write_word(address, value);
+    }
+    *reg = value;
+    *point = sign_extend_reference_point(value);
+    int32_t actual = y ? ppu->affine_y[bg - 2] : ppu->affine_x[bg - 2];
+    CHECK(actual == *point, "BG%d%c is %d after writing 0x%08X, not %d", bg, y ? 'Y' : 'X', actual, value, *point)
+}
+
+static void write_parameters(int bg, half control) {
+    reference_bg_t* ref = &reference[bg - 2];
+    ref->control = control;
+    // Anything from half to twice the size, rotated either way
+    ref->pa = (int16_t)(next_random() % 0x400) - 0x200;
+    ref->pb = (int16_t)(next_random() % 0x400) - 0x200;
+    ref->pc = (int16_t)(next_random() % 0x400) - 0x200;
+    ref->pd = (int16_t)(next_random() % 0x400) - 0x200;
+    gba_write_half(IO(IO_BG2CNT) + (bg - 2) * 2, control);
+    gba_write_half(bg_register(bg, IO_BG2PA), ref->pa);
+    gba_write_half(bg_register(bg, IO_BG2PB), ref->pb);
+    gba_write_half(bg_register(bg, IO_BG2PC), ref->pc);
+    gba_write_half(bg_register(bg, IO_BG2PD), ref->pd);
+}
+
+// A point somewhere around the BG, with junk in the unused top 4 bits
+static word random_reference_point() {
+    int32_t point = (int32_t)(next_random() % (2048 << 8)) - (1024 << 8);
+    return ((word)point & 0x0FFFFFFF) | (next_random() & 0xF0000000);
+}
+
+// The palette entry of a pixel on the current line, and whether it's opaque. Outside of the BG, it either wraps
+// around or is transparent.
+static int reference_affine_pixel(reference_bg_t* ref, int screen_x, bool* opaque) {
+    int32_t x = (ref->x + ref->pa * screen_x) >> 8;
+    int32_t y = (ref->y + ref->pc * screen_x) >> 8;
+    int size = 128 << (ref->control >> 14);
+    if (x < 0 || x >= size || y < 0 || y >= size) {
+        if (!(ref->control & 0x2000)) {
+            *opaque = false;
+            return 0;
+        }
+        x &= size - 1;
+        y &= size - 1;
+    }
+
+    word character_base = ((ref->control >> 2) & 3) * 0x4000;
+    word screen_base = ((ref->control >> 8) & 0x1F) * 0x800;
+    byte tile = vram_at(screen_base + (y / 8) * (size / 8) + x / 8);
+    byte index = vram_at(character_base + tile * 0x40 + (y % 8) * 8 + x % 8);
+    *opaque = index != 0;
+    return index;
+}
+
+// The BG on top always wraps around, so whether the one under it is transparent outside of its area shows
+static void check_line(int y, int top) {
+    int wrong = 0;
+    for (int x = 0; x < GBA_SCREEN_X; x++) {
+        bool top_opaque;
+        bool bottom_opaque;
+        int top_entry = reference_affine_pixel(&reference[top - 2], x, &top_opaque);
+        int bottom_entry = reference_affine_pixel(&reference[(top ^ 1) - 2], x, &bottom_opaque);
+        int entry = top_opaque ? top_entry : bottom_opaque ? bottom_entry : 0;
+        word expected = screen_color(ppu->palette[entry]);
+        if (ppu->screen[y][x].raw != expected && wrong++ == 0) {
+            printf("Line %d: pixel %d is 0x%08X, not 0x%08X\n", y, x, ppu->screen[y][x].raw, expected);
+        }
+    }
+    CHECK(wrong == 0, "%d pixels of line %d are wrong", wrong, y)
+}
+
+// Runs the system until the PPU is about to draw line y
+static void run_to_line(int y) {
+    while (ppu->y != y || ppu->DISPSTAT.hblank) {
+        current_cycle = next_event_time() > current_cycle ? next_event_time() : current_cycle;
+        run_events();
+    }
+}
+
+static void test_sign_extension() {
+    write_reference_point(2, false, 0x08000000, false);
+    CHECK(ppu->affine_x[0] == -0x08000000, "Smallest reference point is %d", ppu->affine_x[0])
+    write_reference_point(2, false, 0x07FFFFFF, false);
+    CHECK(ppu->affine_x[0] == 0x07FFFFFF, "Largest reference point is %d", ppu->affine_x[0])
+    write_reference_point(3, true, 0xFFFFFF00, true);
+    CHECK(ppu->affine_y[1] == -0x100, "-1.0 is %d", ppu->affine_y[1])
+    write_reference_point(3, true, 0xF0000180, true);
+    CHECK(ppu->affine_y[1] == 0x180, "1.5 with the top bits set is %d", ppu->affine_y[1])
+}
+
+static void test_frames() {
+    for (word i = 0; i < 0x18000; i += 4) {
+        gba_write_word(0x06000000 + i, next_random());
+    }
+    for (word i = 0; i < 0x200; i += 4) {
+        gba_write_word(0x05000000 + i, next_random());
+    }
+    for (int sprite = 0; sprite < 128; sprite++) {
+        gba_write_half(0x07000000 + sprite * 8, 0x0200); // Disabled
+    }
+    gba_write_half(IO(IO_DISPCNT), 0x0C02); // Mode 2, BG2 and BG3
+
+    for (int frame = 0; frame < NUM_FRAMES; frame++) {
+        // Set everything up during VBlank, after the reference points were reloaded
+        run_to_line(200);
+        int top = 2 + frame % 2;
+        for (int bg = 2; bg <= 3; bg++) {
+            // Random tiles, map and size. The BG on top has priority 0 and wraps around, the other one might.
+            half control = next_random() & 0xDF3C;
+            control |= bg == top ? 0x2000 : 1 | (next_random() & 0x2000);
+            write_parameters(bg, control);
+            // Every other frame starts from the reference points the VBlank reloaded
+            if (frame % 4 < 2) {
+                write_reference_point(bg, false, random_reference_point(), frame % 2);
+                write_reference_point(bg, true, random_reference_point(), frame % 2);
+            }
+        }
+
+        int reload_line = 1 + next_random() % (GBA_SCREEN_Y - 1);
+        for (int y = 0; y < GBA_SCREEN_Y; y++) {
+            run_to_line(y);
+            if (y == reload_line) {
+                write_reference_point(2, false, random_reference_point(), false);
+                write_reference_point(3, true, random_reference_point(), true);
+            }
+            run_to_line(y + 1);
+            check_line(y, top);
+            for (int i = 0; i < 2; i++) {
+                reference[i].x += reference[i].pb;
+                reference[i].y += reference[i].pd;
+            }
+            CHECK(ppu->affine_x[0] == reference[0].x && ppu->affine_y[1] == reference[1].y,
+                  "Reference points are %d,%d after line %d, not %d,%d", ppu->affine_x[0], ppu->affine_y[1], y,
+                  reference[0].x, reference[1].y)
+        }
+
+        run_to_line(200);
+        for (int i = 0; i < 2; i++) {
+            reference[i].x = sign_extend_reference_point(reference[i].x_register);
+            reference[i].y = sign_extend_reference_point(reference[i].y_register);
+            CHECK(ppu->affine_x[i] == reference[i].x && ppu->affine_y[i] == reference[i].y,
+                  "BG%d reference point is %d,%d after VBlank, not %d,%d", i + 2, ppu->affine_x[i], ppu->affine_y[i],
+                  reference[i].x, reference[i].y)
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    init_gbasystem("arm.gba", NULL);
+    skip_bios(cpu);
+
+    test_sign_extension();
+    test_frames();
+
+    exit(report_failures());
+}
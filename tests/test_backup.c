@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "../src/common/log.h"
+#include "../src/gba_system.h"
+#include "../src/scheduler.h"
+#include "../src/mem/backup.h"
+#include "../src/mem/ioreg_names.h"
+#include "test_common.h"
+
+
+// A copy of arm.gba with the save library's ID string at the end
+static void make_rom(const char* name, const char* id) {
+    FILE* in = fopen("arm.gba", "rb");
+    static byte rom[0x10000];
+    size_t size = fread(rom, 1, sizeof(rom) - 16, in);
+    fclose(in);
+    size = (size + 3) & ~3;
+    memcpy(&rom[size], id, strlen(id));
+    size += 16;
+
+    char path[64];
+    snprintf(path, sizeof(path), "%s.gba", name);
+    FILE* out = fopen(path, "wb");
+    fwrite(rom, 1, size, out);
+    fclose(out);
+    snprintf(path, sizeof(path), "%s.sav", name);
+    remove(path);
+}
+
+static void boot(const char* name) {
+    char path[64];
+    snprintf(path, sizeof(path), "%s.gba", name);
+    init_gbasystem(path, NULL);
+    skip_bios(cpu);
+}
+
+static void flash_command(byte command) {
+    gba_write_byte(0x0E005555, 0xAA);
+    gba_write_byte(0x0E002AAA, 0x55);
+    gba_write_byte(0x0E005555, command);
+}
+
+static void test_flash() {
+    make_rom("backup_flash", "FLASH1M_V103");
+    boot("backup_flash");
+    CHECK(backup_type == FLASH128K, "FLASH1M not detected")
+    CHECK(gba_read_byte(0x0E000000) == 0xFF, "New FLASH isn't erased")
+
+    flash_command(0x90);
+    CHECK(gba_read_byte(0x0E000000) == 0x62 && gba_read_byte(0x0E000001) == 0x13, "Wrong FLASH ID")
+    flash_command(0xF0);
+
+    flash_command(0xA0);
+    gba_write_byte(0x0E001234, 0x5A);
+    flash_command(0xB0);
+    gba_write_byte(0x0E000000, 1);
+    flash_command(0xA0);
+    gba_write_byte(0x0E001234, 0xA5);
+    CHECK(gba_read_byte(0x0E001234) == 0xA5, "FLASH bank 1 write didn't stick")
+    flash_command(0xB0);
+    gba_write_byte(0x0E000000, 0);
+    CHECK(gba_read_byte(0x0E001234) == 0x5A, "FLASH bank 0 write didn't stick")
+
+    flash_command(0xA0);
+    gba_write_byte(0x0E002000, 0x11);
+    // Sector erases go to the sector's address instead of 0x5555
+    flash_command(0x80);
+    gba_write_byte(0x0E005555, 0xAA);
+    gba_write_byte(0x0E002AAA, 0x55);
+    gba_write_byte(0x0E001000, 0x30);
+    CHECK(gba_read_byte(0x0E001234) == 0xFF, "FLASH sector wasn't erased")
+    CHECK(gba_read_byte(0x0E002000) == 0x11, "FLASH erased the wrong sector")
+
+    // Everything written is in the file straight away
+    boot("backup_flash");
+    CHECK(gba_read_byte(0x0E002000) == 0x11, "FLASH write didn't persist")
+    flash_command(0xB0);
+    gba_write_byte(0x0E000000, 1);
+    CHECK(gba_read_byte(0x0E001234) == 0xA5, "FLASH bank 1 didn't persist")
+}
+
+static void run_eeprom_dma(word source, word dest, half count) {
+    gba_write_word(IO(IO_DMA3SAD), source);
+    gba_write_word(IO(IO_DMA3DAD), dest);
+    gba_write_half(IO(IO_DMA3CNT_L), count);
+    gba_write_half(IO(IO_DMA3CNT_H), 0x8000);
+    current_cycle += 10000;
+    run_events();
+}
+
+// Puts a request into EWRAM a bit per halfword, returns how many bits it is
+static int eeprom_request(bool read, word block, uint64_t data) {
+    int bits = 0;
+    word base = 0x02000000;
+    gba_write_half(base + bits++ * 2, 1);
+    gba_write_half(base + bits++ * 2, read);
+    for (int i = 13; i >= 0; i--) {
+        gba_write_half(base + bits++ * 2, (block >> i) & 1);
+    }
+    if (!read) {
+        for (int i = 63; i >= 0; i--) {
+            gba_write_half(base + bits++ * 2, (data >> i) & 1);
+        }
+    }
+    gba_write_half(base + bits++ * 2, 0);
+    return bits;
+}
+
+static uint64_t eeprom_read_block(word block) {
+    run_eeprom_dma(0x02000000, 0x0D000000, eeprom_request(true, block, 0));
+    run_eeprom_dma(0x0D000000, 0x02001000, 68);
+    uint64_t data = 0;
+    for (int i = 4; i < 68; i++) {
+        data = (data << 1) | (gba_read_half(0x02001000 + i * 2) & 1);
+    }
+    return data;
+}
+
+static void test_eeprom() {
+    make_rom("backup_eeprom", "EEPROM_V124");
+    boot("backup_eeprom");
+    CHECK(backup_type == EEPROM, "EEPROM not detected")
+
+    run_eeprom_dma(0x02000000, 0x0D000000, eeprom_request(false, 0x3F5, 0x0123456789ABCDEF));
+    CHECK(gba_read_half(0x0D000000) == 1, "EEPROM not ready after a write")
+    CHECK(eeprom_read_block(0x3F5) == 0x0123456789ABCDEF, "EEPROM read back the wrong data")
+
+    struct stat st;
+    CHECK(stat("backup_eeprom.sav", &st) == 0 && st.st_size == 0x2000, "EEPROM save isn't 8K")
+
+    boot("backup_eeprom");
+    CHECK(eeprom_read_block(0x3F5) == 0x0123456789ABCDEF, "EEPROM write didn't persist")
+}
+
+static void test_sram() {
+    make_rom("backup_sram", "SRAM_V113");
+    boot("backup_sram");
+    CHECK(backup_type == SRAM, "SRAM not detected")
+    gba_write_byte(0x0E007FFF, 0x42);
+    CHECK(gba_read_byte(0x0E00FFFF) == 0x42, "SRAM isn't mirrored")
+    boot("backup_sram");
+    CHECK(gba_read_byte(0x0E007FFF) == 0x42, "SRAM write didn't persist")
+
+    // A save that's too short keeps what it has, and the rest reads as erased
+    FILE* save = fopen("backup_sram.sav", "wb");
+    static const byte start[0x100];
+    fwrite(start, 1, sizeof(start), save);
+    fclose(save);
+    boot("backup_sram");
+    CHECK(gba_read_byte(0x0E0000FF) == 0x00 && gba_read_byte(0x0E000100) == 0xFF, "Short SRAM save wasn't filled with 0xFF")
+}
+
+int main(int argc, char** argv) {
+    test_flash();
+    test_eeprom();
+    test_sram();
+    exit(report_failures());
+}
@@ -9,6 +9,81 @@
 #include "../src/mem/gbabios.h"
 #include "../src/arm7tdmi/arm7tdmi.h"
 #include "../src/gba_system.h"
+#include "../src/scheduler.h"
+#include "../src/mem/ioreg_names.h"
+
+#define IO(offset) (0x04000000 + (offset))
+
+// Tests that keep going after something's wrong count it here, and report_failures() prints the total at the end
+int failures = 0;
+
+#define CHECK(condition, message, ...) if (!(condition)) { printf(message "\n", ##__VA_ARGS__); failures++; }
+
+int report_failures() {
+    printf("%d failures\n", failures);
+    return failures != 0;
+}
+
+#define DMA_ENABLE 0x8000
+#define DMA_IRQ 0x4000
+#define DMA_HBLANK 0x2000
+#define DMA_32BIT 0x0400
+#define DMA_REPEAT 0x0200
+#define DMA_DEST_FIXED 0x0040
+#define DMA_SOURCE_FIXED 0x0100
+
+void start_dma(int n, word source, word dest, half count, half control) {
+    word registers = IO(IO_DMA0SAD) + n * (IO_DMA1SAD - IO_DMA0SAD);
+    gba_write_word(registers, source);
+    gba_write_word(registers + 4, dest);
+    gba_write_half(registers + 8, count);
+    gba_write_half(registers + 10, control);
+}
+
+// Runs the system (without the CPU) for this many cycles
+void run_for(int cycles) {
+    uint64_t until = current_cycle + cycles;
+    while (next_event_time() <= until) {
+        current_cycle = next_event_time() > current_cycle ? next_event_time() : current_cycle;
+        run_events();
+    }
+    current_cycle = until > current_cycle ? until : current_cycle;
+}
+
+// A GBA color the way the PPU puts it on the screen
+word screen_color(half gba_color) {
+    int r = gba_color & 0x1F;
+    int g = (gba_color >> 5) & 0x1F;
+    int b = (gba_color >> 10) & 0x1F;
+    color_t color;
+    color.a = 0xFF;
+    color.r = FIVEBIT_TO_EIGHTBIT_COLOR(r);
+    color.g = FIVEBIT_TO_EIGHTBIT_COLOR(g);
+    color.b = FIVEBIT_TO_EIGHTBIT_COLOR(b);
+    return color.raw;
+}
+
+// VRAM is mirrored the same way as on the bus
+byte vram_at(word offset) {
+    offset &= 0x1FFFF;
+    return ppu->vram[offset < VRAM_SIZE ? offset : offset - 0x8000];
+}
+
+// The same sequence every run, so failures can be reproduced
+word random_state = 0x12345678;
+
+word next_random() {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+// Draws line y of the screen, the same as when the PPU gets to its HBlank
+void render_test_line(int y) {
+    ppu->y = y;
+    ppu_hblank(ppu);
+}
 
 typedef struct cpu_log {
     word address;
@@ -87,11 +162,11 @@ int test_loop(const char* rom_filename, int num_log_lines, const char* log_filen
         logdebug("Checking registers against step %d (line %d in log)", step, step + 1)
         ASSERT_EQUAL(adjusted_pc, "Address", lines[step].address, cpu->pc - (cpu->cpsr.thumb ? 2 : 4))
 
-        if (lines[step].cpsr.raw != cpu->cpsr.raw) {
+        if (lines[step].cpsr.raw != get_psr(cpu)->raw) {
             printf("Expected cpsr: ");
             printcpsr(lines[step].cpsr);
             printf(" Actual cpsr: ");
-            printcpsr(cpu->cpsr);
+            printcpsr((*get_psr(cpu)));
             printf("\n");
         }
 
@@ -111,7 +186,7 @@ int test_loop(const char* rom_filename, int num_log_lines, const char* log_filen
         ASSERT_EQUAL(adjusted_pc, "r13 (SP)",  lines[step].r[13],    get_register(cpu, 13))
         ASSERT_EQUAL(adjusted_pc, "r14 (LR)",  lines[step].r[14],    get_register(cpu, 14))
         ASSERT_EQUAL(adjusted_pc, "r15 (PC)",  lines[step].r[15],    get_register(cpu, 15))
-        ASSERT_EQUAL(adjusted_pc, "CPSR",      lines[step].cpsr.raw, cpu->cpsr.raw)
+        ASSERT_EQUAL(adjusted_pc, "CPSR",      lines[step].cpsr.raw, get_psr(cpu)->raw)
 
         //ASSERT_EQUAL(adjusted_pc, "cycles", lines[step].cycles, cycles)
         if (cycles != lines[step].cycles) {
@@ -0,0 +1,56 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/arm7tdmi/arm7tdmi.h"
+#include "test_common.h"
+
+// The switch check_cond() used before it became a table lookup
+static bool reference_cond(arm_cond_t cond, bool n, bool z, bool c, bool v) {
+    switch (cond) {
+        case EQ: return z;
+        case NE: return !z;
+        case CS: return c;
+        case CC: return !c;
+        case MI: return n;
+        case PL: return !n;
+        case VS: return v;
+        case VC: return !v;
+        case HI: return c && !z;
+        case LS: return !c || z;
+        case GE: return n == v;
+        case LT: return n != v;
+        case GT: return !z && n == v;
+        case LE: return z || n != v;
+        case AL: return true;
+        case NV: return false;
+    }
+    return false;
+}
+
+int main(int argc, char** argv) {
+    arm7tdmi_t state;
+    memset(&state, 0, sizeof(state));
+
+    for (int cond = 0; cond < 16; cond++) {
+        for (int nzcv = 0; nzcv < 16; nzcv++) {
+            bool n = (nzcv >> 3) & 1;
+            bool z = (nzcv >> 2) & 1;
+            bool c = (nzcv >> 1) & 1;
+            bool v = nzcv & 1;
+
+            set_flags_n_z(&state, n, z);
+            state.flags.op = FLAGS_STORED;
+            state.flags.C = c;
+            state.flags.V = v;
+
+            arminstr_t instr;
+            instr.raw = (word)cond << 28u;
+
+            bool expected = reference_cond(cond, n, z, c, v);
+            CHECK(check_cond(&state, &instr) == expected, "cond %d with NZCV %d%d%d%d: expected %d", cond, n, z, c, v, expected)
+        }
+    }
+
+    exit(report_failures());
+}
@@ -0,0 +1,57 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../src/common/log.h"
+#include "../src/gba_system.h"
+#include "../src/scheduler.h"
+#include "../src/mem/ioreg_names.h"
+#include "test_common.h"
+
+int main(int argc, char** argv) {
+    init_gbasystem("arm.gba", NULL);
+    skip_bios(cpu);
+    gba_write_half(IO(IO_IE), 0xFFFF);
+    gba_write_half(IO(IO_IME), 1);
+
+    for (word i = 0; i < 0x4000; i++) {
+        gba_write_word(0x02000000 + i * 4, i * 0x01010101);
+    }
+
+    // Immediate: starts 2 cycles after it's enabled, then EWRAM -> IWRAM takes 6 + 1 cycles a word
+    uint64_t start = current_cycle;
+    start_dma(3, 0x02000000, 0x03001000, 64, DMA_ENABLE | DMA_IRQ | DMA_32BIT);
+    run_for(2);
+    CHECK(current_cycle - start == 2 + 64 * 7, "Immediate DMA took %d cycles", (int)(current_cycle - start))
+    for (word i = 0; i < 64; i++) {
+        CHECK(gba_read_word(0x03001000 + i * 4) == i * 0x01010101, "Immediate DMA word %d is wrong", i)
+    }
+    CHECK(!bus->DMA3CNT_H.dma_enable, "Immediate DMA still enabled")
+    CHECK(bus->IF.dma3, "No DMA3 IRQ")
+
+    // HBlank, repeating: one halfword every line
+    start_dma(0, 0x02000000, 0x03002000, 1, DMA_ENABLE | DMA_HBLANK | DMA_REPEAT | DMA_DEST_FIXED);
+    run_for(10 * LINE_CYCLES);
+    CHECK(bus->DMA0INT.current_source_address == 0x02000000 + 10 * 2, "HBlank DMA ran %d times, not 10",
+          (bus->DMA0INT.current_source_address - 0x02000000) / 2)
+    CHECK(gba_read_half(0x03002000) == gba_read_half(0x02000000 + 9 * 2), "HBlank DMA copied the wrong halfword")
+    CHECK(bus->DMA0CNT_H.dma_enable, "Repeating DMA was disabled")
+
+    // A long DMA3 doesn't hold up the HBlank one, which has a higher priority
+    word hblank_source = bus->DMA0INT.current_source_address;
+    start = current_cycle;
+    start_dma(3, 0x02000000, 0x02010000, 0x2000, DMA_ENABLE | DMA_32BIT);
+    run_for(2);
+    int lines = (current_cycle - start) / LINE_CYCLES;
+    int hblank_transfers = (bus->DMA0INT.current_source_address - hblank_source) / 2;
+    CHECK(lines > 50, "Long DMA only took %d lines", lines)
+    CHECK(hblank_transfers >= lines && hblank_transfers <= lines + 1, "%d HBlank transfers during %d lines", hblank_transfers, lines)
+    CHECK(gba_read_word(0x02010000 + 0x1FFF * 4) == 0x1FFFu * 0x01010101u, "Long DMA didn't finish")
+
+    // Turning it off stops it
+    gba_write_half(IO(IO_DMA0CNT_H), 0);
+    hblank_source = bus->DMA0INT.current_source_address;
+    run_for(5 * LINE_CYCLES);
+    CHECK(bus->DMA0INT.current_source_address == hblank_source, "Disabled DMA kept running")
+
+    exit(report_failures());
+}
@@ -0,0 +1,70 @@
+#include <stdlib.h>
+#include <string.h>
+#include "test_common.h"
+#include "../src/arm7tdmi/jit.h"
+#include "../src/arm7tdmi/block_cache.h"
+
+// Runs a ROM the way --jit-verify does: every compiled block goes through the interpreter first, and the two
+// disagreeing is fatal. The ROM is run from the top over and over, so everything in it ends up hot enough to compile.
+#define NUM_PASSES (JIT_HOT_THRESHOLD + 4)
+#define BLOCKS_PER_PASS 20000 // Gets to the loop both ROMs end in, with room to spare
+// Tells CTest the JIT isn't supported here
+#define SKIPPED 77
+
+// The ROMs never leave a compiled block through the interpreter's slow path, so this does: a block that starts with a
+// store to IO, which exits the block right after it. The instruction after the store has to be the next one to run.
+#define IO_STORE_BLOCK 0x03000000
+#define IO_STORE_LOOPS 100
+
+static void run_rom() {
+    for (int pass = 0; pass < NUM_PASSES; pass++) {
+        skip_bios(cpu);
+        for (int i = 0; i < BLOCKS_PER_PASS; i++) {
+            arm7tdmi_run_block(cpu);
+        }
+    }
+
+    // Both ROMs end up looping forever, so whatever the CPU is in now must have been compiled
+    word pc = cpu->pc - (cpu->cpsr.thumb ? 2 : 4);
+    cached_block_t* block = get_cached_block(cpu, pc, cpu->cpsr.thumb);
+    CHECK(block && block->jit_code, "The block at 0x%08X was never compiled", pc)
+}
+
+static void run_io_store() {
+    cpu->write_half(IO_STORE_BLOCK, 0x6008);     // str r0, [r1]
+    cpu->write_half(IO_STORE_BLOCK + 2, 0x3201); // adds r2, #1
+    cpu->write_half(IO_STORE_BLOCK + 4, 0xE7FC); // b IO_STORE_BLOCK
+    cpu->r[0] = 0;
+    cpu->r[1] = IO(0x208); // IME
+    cpu->r[2] = 0;
+    set_pc(cpu, IO_STORE_BLOCK | 1);
+
+    for (int i = 0; i < IO_STORE_LOOPS * 4 && cpu->r[2] < IO_STORE_LOOPS; i++) {
+        arm7tdmi_run_block(cpu);
+    }
+
+    CHECK(cpu->r[2] == IO_STORE_LOOPS, "The loop after the IO store went around %d times, expected %d", cpu->r[2], IO_STORE_LOOPS)
+    cached_block_t* block = get_cached_block(cpu, IO_STORE_BLOCK, true);
+    CHECK(block && block->jit_code, "The block at 0x%08X was never compiled", IO_STORE_BLOCK)
+}
+
+int main(int argc, char** argv) {
+    if (argc != 2 && !(argc == 3 && strcmp(argv[2], "io-store") == 0)) {
+        logfatal("Usage: %s ROM [io-store]", argv[0])
+    }
+    log_set_verbosity(0);
+    init_gbasystem(argv[1], NULL);
+    skip_bios(cpu);
+
+    jit_memory_t jit_memory = {mem->ewram, mem->iwram, mem->rom, mem->rom_mask + 1};
+    if (!jit_init(jit_memory, true, false)) {
+        exit(SKIPPED);
+    }
+
+    if (argc == 3) {
+        run_io_store();
+    } else {
+        run_rom();
+    }
+    exit(report_failures());
+}
@@ -0,0 +1,378 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/common/log.h"
+#include "../src/gba_system.h"
+#include "test_common.h"
+
+// BG0 is 4bpp, with its map in the last screenblock. Every tile on it is TILE.
+#define SCREEN_BASE_BLOCK 31
+#define MAP_ADDRESS (0x06000000 + SCREEN_BASE_BLOCK * 0x800)
+#define TILE 1
+#define TILE_ADDRESS (0x06000000 + TILE * 0x20)
+// The same, but with a tile out of the 32KB mirrored at the end of VRAM's 128KB window
+#define MIRROR_CHARACTER_BASE_BLOCK 3
+#define MIRROR_TILE 512
+#define MIRROR_TILE_ADDRESS 0x06018000 // VRAM 0x10000
+// Writes are staged here for the DMA
+#define DMA_SOURCE 0x02000000
+
+// Every way something can get written to video memory. The CPU goes through the page table for halfwords and words,
+// and the slow path for bytes. DMA goes through gba_write_span().
+typedef void (*write_path_t)(word address, const byte* data, int length);
+
+static void write_bytes(word address, const byte* data, int length) {
+    for (int i = 0; i < length; i++) {
+        cpu->write_byte(address + i, data[i]);
+    }
+}
+
+static void write_halves(word address, const byte* data, int length) {
+    for (int i = 0; i < length; i += 2) {
+        half value;
+        memcpy(&value, &data[i], sizeof(value));
+        cpu->write_half(address + i, value);
+    }
+}
+
+static void write_words(word address, const byte* data, int length) {
+    for (int i = 0; i < length; i += 4) {
+        word value;
+        memcpy(&value, &data[i], sizeof(value));
+        cpu->write_word(address + i, value);
+    }
+}
+
+static void write_dma(word address, const byte* data, int length) {
+    for (int i = 0; i < length; i++) {
+        gba_write_byte(DMA_SOURCE + i, data[i]);
+    }
+    start_dma(3, DMA_SOURCE, address, length / 2, DMA_ENABLE);
+    run_for(length * 8);
+}
+
+// A fixed source filling the destination, which DMA does with one span as well
+static void write_dma_fill(word address, const byte* data, int length) {
+    write_words(DMA_SOURCE, data, 4);
+    start_dma(3, DMA_SOURCE, address, length / 4, DMA_ENABLE | DMA_32BIT | DMA_SOURCE_FIXED);
+    run_for(length * 8);
+}
+
+static const struct {
+    const char* name;
+    write_path_t write;
+} write_paths[] = {
+        {"halfword", write_halves},
+        {"word", write_words},
+        {"byte", write_bytes},
+        {"DMA", write_dma},
+        {"DMA fill", write_dma_fill}
+};
+#define NUM_WRITE_PATHS (sizeof(write_paths) / sizeof(write_paths[0]))
+
+static void disable_sprites() {
+    for (int sprite = 0; sprite < 128; sprite++) {
+        gba_write_half(0x07000000 + sprite * 8, 0x0200);
+    }
+}
+
+static void setup_bg0(int character_base_block, int tile) {
+    gba_write_half(IO(IO_DISPCNT), 0x0100); // Mode 0, BG0 only
+    gba_write_half(IO(IO_BG0CNT), (SCREEN_BASE_BLOCK << 8) | (character_base_block << 2));
+    gba_write_half(IO(IO_BG0HOFS), 0);
+    gba_write_half(IO(IO_BG0VOFS), 0);
+    for (int i = 0; i < 32 * 32; i++) {
+        gba_write_half(MAP_ADDRESS + i * 2, tile);
+    }
+    disable_sprites();
+}
+
+// BG palette 0, every color different
+static half bg_color(int index) {
+    return index * 0x0421 + 0x0400;
+}
+
+// Fills a tile with one palette index through the write path, draws a line and checks that every pixel has changed
+static void check_tile_rewrite(word tile_address, int path, int index) {
+    byte tile[0x20];
+    memset(tile, index * 0x11, sizeof(tile));
+    write_paths[path].write(tile_address, tile, sizeof(tile));
+
+    int y = index % GBA_SCREEN_Y;
+    render_test_line(y);
+    int wrong = 0;
+    for (int x = 0; x < GBA_SCREEN_X; x++) {
+        wrong += ppu->screen[y][x].raw != screen_color(bg_color(index));
+    }
+    CHECK(wrong == 0, "%d pixels still have the old tile after a %s write to 0x%08X", wrong, write_paths[path].name, tile_address)
+}
+
+static void test_vram() {
+    for (int i = 0; i < 16; i++) {
+        gba_write_half(0x05000000 + i * 2, bg_color(i));
+    }
+
+    setup_bg0(0, TILE);
+    for (int path = 0; path < NUM_WRITE_PATHS; path++) {
+        check_tile_rewrite(TILE_ADDRESS, path, 1 + path * 2);
+        check_tile_rewrite(TILE_ADDRESS, path, 2 + path * 2);
+    }
+
+    setup_bg0(MIRROR_CHARACTER_BASE_BLOCK, MIRROR_TILE);
+    for (int path = 0; path < NUM_WRITE_PATHS; path++) {
+        check_tile_rewrite(MIRROR_TILE_ADDRESS, path, 15 - path * 2);
+        check_tile_rewrite(MIRROR_TILE_ADDRESS, path, 14 - path * 2);
+    }
+}
+
+// TILE's left half is PALETTE_INDEX, its right half the color after it
+#define PALETTE_INDEX 6
+
+// Writes two colors through the write path, draws a line and checks that every pixel has changed color
+static void check_palette_rewrite(word palette_address, int path, half left, half right) {
+    byte colors[4] = {left & 0xFF, left >> 8, right & 0xFF, right >> 8};
+    write_paths[path].write(palette_address, colors, sizeof(colors));
+
+    int y = (path * 16 + (left & 0xF)) % GBA_SCREEN_Y;
+    render_test_line(y);
+    int wrong = 0;
+    for (int x = 0; x < GBA_SCREEN_X; x++) {
+        wrong += ppu->screen[y][x].raw != screen_color(x % 8 < 4 ? left : right);
+    }
+    CHECK(wrong == 0, "%d pixels still have the old color after a %s write to 0x%08X", wrong, write_paths[path].name, palette_address)
+}
+
+static void test_pram() {
+    setup_bg0(0, TILE);
+    for (int row = 0; row < 8; row++) {
+        gba_write_word(TILE_ADDRESS + row * 4, (PALETTE_INDEX + 1) * 0x11110000 + PALETTE_INDEX * 0x1111);
+    }
+
+    // Palette RAM is mirrored every 1KB
+    word addresses[] = {0x05000000 + PALETTE_INDEX * 2, 0x05FFFC00 + PALETTE_INDEX * 2};
+    for (int i = 0; i < 2; i++) {
+        for (int path = 0; path < NUM_WRITE_PATHS; path++) {
+            check_palette_rewrite(addresses[i], path, 0x001F + path + i * 8, 0x7C00 + path + i * 8);
+            check_palette_rewrite(addresses[i], path, 0x03E0 + path + i * 8, 0x7FFF - path - i * 8);
+        }
+    }
+}
+
+// A text BG pixel worked out on its own, the way the renderer did before it drew whole tile rows. Returns the palette
+// entry, and whether it's opaque.
+static int reference_text_pixel(half control, int hofs, int vofs, int x, int y, bool* opaque) {
+    bool is_256color = control & 0x80;
+    word character_base = ((control >> 2) & 3) * 0x4000;
+    word screen_base = ((control >> 8) & 0x1F) * 0x800;
+    bool wide = (control >> 14) & 1;
+    bool tall = (control >> 15) & 1;
+
+    int map_x = (x + hofs) % 512;
+    int map_y = (y + vofs) % 512;
+    int screenblock = 0;
+    if (wide && map_x >= 256) {
+        screenblock++;
+    }
+    if (tall && map_y >= 256) {
+        screenblock += wide ? 2 : 1;
+    }
+    map_x %= 256;
+    map_y %= 256;
+
+    word se_address = screen_base + screenblock * 0x800 + (map_y / 8) * 64 + (map_x / 8) * 2;
+    half se = vram_at(se_address) | (vram_at(se_address + 1) << 8);
+    int tile_x = se & 0x400 ? 7 - map_x % 8 : map_x % 8;
+    int tile_y = se & 0x800 ? 7 - map_y % 8 : map_y % 8;
+    int tid = se & 0x3FF;
+
+    int index;
+    int bank = 0;
+    if (is_256color) {
+        index = vram_at(character_base + tid * 0x40 + tile_y * 8 + tile_x);
+    } else {
+        byte pixels = vram_at(character_base + tid * 0x20 + tile_y * 4 + tile_x / 2);
+        index = tile_x & 1 ? pixels >> 4 : pixels & 0xF;
+        bank = se >> 12;
+    }
+    *opaque = index != 0;
+    return bank * 16 + index;
+}
+
+// BG0 over BG1, both with random settings, VRAM and palettes. Every line drawn by render_bg_regular() has to match
+// the reference pixel for pixel, including the partial tiles at either end when the scroll isn't a multiple of 8.
+static void test_text_bg() {
+    for (word i = 0; i < 0x18000; i += 4) {
+        gba_write_word(0x06000000 + i, next_random());
+    }
+    for (word i = 0; i < 0x200; i += 4) {
+        gba_write_word(0x05000000 + i, next_random());
+    }
+
+    disable_sprites();
+    gba_write_half(IO(IO_DISPCNT), 0x0300); // Mode 0, BG0 and BG1
+    gba_write_half(IO(IO_BG2CNT), 3);
+    gba_write_half(IO(IO_BG3CNT), 3);
+    for (int setting = 0; setting < 200; setting++) {
+        half control[2];
+        int hofs[2];
+        int vofs[2];
+        for (int bg = 0; bg < 2; bg++) {
+            control[bg] = (next_random() & 0xFFBC) | bg; // No mosaic, BG0 first
+            hofs[bg] = next_random() & 0x1FF;
+            vofs[bg] = next_random() & 0x1FF;
+            gba_write_half(IO(IO_BG0CNT) + bg * 2, control[bg]);
+            gba_write_half(IO(IO_BG0HOFS) + bg * 4, hofs[bg]);
+            gba_write_half(IO(IO_BG0VOFS) + bg * 4, vofs[bg]);
+        }
+
+        for (int line = 0; line < 4; line++) {
+            int y = next_random() % GBA_SCREEN_Y;
+            render_test_line(y);
+            int wrong = 0;
+            for (int x = 0; x < GBA_SCREEN_X; x++) {
+                bool opaque[2];
+                int bg0 = reference_text_pixel(control[0], hofs[0], vofs[0], x, y, &opaque[0]);
+                int bg1 = reference_text_pixel(control[1], hofs[1], vofs[1], x, y, &opaque[1]);
+                // Nothing opaque leaves BG0's transparent color
+                int entry = !opaque[0] && opaque[1] ? bg1 : bg0;
+                word expected = screen_color(ppu->palette[entry]);
+                if (ppu->screen[y][x].raw != expected && wrong++ == 0) {
+                    printf("BG0CNT 0x%04X %d,%d BG1CNT 0x%04X %d,%d: pixel %d,%d is 0x%08X, not 0x%08X\n",
+                           control[0], hofs[0], vofs[0], control[1], hofs[1], vofs[1], x, y, ppu->screen[y][x].raw, expected);
+                }
+            }
+            CHECK(wrong == 0, "%d pixels of line %d are wrong", wrong, y)
+        }
+    }
+}
+
+#define OBJ_TILES_ADDRESS 0x06010000
+#define SPRITE_Y 40
+#define SPRITE_SIZE 64
+// Off the left of the screen, but still on the line, so they use up the OBJ renderer's time and nothing else
+#define FILLER_X 300
+#define FIRST_X 0
+#define SECOND_X 100
+
+static half oam[OAM_SIZE / 2];
+
+static void set_sprite(int sprite, bool affine, int x, int y, int pb) {
+    oam[sprite * 4] = y | (affine ? 0x0100 : 0); // Square
+    oam[sprite * 4 + 1] = x | (3 << 14); // 64x64, affine ones use parameters 0
+    oam[sprite * 4 + 2] = pb << 12; // Tile 0, priority 0
+}
+
+static half obj_color(int pb) {
+    return ppu->palette[0x100 + pb * 16 + 1];
+}
+
+// Draws a line with nothing under the sprites, and counts the pixels of the sprite with palette bank pb starting at x
+static int sprite_pixels(int y, int x, int pb) {
+    memset(ppu->screen[y], 0, sizeof(ppu->screen[y]));
+    render_test_line(y);
+    int pixels = 0;
+    while (x + pixels < GBA_SCREEN_X && ppu->screen[y][x + pixels].raw == screen_color(obj_color(pb))) {
+        pixels++;
+    }
+    return pixels;
+}
+
+static bool line_empty(int y) {
+    memset(ppu->screen[y], 0, sizeof(ppu->screen[y]));
+    render_test_line(y);
+    for (int x = 0; x < GBA_SCREEN_X; x++) {
+        if (ppu->screen[y][x].raw != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Disables every sprite with a DMA fill, and checks that the next line sees it
+static void clear_oam() {
+    for (int i = 0; i < OAM_SIZE / 2; i++) {
+        oam[i] = 0x0200;
+    }
+    oam[3] = 0x100; // Parameters 0 are the identity
+    oam[7] = 0;
+    oam[11] = 0;
+    oam[15] = 0x100;
+    write_dma_fill(0x07000000, (const byte*)oam, OAM_SIZE);
+    CHECK(line_empty(SPRITE_Y), "Sprites still there after a DMA fill disabled them")
+}
+
+// The OBJ renderer has 1210 cycles for every line, or 954 with HBlank interval free. A normal sprite takes its width
+// and an affine one 10 + twice its width, and whatever is left over when it runs out draws part of the sprite.
+static const struct {
+    bool affine;
+    bool hblank_free;
+    int fillers;
+    int first; // Pixels drawn of the two sprites after the fillers
+    int second;
+} budgets[] = {
+        {false, false, 18, 58, 0}, // 1210 = 18 * 64 + 58
+        {false, false, 17, 64, 58},
+        {false, true, 14, 58, 0}, // 954 = 14 * 64 + 58
+        {false, true, 18, 0, 0},
+        {true, false, 8, 48, 0}, // 1210 = 8 * 138 + 106, which draws (106 - 10) / 2 pixels
+        {true, false, 7, 64, 48},
+        {true, true, 6, 58, 0}, // 954 = 6 * 138 + 126
+        {true, true, 8, 0, 0}
+};
+
+static void test_oam() {
+    for (int i = 0; i < SPRITE_SIZE * SPRITE_SIZE / 2; i += 4) {
+        gba_write_word(OBJ_TILES_ADDRESS + i, 0x11111111);
+    }
+    for (int pb = 0; pb < 3; pb++) {
+        gba_write_half(0x05000200 + (pb * 16 + 1) * 2, 0x1234 * (pb + 1));
+    }
+
+    for (int i = 0; i < sizeof(budgets) / sizeof(budgets[0]); i++) {
+        bool affine = budgets[i].affine;
+        gba_write_half(IO(IO_DISPCNT), 0x1040 | (budgets[i].hblank_free ? 0x0020 : 0)); // Mode 0, 1D OBJ only
+        clear_oam();
+
+        for (int sprite = 0; sprite < budgets[i].fillers; sprite++) {
+            set_sprite(sprite, affine, FILLER_X, SPRITE_Y, 0);
+        }
+        set_sprite(budgets[i].fillers, affine, FIRST_X, SPRITE_Y, 1);
+        set_sprite(budgets[i].fillers + 1, affine, SECOND_X, SPRITE_Y, 2);
+        // Everything but the fill, which can't write the sprites
+        int path = i % (NUM_WRITE_PATHS - 1);
+        write_paths[path].write(0x07000000, (const byte*)oam, OAM_SIZE);
+
+        for (int y = SPRITE_Y; y < SPRITE_Y + SPRITE_SIZE; y += SPRITE_SIZE - 1) {
+            int first = sprite_pixels(y, FIRST_X, 1);
+            int second = sprite_pixels(y, SECOND_X, 2);
+            CHECK(first == budgets[i].first && second == budgets[i].second,
+                  "Two %s sprites after %d fillers on line %d, written by %s, drew %d and %d pixels, not %d and %d",
+                  affine ? "affine" : "normal", budgets[i].fillers, y, write_paths[path].name,
+                  first, second, budgets[i].first, budgets[i].second)
+        }
+        // The sprites are only on their own lines
+        CHECK(line_empty(SPRITE_Y - 1) && line_empty(SPRITE_Y + SPRITE_SIZE), "Sprites on line %d drawn outside of it", SPRITE_Y)
+    }
+
+    // A sprite with a Y past the bottom of the screen starts above the top instead
+    gba_write_half(IO(IO_DISPCNT), 0x1040);
+    clear_oam();
+    set_sprite(0, false, FIRST_X, 256 - 16, 1);
+    write_halves(0x07000000, (const byte*)oam, 8);
+    CHECK(sprite_pixels(0, FIRST_X, 1) == SPRITE_SIZE, "Sprite wrapping around to the top isn't on line 0")
+    CHECK(sprite_pixels(SPRITE_SIZE - 17, FIRST_X, 1) == SPRITE_SIZE, "Sprite wrapping around to the top ends early")
+    CHECK(line_empty(SPRITE_SIZE - 16), "Sprite wrapping around to the top goes on for too long")
+}
+
+int main(int argc, char** argv) {
+    init_gbasystem("arm.gba", NULL);
+    skip_bios(cpu);
+
+    test_vram();
+    test_pram();
+    test_text_bg();
+    test_oam();
+
+    exit(report_failures());
+}
@@ -0,0 +1,58 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/common/log.h"
+#include "../src/gba_system.h"
+#include "test_common.h"
+
+// What the game pak bus gives back past the end of the ROM
+static half past_end(word address) {
+    return (address & 0x1FFFFFF) >> 1;
+}
+
+// How many mappings of the file there are in this process. The file's last page is split off from the rest.
+static int rom_mappings(const char* name) {
+    FILE* maps = fopen("/proc/self/maps", "r");
+    char line[512];
+    int mappings = 0;
+    while (fgets(line, sizeof(line), maps)) {
+        if (strstr(line, name)) {
+            mappings++;
+        }
+    }
+    fclose(maps);
+    return mappings;
+}
+
+int main(int argc, char** argv) {
+    // Booting again unmaps the ROM of the last boot
+    init_gbasystem("arm.gba", NULL);
+    int mappings = rom_mappings("arm.gba");
+    for (int boot = 0; boot < 2; boot++) {
+        init_gbasystem("arm.gba", NULL);
+    }
+    skip_bios(cpu);
+    CHECK(rom_mappings("arm.gba") == mappings, "%d mappings of arm.gba after booting it 3 times, %d after once",
+          rom_mappings("arm.gba"), mappings)
+
+    // The padded part is mapped, the rest goes through the slow path. Both have to give the same thing.
+    word padded_end = mem->rom_mask + 1;
+    word addresses[] = {
+            mem->rom_size + (mem->rom_size & 1), padded_end - 2, padded_end, padded_end + 0x1236, 0x1FFFFFE
+    };
+    for (int i = 0; i < sizeof(addresses) / sizeof(addresses[0]); i++) {
+        for (word window = 0x08000000; window < 0x0E000000; window += 0x02000000) {
+            word address = window + addresses[i];
+            CHECK(gba_read_half(address) == past_end(address), "Read 0x%04X from 0x%08X past the end of the ROM",
+                  gba_read_half(address), address)
+            CHECK(gba_read_byte(address + 1) == past_end(address) >> 8, "Read 0x%02X from 0x%08X past the end of the ROM",
+                  gba_read_byte(address + 1), address + 1)
+        }
+        word address = 0x08000000 + (addresses[i] & ~3);
+        CHECK(gba_read_word(address) == (past_end(address) | (past_end(address + 2) << 16)),
+              "Read 0x%08X from 0x%08X past the end of the ROM", gba_read_word(address), address)
+    }
+
+    exit(report_failures());
+}
@@ -0,0 +1,99 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../src/common/log.h"
+#include "../src/gba_system.h"
+#include "../src/scheduler.h"
+#include "../src/mem/ioreg_names.h"
+#include "test_common.h"
+
+// Steps the timers one cycle at a time, the way they used to be run, to compare the lazy ones against
+typedef struct reference_timer {
+    half reload;
+    half control;
+    half value;
+    int prescaler;
+} reference_timer_t;
+
+static reference_timer_t reference[4];
+static half reference_if = 0;
+static const int frequencies[4] = {1, 64, 256, 1024};
+
+static void reference_increment(int n) {
+    if (reference[n].value == 0xFFFF) {
+        reference[n].value = reference[n].reload;
+        if (reference[n].control & 0x40) {
+            reference_if |= 1 << (3 + n);
+        }
+        if (n < 3 && (reference[n + 1].control & 0x84) == 0x84) {
+            reference_increment(n + 1);
+        }
+    } else {
+        reference[n].value++;
+    }
+}
+
+static void reference_step() {
+    for (int n = 0; n < 4; n++) {
+        bool cascade = n > 0 && (reference[n].control & 0x4);
+        if ((reference[n].control & 0x80) && !cascade && ++reference[n].prescaler == frequencies[reference[n].control & 3]) {
+            reference[n].prescaler = 0;
+            reference_increment(n);
+        }
+    }
+}
+
+static void reference_write_control(int n, half value) {
+    half old = reference[n].control;
+    reference[n].control = value;
+    if (!(old & 0x80) && (value & 0x80)) {
+        reference[n].value = reference[n].reload;
+        reference[n].prescaler = 0;
+    } else if ((old & 0x7) != (value & 0x7)) {
+        reference[n].prescaler = 0;
+    }
+}
+
+int main(int argc, char** argv) {
+    init_gbasystem("arm.gba", NULL);
+    skip_bios(cpu);
+    // Only the timers are being tested, keep the PPU out of it
+    cancel_event(EVENT_HBLANK);
+    cancel_event(EVENT_HDRAW);
+    gba_write_half(IO(IO_IE), 0xFFFF);
+    gba_write_half(IO(IO_IME), 1);
+
+    srand(1234);
+    for (int i = 0; i < 20000 && failures < 10; i++) {
+        int n = rand() % 4;
+        word address = IO(IO_TM0CNT_L) + n * 4;
+        if (rand() % 2) {
+            half reload = 0xFFFF - rand() % 0x200;
+            reference[n].reload = reload;
+            gba_write_half(address, reload);
+        } else {
+            // Slow prescalers only rarely, so there are plenty of overflows
+            half control = (rand() & 0xC4) | (rand() % 8 == 0 ? rand() % 4 : 0);
+            reference_write_control(n, control);
+            gba_write_half(address + 2, control);
+        }
+
+        int cycles = rand() % 700;
+        for (int c = 0; c < cycles; c++) {
+            reference_step();
+        }
+        current_cycle += cycles;
+        run_events();
+
+        for (int t = 0; t < 4; t++) {
+            half value = gba_read_half(IO(IO_TM0CNT_L) + t * 4);
+            CHECK(value == reference[t].value, "Step %d: timer %d is 0x%04X, expected 0x%04X", i, t, value, reference[t].value)
+        }
+        half timer_irqs = bus->IF.raw & 0x78;
+        CHECK(timer_irqs == reference_if, "Step %d: timer IRQs are 0x%02X, expected 0x%02X", i, timer_irqs, reference_if)
+        gba_write_half(IO(IO_IF), timer_irqs);
+        reference_if = 0;
+    }
+
+    exit(report_failures());
+}